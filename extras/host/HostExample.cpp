@@ -0,0 +1,60 @@
+/**
+ * HostExample.cpp
+ *
+ * Runs StompClient on the host against the mock WebSocketsClient: the broker's side of the conversation is scripted
+ * with queueText(), and the frames the client sends are read back from sent().
+ */
+
+#include <Arduino.h>
+#include <WebSocketsClient.h>
+#include "StompClient.h"
+
+WebSocketsClient webSocket;
+
+Stomp::StompClient stomper(webSocket, "broker.example", 61614, "/ws", false);
+
+int received = 0;
+
+Stomp::Stomp_Ack_t handleMessage(const Stomp::StompCommand &message) {
+    received++;
+    Serial.println("MESSAGE " + message.body);
+    return Stomp::ACK;
+}
+
+void subscribe(const Stomp::StompCommand &frame) {
+    stomper.subscribe("/topic/greetings", Stomp::CLIENT, handleMessage);
+    stomper.sendMessage("/app/hello", "{\"name\":\"host\"}");
+}
+
+void printSent() {
+    for (const String &frame: webSocket.sent()) {
+        Serial.print("> ");
+        String line = frame.substring(0, frame.indexOf('\n'));
+        Serial.println(line);
+    }
+    webSocket.sent().clear();
+}
+
+int main() {
+    ArduinoShim::useManualClock();
+
+    stomper.onConnect(subscribe);
+    stomper.begin();
+    stomper.loop();
+    printSent();
+
+    webSocket.queueText("CONNECTED\nversion:1.2\nheart-beat:0,0\n\n");
+    stomper.loop();
+    printSent();
+
+    webSocket.queueText("MESSAGE\ndestination:/topic/greetings\nsubscription:sub-0\nmessage-id:1\nack:1\n\n"
+                        "{\"greeting\":\"Hello, host\"}");
+    stomper.loop();
+    printSent();
+
+    stomper.disconnect();
+    stomper.loop();
+    printSent();
+
+    return received == 1 ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+/**
+ * The counting operator new / delete and String hooks declared in StompAllocCounter.h
+ */
+
+#include <Arduino.h>
+#include "StompAllocCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+    bool counting = false;
+    StompHost::Allocations count;
+
+    void countAllocation(size_t size) {
+        if (counting) {
+            count.allocations++;
+            count.bytes += size;
+        }
+    }
+
+    void *reallocate(void *ptr, size_t size) {
+        if (counting) {
+            count.stringAllocations++;
+            count.stringBytes += size;
+        }
+        countAllocation(size);
+        return realloc(ptr, size);
+    }
+
+    void release(void *ptr) {
+        free(ptr);
+    }
+
+}
+
+namespace StompHost {
+
+    void installAllocationHooks() {
+        ArduinoShim::allocHooks() = {reallocate, release};
+    }
+
+    bool countAllocations(bool enabled) {
+        bool previous = counting;
+        counting = enabled;
+        return previous;
+    }
+
+    const Allocations &allocationCount() {
+        return count;
+    }
+
+    void resetAllocationCount() {
+        count = Allocations();
+    }
+
+}
+
+// Every replaceable form is defined, so that no allocation reaches the library's operator new uncounted, and no
+// pointer from one family is freed by the other
+
+void *operator new(size_t size) {
+    countAllocation(size);
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    countAllocation(size);
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    countAllocation(size);
+    size_t align = (size_t) alignment < sizeof(void *) ? sizeof(void *) : (size_t) alignment;
+    void *p = nullptr;
+    if (posix_memalign(&p, align, size ? size : 1) != 0) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    countAllocation(size);
+    size_t align = (size_t) alignment < sizeof(void *) ? sizeof(void *) : (size_t) alignment;
+    void *p = nullptr;
+    return posix_memalign(&p, align, size ? size : 1) == 0 ? p : nullptr;
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return operator new(size, alignment, std::nothrow);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+    free(p);
+}
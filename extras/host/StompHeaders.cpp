@@ -0,0 +1,30 @@
+/**
+ * Includes every header of the library that can be built on the host. StompOutboxLittleFS.h needs the ESP8266 core and
+ * is left out.
+ */
+
+#include <Arduino.h>
+#include <WebSocketsClient.h>
+
+#include "Stomp.h"
+#include "StompBatch.h"
+#include "StompClient.h"
+#include "StompCommandParser.h"
+#include "StompDedup.h"
+#include "StompDelegate.h"
+#include "StompFlightRecorder.h"
+#include "StompHeaderFilter.h"
+#include "StompInboundQueue.h"
+#include "StompJson.h"
+#include "StompLog.h"
+#include "StompMetrics.h"
+#include "StompOutbox.h"
+#include "StompOutboxMmap.h"
+#include "StompProfiler.h"
+#include "StompRetry.h"
+#include "StompStateMachine.h"
+#include "StompSockJS.h"
+#include "StompSubscriptions.h"
+#include "StompTimers.h"
+#include "StompTopicRouter.h"
+#include "StompTracer.h"
@@ -0,0 +1,297 @@
+/**
+ * StompBench.cpp
+ *
+ * Microbenchmarks of the frame paths on the host, run over the frames in corpus/:
+ *  - parse:     StompCommandParser::parse()
+ *  - lookup:    StompHeaders::getValue() of "message-id" and "ack" on a parsed frame
+ *  - peek:      StompCommandParser::peekHeader() of the same headers on the raw frame
+ *  - send:      StompClient::sendMessage() with each MESSAGE's destination and body (serialisation and the send path)
+ *  - send+hdr:  StompClient::sendMessageAndHeaders() with each MESSAGE's other headers as well
+ *  - dispatch:  a raw MESSAGE handed to the client by the socket, through to the subscription's handler
+ *
+ * For each benchmark and corpus file it reports ns/frame, bytes/s and heap allocations (operator new and String
+ * buffers) per frame.
+ *
+ *     stomp_bench [--corpus DIR] [--filter TEXT] [--time SECONDS] [--json FILE] [--label TEXT]
+ *
+ * The corpus format is described in StompCorpus.h.
+ */
+
+#include <Arduino.h>
+#include <WebSocketsClient.h>
+#include "StompAllocCounter.h"
+#include "StompClient.h"
+#include "StompCorpus.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifndef STOMP_BENCH_CORPUS
+#define STOMP_BENCH_CORPUS "corpus"
+#endif
+
+namespace {
+
+    struct Frame {
+        String text;
+        bool message;
+        String destination;
+        String body;
+        Stomp::StompHeaders extra;  // the headers other than destination
+    };
+
+    struct FrameSet {
+        std::string name;
+        std::vector<Frame> frames;
+        uint64_t bytes = 0;
+    };
+
+    struct Result {
+        std::string benchmark;
+        std::string corpus;
+        uint64_t frames;
+        double bytesPerFrame;
+        double nsPerFrame;
+        double bytesPerSecond;
+        double allocationsPerFrame;
+        double allocatedBytesPerFrame;
+    };
+
+    struct Options {
+        std::string corpus = STOMP_BENCH_CORPUS;
+        std::string filter;
+        std::string json;
+        std::string label;
+        double seconds = 0.1;
+    };
+
+    /**
+     * Parse the frames of a corpus file once, for the benchmarks which need their parts
+     */
+    FrameSet prepare(const StompHost::Corpus &corpus) {
+        FrameSet set;
+        set.name = corpus.name;
+        for (const String &text: corpus.frames) {
+            Frame frame;
+            frame.text = text;
+            Stomp::StompCommand parsed = Stomp::StompCommandParser::parse(frame.text);
+            frame.message = parsed.command.equals("MESSAGE");
+            frame.destination = parsed.headers.getValue("destination");
+            frame.body = parsed.body;
+            for (uint8_t i = 0; i < parsed.headers.size(); i++) {
+                Stomp::StompHeader header = parsed.headers.get(i);
+                if (!header.key.equals("destination")) {
+                    frame.extra.append(header);
+                }
+            }
+            set.bytes += frame.text.length();
+            set.frames.push_back(std::move(frame));
+        }
+        return set;
+    }
+
+    /**
+     * A client connected to the mock socket, subscribed to sub-0 in AUTO mode
+     */
+    struct ConnectedClient {
+        WebSocketsClient webSocket;
+        Stomp::StompClient client;
+        uint64_t handled = 0;
+
+        ConnectedClient() : client(webSocket, "bench", 61613, "/ws", false) {
+            client.begin();
+            webSocket.queueText("CONNECTED\nversion:1.2\nheart-beat:0,0\n\n");
+            client.loop();
+            client.subscribe("/topic/bench", Stomp::AUTO, [this](const Stomp::StompCommand &) {
+                handled++;
+                return Stomp::CONTINUE;
+            });
+            webSocket.setRecording(false);
+        }
+    };
+
+    template<typename Operation>
+    bool run(std::vector<Result> &results, const Options &options, const char *benchmark, FrameSet &corpus,
+             bool messagesOnly, Operation operation) {
+        std::string name = std::string(benchmark) + "/" + corpus.name;
+        if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+            return false;
+        }
+
+        std::vector<Frame *> frames;
+        uint64_t bytes = 0;
+        for (auto &frame: corpus.frames) {
+            if (!messagesOnly || frame.message) {
+                frames.push_back(&frame);
+                bytes += frame.text.length();
+            }
+        }
+        if (frames.empty()) {
+            return false;
+        }
+
+        for (auto frame: frames) {
+            operation(*frame);
+        }
+
+        typedef std::chrono::steady_clock Clock;
+        auto budget = std::chrono::duration<double>(options.seconds);
+        uint64_t passes = 0;
+        StompHost::resetAllocationCount();
+        StompHost::countAllocations(true);
+        Clock::time_point start = Clock::now();
+        Clock::duration elapsed;
+        do {
+            for (auto frame: frames) {
+                operation(*frame);
+            }
+            passes++;
+            elapsed = Clock::now() - start;
+        } while (elapsed < budget);
+        StompHost::countAllocations(false);
+        const StompHost::Allocations &allocations = StompHost::allocationCount();
+
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        uint64_t count = passes * frames.size();
+        results.push_back({benchmark, corpus.name, count, (double) bytes / frames.size(), seconds * 1e9 / count,
+                           bytes * passes / seconds, (double) allocations.allocations / count,
+                           (double) allocations.bytes / count});
+
+        const Result &r = results.back();
+        printf("%-10s %-18s %10llu %8.0f %10.1f %10.2f %8.2f %10.1f\n", r.benchmark.c_str(), r.corpus.c_str(),
+               (unsigned long long) r.frames, r.bytesPerFrame, r.nsPerFrame, r.bytesPerSecond / 1e6,
+               r.allocationsPerFrame, r.allocatedBytesPerFrame);
+        return true;
+    }
+
+    bool writeJson(const Options &options, const std::vector<Result> &results) {
+        FILE *out = fopen(options.json.c_str(), "w");
+        if (!out) {
+            return false;
+        }
+        fprintf(out, "{\n  \"label\": \"%s\",\n  \"results\": [\n", options.label.c_str());
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result &r = results[i];
+            fprintf(out, "    {\"benchmark\": \"%s\", \"corpus\": \"%s\", \"frames\": %llu, \"bytes_per_frame\": %.1f, "
+                         "\"ns_per_frame\": %.2f, \"bytes_per_second\": %.0f, \"allocations_per_frame\": %.3f, "
+                         "\"allocated_bytes_per_frame\": %.1f}%s\n",
+                    r.benchmark.c_str(), r.corpus.c_str(), (unsigned long long) r.frames, r.bytesPerFrame,
+                    r.nsPerFrame, r.bytesPerSecond, r.allocationsPerFrame, r.allocatedBytesPerFrame,
+                    i + 1 < results.size() ? "," : "");
+        }
+        fprintf(out, "  ]\n}\n");
+        return fclose(out) == 0;
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc) {
+                return false;
+            }
+            if (arg == "--corpus") {
+                options.corpus = argv[++i];
+            } else if (arg == "--filter") {
+                options.filter = argv[++i];
+            } else if (arg == "--time") {
+                options.seconds = atof(argv[++i]);
+            } else if (arg == "--json") {
+                options.json = argv[++i];
+            } else if (arg == "--label") {
+                options.label = argv[++i];
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--corpus DIR] [--filter TEXT] [--time SECONDS] [--json FILE] [--label TEXT]\n",
+                argv[0]);
+        return 2;
+    }
+
+    StompHost::installAllocationHooks();
+
+    std::vector<FrameSet> corpora;
+    for (const auto &corpus: StompHost::loadCorpora(options.corpus)) {
+        corpora.push_back(prepare(corpus));
+    }
+    if (corpora.empty()) {
+        fprintf(stderr, "no .stomp files in %s\n", options.corpus.c_str());
+        return 1;
+    }
+
+    ConnectedClient connected;
+    Stomp::StompClient &client = connected.client;
+    std::vector<Result> results;
+
+    printf("%-10s %-18s %10s %8s %10s %10s %8s %10s\n", "benchmark", "corpus", "frames", "bytes", "ns/frame", "MB/s",
+           "allocs", "alloc B");
+
+    for (auto &corpus: corpora) {
+        run(results, options, "parse", corpus, false, [](Frame &frame) {
+            Stomp::StompCommand command = Stomp::StompCommandParser::parse(frame.text);
+            (void) command;
+        });
+    }
+
+    for (auto &corpus: corpora) {
+        std::vector<Stomp::StompCommand> parsed;
+        for (auto &frame: corpus.frames) {
+            parsed.push_back(Stomp::StompCommandParser::parse(frame.text));
+        }
+        size_t next = 0;
+        run(results, options, "lookup", corpus, false, [&parsed, &next](Frame &) {
+            const Stomp::StompCommand &command = parsed[next++ % parsed.size()];
+            volatile unsigned int length = command.headers.getValue("message-id").length() +
+                                           command.headers.getValue("ack").length();
+            (void) length;
+        });
+    }
+
+    for (auto &corpus: corpora) {
+        run(results, options, "peek", corpus, false, [](Frame &frame) {
+            unsigned int length;
+            volatile const char *id = Stomp::StompCommandParser::peekHeader(frame.text, "message-id", &length);
+            volatile const char *ack = Stomp::StompCommandParser::peekHeader(frame.text, "ack", &length);
+            (void) id;
+            (void) ack;
+        });
+    }
+
+    for (auto &corpus: corpora) {
+        run(results, options, "send", corpus, true, [&client](Frame &frame) {
+            client.sendMessage(frame.destination, frame.body);
+        });
+    }
+
+    for (auto &corpus: corpora) {
+        run(results, options, "send+hdr", corpus, true, [&client](Frame &frame) {
+            client.sendMessageAndHeaders(frame.destination, frame.body, frame.extra);
+        });
+    }
+
+    for (auto &corpus: corpora) {
+        run(results, options, "dispatch", corpus, true, [&connected](Frame &frame) {
+            connected.webSocket.deliver(WStype_TEXT, (uint8_t *) frame.text.begin(), frame.text.length());
+        });
+    }
+
+    if (connected.handled == 0 && !results.empty() && options.filter.empty()) {
+        fprintf(stderr, "dispatch did not reach the handler\n");
+        return 1;
+    }
+
+    if (!options.json.empty() && !writeJson(options, results)) {
+        fprintf(stderr, "could not write %s\n", options.json.c_str());
+        return 1;
+    }
+    return 0;
+}
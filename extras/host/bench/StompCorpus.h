@@ -0,0 +1,65 @@
+/**
+ * Loads the frame corpus used by the host benchmarks and soak test. Corpus files (*.stomp) hold frames as received,
+ * each followed by a line "^@" in place of the NULL octet.
+ */
+
+#ifndef STOMP_HOST_CORPUS_H
+#define STOMP_HOST_CORPUS_H
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace StompHost {
+
+    struct Corpus {
+        std::string name;   // the file name without its extension, e.g. "rabbitmq-headers"
+        std::vector<String> frames;
+    };
+
+    inline Corpus loadCorpus(const std::filesystem::path &path) {
+        std::ifstream in(path, std::ios::binary);
+        std::stringstream contents;
+        contents << in.rdbuf();
+        std::string text = contents.str();
+
+        Corpus corpus;
+        corpus.name = path.stem().string();
+
+        const std::string terminator = "\n^@\n";
+        size_t start = 0;
+        size_t end;
+        while ((end = text.find(terminator, start)) != std::string::npos) {
+            corpus.frames.emplace_back(text.data() + start, (unsigned int) (end - start));
+            start = end + terminator.length();
+        }
+        return corpus;
+    }
+
+    /**
+     * Every *.stomp file in directory, in name order
+     */
+    inline std::vector<Corpus> loadCorpora(const std::string &directory) {
+        std::vector<std::filesystem::path> paths;
+        for (const auto &entry: std::filesystem::directory_iterator(directory)) {
+            if (entry.path().extension() == ".stomp") {
+                paths.push_back(entry.path());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+
+        std::vector<Corpus> corpora;
+        for (const auto &path: paths) {
+            corpora.push_back(loadCorpus(path));
+        }
+        return corpora;
+    }
+
+}
+
+#endif
@@ -0,0 +1,180 @@
+/**
+ * StompLoopbackBench.cpp
+ *
+ * End-to-end throughput and latency of the whole StompClient stack against the loopback broker: a client subscribed
+ * to a destination sends to it with a fixed number of messages in flight, and times each one until its own handler
+ * receives it. Runs over raw WebSocket and SockJS framing, in AUTO and CLIENT_INDIVIDUAL modes, with small and large
+ * bodies.
+ *
+ *     stomp_loopback_bench [--messages N] [--window N] [--json FILE] [--label TEXT]
+ */
+
+#include <Arduino.h>
+#include <WebSocketsClient.h>
+#include "StompClient.h"
+#include "StompLoopbackBroker.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace {
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Options {
+        uint32_t messages = 20000;
+        uint32_t window = 8;
+        std::string json;
+        std::string label;
+    };
+
+    struct Result {
+        std::string name;
+        uint32_t messages;
+        double messagesPerSecond;
+        double p50;
+        double p99;
+        double max;
+        double framesPerMessage;
+    };
+
+    /**
+     * Send times of the messages in flight and the latencies of those received
+     */
+    struct Timings {
+        std::vector<Clock::time_point> sentAt;
+        std::vector<double> latencies;
+        Stomp::Stomp_Ack_t reply;
+
+        Stomp::Stomp_Ack_t received(const Stomp::StompCommand &message) {
+            uint32_t sequence = (uint32_t) message.body.toInt();
+            if (sequence < sentAt.size()) {
+                latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sentAt[sequence]).count());
+            }
+            return reply;
+        }
+    };
+
+    Result run(const Options &options, bool sockjs, Stomp::Stomp_AckMode_t ackMode, unsigned int bodySize) {
+        StompHost::LoopbackBroker broker(sockjs);
+        WebSocketsClient webSocket;
+        webSocket.setPeer(&broker);
+        webSocket.setRecording(false);
+        Stomp::StompClient client(webSocket, "loopback", 61613, "/ws", sockjs);
+
+        Timings timings;
+        timings.reply = ackMode == Stomp::AUTO ? Stomp::CONTINUE : Stomp::ACK;
+        timings.sentAt.resize(options.messages);
+        timings.latencies.reserve(options.messages);
+        std::vector<double> &latencies = timings.latencies;
+
+        client.onConnect([&client, &timings, ackMode](const Stomp::StompCommand &) {
+            client.subscribe("/queue/bench", ackMode, Stomp::StompMessageHandler(&timings, &Timings::received));
+        });
+        client.begin();
+        while (client.state() != Stomp::CONNECTED) {
+            broker.loop();
+            client.loop();
+        }
+        broker.resetStats();
+
+        String padding;
+        while (padding.length() < bodySize) {
+            padding += "x";
+        }
+
+        uint32_t sent = 0;
+        Clock::time_point start = Clock::now();
+        while (latencies.size() < options.messages) {
+            while (sent < options.messages && sent - latencies.size() < options.window) {
+                timings.sentAt[sent] = Clock::now();
+                String body(sent);
+                body += " ";
+                body += padding;
+                client.sendMessage("/queue/bench", body);
+                sent++;
+            }
+            broker.loop();
+            client.loop();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::sort(latencies.begin(), latencies.end());
+        const StompHost::LoopbackBroker::Stats &stats = broker.stats();
+        std::string name = std::string(sockjs ? "sockjs" : "raw") + "/" +
+                           (ackMode == Stomp::AUTO ? "auto" : "client-individual") + "/" + std::to_string(bodySize);
+        return {name, options.messages, options.messages / seconds, latencies[latencies.size() / 2],
+                latencies[latencies.size() * 99 / 100], latencies.back(),
+                (double) (stats.framesIn + stats.framesOut) / options.messages};
+    }
+
+    bool writeJson(const Options &options, const std::vector<Result> &results) {
+        FILE *out = fopen(options.json.c_str(), "w");
+        if (!out) {
+            return false;
+        }
+        fprintf(out, "{\n  \"label\": \"%s\",\n  \"results\": [\n", options.label.c_str());
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result &r = results[i];
+            fprintf(out, "    {\"benchmark\": \"%s\", \"messages\": %u, \"messages_per_second\": %.0f, "
+                         "\"latency_p50_us\": %.2f, \"latency_p99_us\": %.2f, \"latency_max_us\": %.2f, "
+                         "\"frames_per_message\": %.2f}%s\n",
+                    r.name.c_str(), r.messages, r.messagesPerSecond, r.p50, r.p99, r.max, r.framesPerMessage,
+                    i + 1 < results.size() ? "," : "");
+        }
+        fprintf(out, "  ]\n}\n");
+        return fclose(out) == 0;
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc) {
+                return false;
+            }
+            if (arg == "--messages") {
+                options.messages = (uint32_t) atol(argv[++i]);
+            } else if (arg == "--window") {
+                options.window = (uint32_t) atol(argv[++i]);
+            } else if (arg == "--json") {
+                options.json = argv[++i];
+            } else if (arg == "--label") {
+                options.label = argv[++i];
+            } else {
+                return false;
+            }
+        }
+        return options.messages > 0 && options.window > 0;
+    }
+
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--messages N] [--window N] [--json FILE] [--label TEXT]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<Result> results;
+    printf("%-32s %10s %12s %10s %10s %10s %8s\n", "benchmark", "messages", "msg/s", "p50 us", "p99 us", "max us",
+           "frames");
+    for (bool sockjs: {false, true}) {
+        for (Stomp::Stomp_AckMode_t ackMode: {Stomp::AUTO, Stomp::CLIENT_INDIVIDUAL}) {
+            for (unsigned int bodySize: {32u, 2048u}) {
+                results.push_back(run(options, sockjs, ackMode, bodySize));
+                const Result &r = results.back();
+                printf("%-32s %10u %12.0f %10.2f %10.2f %10.2f %8.2f\n", r.name.c_str(), r.messages,
+                       r.messagesPerSecond, r.p50, r.p99, r.max, r.framesPerMessage);
+            }
+        }
+    }
+
+    if (!options.json.empty() && !writeJson(options, results)) {
+        fprintf(stderr, "could not write %s\n", options.json.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * StompAllocBudget.cpp
+ *
+ * Heap allocations (operator new and String buffers) made by each public operation of a connected client in steady
+ * state, against a declared budget:
+ *  - sendMessage:  StompClient::sendMessage() of a short JSON body
+ *  - subscribe:    StompClient::subscribe() into a free slot
+ *  - dispatch:     an inbound MESSAGE handed over by the socket, through to the subscription's handler
+ *  - ack:          StompClient::ack() of a CLIENT_INDIVIDUAL message
+ *
+ * Each operation runs once to warm up and is then measured over --calls calls; the largest count of any one call is
+ * held against the budget. With --check the program fails if an operation goes over, so that a change which adds
+ * allocations to these paths breaks the build's tests. Lower a budget when a change removes allocations.
+ *
+ * This is a regression tripwire, not a guarantee of allocation-free operation: frames are still built and parsed
+ * into Strings, so each budget is the count the path needs today (one String per header field when dispatching,
+ * one frame buffer per ACK), not zero.
+ *
+ *     stomp_alloc_budget [--check] [--calls N]
+ */
+
+#include <Arduino.h>
+#include <WebSocketsClient.h>
+#include "StompAllocCounter.h"
+#include "StompClient.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+    struct Budget {
+        const char *operation;
+        uint32_t allocations;   // per call
+        uint32_t bytes;         // per call
+    };
+
+    // The declared budgets: today's counts, to be lowered as the paths stop allocating
+    const Budget budgets[] = {
+            {"sendMessage", 7,  256},
+            {"subscribe",   11, 192},
+            {"dispatch",    14, 384},
+            {"ack",         1,  48},
+    };
+
+    struct Options {
+        bool check = false;
+        uint32_t calls = 100;
+    };
+
+    struct Measurement {
+        StompHost::Allocations worst;   // the call with the most allocations
+        StompHost::Allocations total;
+        uint32_t calls = 0;
+    };
+
+    /**
+     * A client connected to the mock socket, with an AUTO and a CLIENT_INDIVIDUAL subscription
+     */
+    struct ConnectedClient {
+        WebSocketsClient webSocket;
+        Stomp::StompClient client;
+        uint32_t handled = 0;
+
+        ConnectedClient() : client(webSocket, "budget", 61613, "/ws", false) {
+            client.begin();
+            webSocket.queueText("CONNECTED\nversion:1.2\nheart-beat:0,0\n\n");
+            client.loop();
+            client.subscribe("/topic/budget", Stomp::AUTO, Stomp::StompMessageHandler(this, &ConnectedClient::update));
+            client.subscribe("/queue/budget", Stomp::CLIENT_INDIVIDUAL,
+                             Stomp::StompMessageHandler(this, &ConnectedClient::update));
+            webSocket.setRecording(false);
+        }
+
+        Stomp::Stomp_Ack_t update(const Stomp::StompCommand &) {
+            handled++;
+            return Stomp::CONTINUE;
+        }
+    };
+
+    /**
+     * Run operation once, then measure it over options.calls calls. prepare runs before each call, uncounted
+     */
+    template<typename Prepare, typename Operation>
+    Measurement measure(const Options &options, Prepare prepare, Operation operation) {
+        prepare();
+        operation();
+
+        Measurement m;
+        for (uint32_t i = 0; i < options.calls; i++) {
+            prepare();
+            StompHost::Allocations used;
+            {
+                StompHost::AllocationScope scope;
+                operation();
+                used = scope.result();
+            }
+            if (used.allocations > m.worst.allocations ||
+                (used.allocations == m.worst.allocations && used.bytes > m.worst.bytes)) {
+                m.worst = used;
+            }
+            m.total.allocations += used.allocations;
+            m.total.bytes += used.bytes;
+            m.calls++;
+        }
+        return m;
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--check") {
+                options.check = true;
+            } else if (arg == "--calls" && i + 1 < argc) {
+                options.calls = (uint32_t) atol(argv[++i]);
+            } else {
+                return false;
+            }
+        }
+        return options.calls > 0;
+    }
+
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--check] [--calls N]\n", argv[0]);
+        return 2;
+    }
+
+    StompHost::installAllocationHooks();
+    ConnectedClient connected;
+    Stomp::StompClient &client = connected.client;
+
+    const String body = "{\"sensor\":\"budget\",\"temperature\":21.5,\"humidity\":40.25,\"seq\":123456}";
+    const String message = "MESSAGE\ndestination:/topic/budget\nsubscription:sub-0\nmessage-id:m-1\n"
+                           "content-type:application/json\ncontent-length:" + String(body.length()) + "\n\n" + body;
+    const Stomp::StompCommand ackable = Stomp::StompCommandParser::parse(
+            "MESSAGE\ndestination:/queue/budget\nsubscription:sub-1\nmessage-id:m-2\nack:m-2\n\n" + body);
+    std::vector<char> buffer;
+    int subscription = -1;
+
+    std::vector<Measurement> measurements;
+    auto nothing = []() {};
+    measurements.push_back(measure(options, nothing, [&]() {
+        client.sendMessage("/queue/budget", body);
+    }));
+    measurements.push_back(measure(options, [&]() {
+        if (subscription != -1) client.unsubscribe(subscription);
+    }, [&]() {
+        subscription = client.subscribe("/topic/other", Stomp::AUTO,
+                                        Stomp::StompMessageHandler(&connected, &ConnectedClient::update));
+    }));
+    measurements.push_back(measure(options, [&]() {
+        // the socket's receive buffer, refilled each time since the client may parse it in place
+        buffer.assign(message.c_str(), message.c_str() + message.length() + 1);
+    }, [&]() {
+        connected.webSocket.deliver(WStype_TEXT, (uint8_t *) buffer.data(), message.length());
+    }));
+    measurements.push_back(measure(options, nothing, [&]() {
+        client.ack(ackable);
+    }));
+
+    printf("%-12s %8s %8s %8s %8s %8s %8s\n", "operation", "allocs", "bytes", "string", "mean", "budget", "budget B");
+    int over = 0;
+    for (size_t i = 0; i < measurements.size(); i++) {
+        const Budget &budget = budgets[i];
+        const Measurement &m = measurements[i];
+        bool exceeded = m.worst.allocations > budget.allocations || m.worst.bytes > budget.bytes;
+        over += exceeded;
+        printf("%-12s %8llu %8llu %8llu %8.2f %8u %8u  %s\n", budget.operation,
+               (unsigned long long) m.worst.allocations, (unsigned long long) m.worst.bytes,
+               (unsigned long long) m.worst.stringAllocations, (double) m.total.allocations / m.calls,
+               budget.allocations, budget.bytes, exceeded ? "OVER" : "ok");
+    }
+
+    if (connected.handled < options.calls + 1) {
+        fprintf(stderr, "dispatch did not reach the handler\n");
+        return 1;
+    }
+    printf("\nbudgets are a regression tripwire at today's counts, not a zero-allocation guarantee\n");
+    if (options.check && over > 0) {
+        fprintf(stderr, "%d operation(s) over their allocation budget\n", over);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,598 @@
+/**
+ * Minimal Arduino API shim used to build StompClient on a Linux host.
+ *
+ * Only the parts of the Arduino / ESP8266 core which the library actually uses are provided: a String class with the
+ * ESP8266 WString interface, millis() / micros() / yield() / random(), and a Print based Serial.
+ *
+ * The clock can be switched to manual mode so that tests can step time deterministically.
+ */
+
+#ifndef STOMP_HOST_ARDUINO_H
+#define STOMP_HOST_ARDUINO_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cstdarg>
+#include <utility>
+
+namespace ArduinoShim {
+
+    /**
+     * Allocation functions used by String. Replace these to observe or model heap behaviour.
+     */
+    struct AllocHooks {
+        void *(*reallocate)(void *ptr, size_t size);
+        void (*release)(void *ptr);
+    };
+
+    inline AllocHooks &allocHooks() {
+        static AllocHooks hooks = {
+                [](void *ptr, size_t size) { return realloc(ptr, size); },
+                [](void *ptr) { free(ptr); }
+        };
+        return hooks;
+    }
+
+    struct Clock {
+        bool manual = false;
+        uint64_t manualMicros = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        uint64_t nowMicros() const {
+            if (manual) return manualMicros;
+            return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+        }
+    };
+
+    inline Clock &clock() {
+        static Clock c;
+        return c;
+    }
+
+    /**
+     * Freeze the clock at its current value. Time then only moves through advanceMillis() / advanceMicros()
+     */
+    inline void useManualClock() {
+        Clock &c = clock();
+        c.manualMicros = c.nowMicros();
+        c.manual = true;
+    }
+
+    inline void advanceMicros(uint64_t us) {
+        clock().manualMicros += us;
+    }
+
+    inline void advanceMillis(uint64_t ms) {
+        clock().manualMicros += ms * 1000;
+    }
+}
+
+inline unsigned long millis() {
+    return (unsigned long) (ArduinoShim::clock().nowMicros() / 1000);
+}
+
+inline unsigned long micros() {
+    return (unsigned long) ArduinoShim::clock().nowMicros();
+}
+
+inline void yield() {
+}
+
+inline void delay(unsigned long ms) {
+    if (ArduinoShim::clock().manual) {
+        ArduinoShim::advanceMillis(ms);
+    }
+}
+
+inline long random(long howsmall, long howbig) {
+    if (howsmall >= howbig) return howsmall;
+    return howsmall + (rand() % (howbig - howsmall));
+}
+
+inline long random(long howbig) {
+    return random(0, howbig);
+}
+
+class String {
+
+public:
+    String() = default;
+
+    String(const char *cstr) {
+        if (cstr) _assign(cstr, strlen(cstr));
+    }
+
+    String(const char *cstr, unsigned int length) {
+        if (cstr) _assign(cstr, length);
+    }
+
+    String(const String &other) {
+        if (other._buffer) _assign(other._buffer, other._len);
+    }
+
+    String(String &&other) noexcept: _buffer(other._buffer), _len(other._len), _capacity(other._capacity) {
+        other._buffer = nullptr;
+        other._len = 0;
+        other._capacity = 0;
+    }
+
+    explicit String(char c) {
+        _assign(&c, 1);
+    }
+
+    explicit String(unsigned char value, unsigned char base = 10) : String((unsigned long) value, base) {}
+
+    explicit String(int value, unsigned char base = 10) : String((long) value, base) {}
+
+    explicit String(unsigned int value, unsigned char base = 10) : String((unsigned long) value, base) {}
+
+    explicit String(long value, unsigned char base = 10) {
+        if (value < 0 && base == 10) {
+            char buf[24];
+            int n = snprintf(buf, sizeof(buf), "%ld", value);
+            _assign(buf, n);
+        } else {
+            _fromUnsigned((unsigned long) value, base);
+        }
+    }
+
+    explicit String(unsigned long value, unsigned char base = 10) {
+        _fromUnsigned(value, base);
+    }
+
+    explicit String(double value, unsigned char decimalPlaces = 2) {
+        char buf[64];
+        int n = snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+        _assign(buf, n);
+    }
+
+    explicit String(float value, unsigned char decimalPlaces = 2) : String((double) value, decimalPlaces) {}
+
+    ~String() {
+        if (_buffer) ArduinoShim::allocHooks().release(_buffer);
+    }
+
+    String &operator=(const String &rhs) {
+        if (this != &rhs) {
+            if (rhs._buffer) {
+                _assign(rhs._buffer, rhs._len);
+            } else {
+                _invalidate();
+            }
+        }
+        return *this;
+    }
+
+    String &operator=(String &&rhs) noexcept {
+        if (this != &rhs) {
+            if (_buffer) ArduinoShim::allocHooks().release(_buffer);
+            _buffer = rhs._buffer;
+            _len = rhs._len;
+            _capacity = rhs._capacity;
+            rhs._buffer = nullptr;
+            rhs._len = 0;
+            rhs._capacity = 0;
+        }
+        return *this;
+    }
+
+    String &operator=(const char *cstr) {
+        if (cstr) {
+            _assign(cstr, strlen(cstr));
+        } else {
+            _invalidate();
+        }
+        return *this;
+    }
+
+    bool reserve(unsigned int size) {
+        if (_buffer && _capacity >= size) return true;
+        void *grown = ArduinoShim::allocHooks().reallocate(_buffer, size + 1);
+        if (!grown) return false;
+        _buffer = (char *) grown;
+        if (_capacity == 0) _buffer[0] = '\0';
+        _capacity = size;
+        return true;
+    }
+
+    unsigned int length() const {
+        return _len;
+    }
+
+    bool isEmpty() const {
+        return _len == 0;
+    }
+
+    const char *c_str() const {
+        return _buffer ? _buffer : "";
+    }
+
+    char *begin() {
+        return _buffer;
+    }
+
+    char *end() {
+        return _buffer + _len;
+    }
+
+    bool concat(const char *cstr, unsigned int length) {
+        if (!cstr || length == 0) return cstr != nullptr;
+        unsigned int newLen = _len + length;
+        if (!reserve(newLen)) return false;
+        memmove(_buffer + _len, cstr, length);
+        _len = newLen;
+        _buffer[_len] = '\0';
+        return true;
+    }
+
+    bool concat(const String &s) {
+        // copy first: s may alias *this
+        if (&s == this) {
+            String copy(s);
+            return concat(copy._buffer, copy._len);
+        }
+        return concat(s.c_str(), s._len);
+    }
+
+    bool concat(const char *cstr) {
+        return cstr && concat(cstr, strlen(cstr));
+    }
+
+    bool concat(char c) {
+        return concat(&c, 1);
+    }
+
+    bool concat(unsigned char num) { return concat(String(num)); }
+
+    bool concat(int num) { return concat(String(num)); }
+
+    bool concat(unsigned int num) { return concat(String(num)); }
+
+    bool concat(long num) { return concat(String(num)); }
+
+    bool concat(unsigned long num) { return concat(String(num)); }
+
+    bool concat(double num) { return concat(String(num)); }
+
+    template<typename T>
+    String &operator+=(const T &rhs) {
+        concat(rhs);
+        return *this;
+    }
+
+    String &operator+=(const char *rhs) {
+        concat(rhs);
+        return *this;
+    }
+
+    int compareTo(const String &s) const {
+        return strcmp(c_str(), s.c_str());
+    }
+
+    bool equals(const String &s) const {
+        return _len == s._len && memcmp(c_str(), s.c_str(), _len) == 0;
+    }
+
+    bool equals(const char *cstr) const {
+        if (!cstr) return _len == 0;
+        return strlen(cstr) == _len && memcmp(c_str(), cstr, _len) == 0;
+    }
+
+    bool equalsIgnoreCase(const String &s) const {
+        if (_len != s._len) return false;
+        for (unsigned int i = 0; i < _len; i++) {
+            if (tolower((unsigned char) _buffer[i]) != tolower((unsigned char) s._buffer[i])) return false;
+        }
+        return true;
+    }
+
+    bool operator==(const String &rhs) const { return equals(rhs); }
+
+    bool operator==(const char *rhs) const { return equals(rhs); }
+
+    bool operator!=(const String &rhs) const { return !equals(rhs); }
+
+    bool operator!=(const char *rhs) const { return !equals(rhs); }
+
+    bool operator<(const String &rhs) const { return compareTo(rhs) < 0; }
+
+    bool startsWith(const String &prefix) const {
+        return startsWith(prefix, 0);
+    }
+
+    bool startsWith(const String &prefix, unsigned int offset) const {
+        if (offset + prefix._len > _len) return false;
+        return memcmp(c_str() + offset, prefix.c_str(), prefix._len) == 0;
+    }
+
+    bool endsWith(const String &suffix) const {
+        if (suffix._len > _len) return false;
+        return memcmp(c_str() + _len - suffix._len, suffix.c_str(), suffix._len) == 0;
+    }
+
+    char charAt(unsigned int index) const {
+        return index < _len ? _buffer[index] : '\0';
+    }
+
+    char operator[](unsigned int index) const {
+        return charAt(index);
+    }
+
+    char &operator[](unsigned int index) {
+        static char dummy;
+        if (index >= _len) {
+            dummy = '\0';
+            return dummy;
+        }
+        return _buffer[index];
+    }
+
+    void setCharAt(unsigned int index, char c) {
+        if (index < _len) _buffer[index] = c;
+    }
+
+    int indexOf(char ch) const {
+        return indexOf(ch, 0);
+    }
+
+    int indexOf(char ch, unsigned int fromIndex) const {
+        if (fromIndex >= _len) return -1;
+        const char *p = (const char *) memchr(_buffer + fromIndex, ch, _len - fromIndex);
+        return p ? (int) (p - _buffer) : -1;
+    }
+
+    int indexOf(const String &s) const {
+        return indexOf(s, 0);
+    }
+
+    int indexOf(const String &s, unsigned int fromIndex) const {
+        if (s._len == 0) return fromIndex <= _len ? (int) fromIndex : -1;
+        if (fromIndex >= _len || s._len > _len) return -1;
+        for (unsigned int i = fromIndex; i + s._len <= _len; i++) {
+            if (_buffer[i] == s._buffer[0] && memcmp(_buffer + i, s._buffer, s._len) == 0) return (int) i;
+        }
+        return -1;
+    }
+
+    int indexOf(const char *s, unsigned int fromIndex = 0) const {
+        return indexOf(String(s), fromIndex);
+    }
+
+    int lastIndexOf(char ch) const {
+        for (int i = (int) _len - 1; i >= 0; i--) {
+            if (_buffer[i] == ch) return i;
+        }
+        return -1;
+    }
+
+    String substring(unsigned int beginIndex) const {
+        return substring(beginIndex, _len);
+    }
+
+    String substring(unsigned int beginIndex, unsigned int endIndex) const {
+        if (beginIndex > endIndex) std::swap(beginIndex, endIndex);
+        if (beginIndex >= _len) return String();
+        if (endIndex > _len) endIndex = _len;
+        return String(_buffer + beginIndex, endIndex - beginIndex);
+    }
+
+    void remove(unsigned int index) {
+        remove(index, (unsigned int) -1);
+    }
+
+    void remove(unsigned int index, unsigned int count) {
+        if (index >= _len) return;
+        if (count > _len - index) count = _len - index;
+        memmove(_buffer + index, _buffer + index + count, _len - index - count);
+        _len -= count;
+        _buffer[_len] = '\0';
+    }
+
+    void replace(const String &find, const String &replacement) {
+        if (find._len == 0) return;
+        String result;
+        int start = 0;
+        int idx;
+        while ((idx = indexOf(find, start)) != -1) {
+            result.concat(_buffer + start, idx - start);
+            result.concat(replacement);
+            start = idx + (int) find._len;
+        }
+        if (start == 0) return;
+        result.concat(_buffer + start, _len - start);
+        *this = std::move(result);
+    }
+
+    void toLowerCase() {
+        for (unsigned int i = 0; i < _len; i++) _buffer[i] = (char) tolower((unsigned char) _buffer[i]);
+    }
+
+    void toUpperCase() {
+        for (unsigned int i = 0; i < _len; i++) _buffer[i] = (char) toupper((unsigned char) _buffer[i]);
+    }
+
+    void trim() {
+        if (!_buffer || _len == 0) return;
+        unsigned int b = 0;
+        while (b < _len && isspace((unsigned char) _buffer[b])) b++;
+        unsigned int e = _len;
+        while (e > b && isspace((unsigned char) _buffer[e - 1])) e--;
+        _len = e - b;
+        if (b > 0) memmove(_buffer, _buffer + b, _len);
+        _buffer[_len] = '\0';
+    }
+
+    long toInt() const {
+        return _buffer ? atol(_buffer) : 0;
+    }
+
+    float toFloat() const {
+        return _buffer ? (float) atof(_buffer) : 0;
+    }
+
+    double toDouble() const {
+        return _buffer ? atof(_buffer) : 0;
+    }
+
+private:
+    char *_buffer = nullptr;
+    unsigned int _len = 0;
+    unsigned int _capacity = 0;
+
+    void _invalidate() {
+        if (_buffer) ArduinoShim::allocHooks().release(_buffer);
+        _buffer = nullptr;
+        _len = 0;
+        _capacity = 0;
+    }
+
+    void _assign(const char *cstr, unsigned int length) {
+        if (!reserve(length)) {
+            _invalidate();
+            return;
+        }
+        if (length > 0) memmove(_buffer, cstr, length);
+        _len = length;
+        _buffer[_len] = '\0';
+    }
+
+    void _fromUnsigned(unsigned long value, unsigned char base) {
+        char buf[8 * sizeof(unsigned long) + 1];
+        char *p = buf + sizeof(buf) - 1;
+        *p = '\0';
+        if (base < 2) base = 10;
+        do {
+            unsigned long digit = value % base;
+            *--p = (char) (digit < 10 ? '0' + digit : 'a' + digit - 10);
+            value /= base;
+        } while (value);
+        _assign(p, (unsigned int) (buf + sizeof(buf) - 1 - p));
+    }
+};
+
+inline String operator+(const String &lhs, const String &rhs) {
+    String s;
+    s.reserve(lhs.length() + rhs.length());
+    s.concat(lhs);
+    s.concat(rhs);
+    return s;
+}
+
+inline String operator+(String &&lhs, const String &rhs) {
+    lhs.concat(rhs);
+    return std::move(lhs);
+}
+
+inline String operator+(const String &lhs, const char *rhs) {
+    String s(lhs);
+    s.concat(rhs);
+    return s;
+}
+
+inline String operator+(String &&lhs, const char *rhs) {
+    lhs.concat(rhs);
+    return std::move(lhs);
+}
+
+inline String operator+(const char *lhs, const String &rhs) {
+    String s(lhs);
+    s.concat(rhs);
+    return s;
+}
+
+inline String operator+(const String &lhs, char rhs) {
+    String s(lhs);
+    s.concat(rhs);
+    return s;
+}
+
+inline String operator+(String &&lhs, char rhs) {
+    lhs.concat(rhs);
+    return std::move(lhs);
+}
+
+class Print {
+
+public:
+    virtual ~Print() = default;
+
+    virtual size_t write(uint8_t c) = 0;
+
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+
+    size_t write(const char *buffer, size_t size) {
+        return write((const uint8_t *) buffer, size);
+    }
+
+    virtual int availableForWrite() {
+        return 0;
+    }
+
+    size_t print(const char *s) { return write(s, strlen(s)); }
+
+    size_t print(const String &s) { return write(s.c_str(), s.length()); }
+
+    size_t print(char c) { return write((uint8_t) c); }
+
+    size_t print(int n) { return print(String(n)); }
+
+    size_t print(unsigned int n) { return print(String(n)); }
+
+    size_t print(long n) { return print(String(n)); }
+
+    size_t print(unsigned long n) { return print(String(n)); }
+
+    size_t print(double n, int digits = 2) { return print(String(n, (unsigned char) digits)); }
+
+    size_t println() { return print("\r\n"); }
+
+    template<typename T>
+    size_t println(const T &value) {
+        size_t n = print(value);
+        return n + println();
+    }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[256];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        if (n < 0) return 0;
+        return write(buf, (size_t) n < sizeof(buf) ? (size_t) n : sizeof(buf) - 1);
+    }
+};
+
+/**
+ * Serial writes to stdout. availableForWrite() reports a large buffer so non-blocking sinks always drain.
+ */
+class HardwareSerial : public Print {
+
+public:
+    void begin(unsigned long) {}
+
+    size_t write(uint8_t c) override {
+        return fwrite(&c, 1, 1, stdout);
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override {
+        return fwrite(buffer, 1, size, stdout);
+    }
+
+    int availableForWrite() override {
+        return 4096;
+    }
+};
+
+inline HardwareSerial Serial;
+
+#endif
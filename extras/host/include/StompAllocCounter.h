@@ -0,0 +1,81 @@
+/**
+ * Allocation counting for the host build. Link the stomp_alloc_counter library, which replaces the global operator
+ * new / delete, and call installAllocationHooks() at startup to route String buffers through the counter too. On the
+ * device these are the two ways the library reaches the heap.
+ *
+ * Counting is off until enabled, so that setup and reporting are not counted:
+ *
+ *     StompHost::AllocationScope scope;
+ *     client.sendMessage("/queue/a", body);
+ *     StompHost::Allocations used = scope.result();
+ */
+
+#ifndef STOMP_HOST_ALLOC_COUNTER_H
+#define STOMP_HOST_ALLOC_COUNTER_H
+
+#include <cstdint>
+
+namespace StompHost {
+
+    struct Allocations {
+        uint64_t allocations = 0;        // operator new and String buffer (re)allocations
+        uint64_t bytes = 0;
+        uint64_t stringAllocations = 0;  // the String buffer part of the above
+        uint64_t stringBytes = 0;
+
+        Allocations operator-(const Allocations &rhs) const {
+            Allocations d;
+            d.allocations = allocations - rhs.allocations;
+            d.bytes = bytes - rhs.bytes;
+            d.stringAllocations = stringAllocations - rhs.stringAllocations;
+            d.stringBytes = stringBytes - rhs.stringBytes;
+            return d;
+        }
+    };
+
+    /**
+     * Route String buffer allocations through the counter
+     */
+    void installAllocationHooks();
+
+    /**
+     * @return bool - Whether allocations were being counted before
+     */
+    bool countAllocations(bool counting);
+
+    /**
+     * Everything counted since the last resetAllocationCount()
+     */
+    const Allocations &allocationCount();
+
+    void resetAllocationCount();
+
+    /**
+     * Counts the allocations made during its lifetime
+     */
+    class AllocationScope {
+
+    public:
+        AllocationScope() : _start(allocationCount()), _previous(countAllocations(true)) {
+        }
+
+        ~AllocationScope() {
+            countAllocations(_previous);
+        }
+
+        AllocationScope(const AllocationScope &) = delete;
+
+        AllocationScope &operator=(const AllocationScope &) = delete;
+
+        Allocations result() const {
+            return allocationCount() - _start;
+        }
+
+    private:
+        Allocations _start;
+        bool _previous;
+    };
+
+}
+
+#endif
@@ -0,0 +1,354 @@
+/**
+ * A model of the ESP8266's umm_malloc heap for the host build, to watch fragmentation develop off the device.
+ *
+ * As in umm_malloc the heap is an array of 8-byte blocks. An allocation takes a run of blocks, found on a free list by
+ * best fit (umm_malloc's default) or first fit, and split off the front of the free run. Freed runs are merged with
+ * free neighbours, and realloc() grows in place into a free neighbour when it can. umm_malloc keeps a 4-byte header
+ * in the first block; here the header takes the whole block, so that pointers are 8-byte aligned as the host needs.
+ *
+ * freeBytes(), maxFreeBlockSize() and fragmentation() follow ESP.getFreeHeap(), ESP.getMaxFreeBlockSize() and
+ * ESP.getHeapFragmentation(). Reading them between calls into the client misses the moments inside a call when the
+ * heap is tightest, so the largest free block is also checked after every allocation and its low-water mark kept.
+ */
+
+#ifndef STOMP_HOST_HEAP_MODEL_H
+#define STOMP_HOST_HEAP_MODEL_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace StompHost {
+
+    class UmmHeap {
+
+    public:
+        enum Fit {
+            BEST_FIT,
+            FIRST_FIT
+        };
+
+        static const size_t BLOCK_SIZE = 8;
+
+        /**
+         * @param size size_t - Bytes of heap, e.g. what ESP.getFreeHeap() reports at the start of the sketch
+         */
+        explicit UmmHeap(size_t size = 40960, Fit fit = BEST_FIT) : _fit(fit) {
+            // block 0 heads the free list and is never allocated; _end marks the end of the heap
+            _end = (uint32_t) (size / BLOCK_SIZE + 1);
+            _memory.resize(_end);
+            _next.resize(_end);
+            _prev.resize(_end);
+            _nextFree.resize(_end);
+            _prevFree.resize(_end);
+            _isFree.assign(_end, false);
+
+            _next[0] = 1;
+            _nextFree[0] = 1;
+            _prevFree[0] = 1;
+            _next[1] = _end;
+            _prev[1] = 0;
+            _isFree[1] = true;
+            _nextFree[1] = 0;
+            _prevFree[1] = 0;
+            _freeBlocks = _end - 1;
+            _minFreeBlocks = _freeBlocks;
+            resetLowWater();
+        }
+
+        UmmHeap(const UmmHeap &) = delete;
+
+        UmmHeap &operator=(const UmmHeap &) = delete;
+
+        bool owns(const void *ptr) const {
+            const uint8_t *p = (const uint8_t *) ptr;
+            const uint8_t *base = (const uint8_t *) _memory.data();
+            return p >= base && p < base + _memory.size() * BLOCK_SIZE;
+        }
+
+        /**
+         * @return void* - nullptr if no free run is large enough
+         */
+        void *malloc(size_t size) {
+            if (size == 0) {
+                return nullptr;
+            }
+            uint32_t blocks = _blocksFor(size);
+
+            uint32_t found = 0;
+            uint32_t foundSize = 0;
+            for (uint32_t b = _nextFree[0]; b != 0; b = _nextFree[b]) {
+                uint32_t runSize = _size(b);
+                if (runSize >= blocks && (found == 0 || runSize < foundSize)) {
+                    found = b;
+                    foundSize = runSize;
+                    if (_fit == FIRST_FIT || runSize == blocks) {
+                        break;
+                    }
+                }
+            }
+            if (found == 0) {
+                _failures++;
+                return nullptr;
+            }
+
+            if (foundSize > blocks) {
+                // the rest of the run takes this one's place on the free list
+                uint32_t rest = _split(found, blocks);
+                _isFree[rest] = true;
+                _nextFree[rest] = _nextFree[found];
+                _prevFree[rest] = _prevFree[found];
+                _prevFree[_nextFree[rest]] = rest;
+                _nextFree[_prevFree[rest]] = rest;
+            } else {
+                _unlink(found);
+            }
+            _isFree[found] = false;
+            _used(blocks);
+            return _data(found);
+        }
+
+        void free(void *ptr) {
+            if (ptr == nullptr) {
+                return;
+            }
+            uint32_t b = _block(ptr);
+            _freeBlocks += _size(b);
+            _isFree[b] = true;
+            _release(b);
+        }
+
+        void *realloc(void *ptr, size_t size) {
+            if (ptr == nullptr) {
+                return malloc(size);
+            }
+            if (size == 0) {
+                free(ptr);
+                return nullptr;
+            }
+
+            uint32_t b = _block(ptr);
+            uint32_t blocks = _blocksFor(size);
+            uint32_t current = _size(b);
+
+            uint32_t next = _next[b];
+            if (current < blocks && next != _end && _isFree[next] && current + _size(next) >= blocks) {
+                // grow into the free run that follows
+                _unlink(next);
+                _freeBlocks -= _size(next);
+                _merge(b, next);
+                current = _size(b);
+            }
+
+            if (current >= blocks) {
+                if (current > blocks) {
+                    uint32_t rest = _split(b, blocks);
+                    _freeBlocks += _size(rest);
+                    _isFree[rest] = true;
+                    _release(rest);
+                }
+                _used(0);
+                return ptr;
+            }
+
+            void *moved = malloc(size);
+            if (moved == nullptr) {
+                return nullptr;
+            }
+            memcpy(moved, ptr, (current - 1) * BLOCK_SIZE);
+            free(ptr);
+            return moved;
+        }
+
+        /**
+         * Bytes in free blocks
+         */
+        size_t freeBytes() const {
+            return (size_t) _freeBlocks * BLOCK_SIZE;
+        }
+
+        /**
+         * The lowest freeBytes() seen
+         */
+        size_t minFreeBytes() const {
+            return (size_t) _minFreeBlocks * BLOCK_SIZE;
+        }
+
+        /**
+         * The largest allocation which would succeed now
+         */
+        size_t maxFreeBlockSize() const {
+            uint32_t largest = _largestRun();
+            return largest > 1 ? (size_t) (largest - 1) * BLOCK_SIZE : 0;
+        }
+
+        /**
+         * The smallest maxFreeBlockSize() seen after an allocation since resetLowWater()
+         */
+        size_t lowWaterBlockSize() const {
+            return _lowLargest > 1 ? (size_t) (_lowLargest - 1) * BLOCK_SIZE : 0;
+        }
+
+        /**
+         * freeBytes() at the moment lowWaterBlockSize() was seen
+         */
+        size_t lowWaterFreeBytes() const {
+            return (size_t) _lowLargestFree * BLOCK_SIZE;
+        }
+
+        /**
+         * Start a new low-water mark from the heap as it is now
+         */
+        void resetLowWater() {
+            _lowLargest = _largestRun();
+            _lowLargestFree = _freeBlocks;
+        }
+
+        /**
+         * 0 when all free memory is one run, approaching 100 as it is split into many small ones
+         */
+        uint8_t fragmentation() const {
+            double total = 0;
+            double squares = 0;
+            for (uint32_t b = _nextFree[0]; b != 0; b = _nextFree[b]) {
+                double bytes = (double) _size(b) * BLOCK_SIZE;
+                total += bytes;
+                squares += bytes * bytes;
+            }
+            return total > 0 ? (uint8_t) (100 - sqrt(squares) * 100 / total) : 0;
+        }
+
+        /**
+         * The number of free runs
+         */
+        uint32_t freeRuns() const {
+            uint32_t runs = 0;
+            for (uint32_t b = _nextFree[0]; b != 0; b = _nextFree[b]) {
+                runs++;
+            }
+            return runs;
+        }
+
+        /**
+         * Allocations that failed for lack of a large enough run
+         */
+        uint32_t failures() const {
+            return _failures;
+        }
+
+    private:
+        struct alignas(BLOCK_SIZE) Block {
+            uint8_t bytes[BLOCK_SIZE];
+        };
+
+        Fit _fit;
+        uint32_t _end;
+        std::vector<Block> _memory;
+        std::vector<uint32_t> _next;      // the next run in memory
+        std::vector<uint32_t> _prev;      // the previous run in memory
+        std::vector<uint32_t> _nextFree;  // free list, through block 0
+        std::vector<uint32_t> _prevFree;
+        std::vector<bool> _isFree;
+        uint32_t _freeBlocks;
+        uint32_t _minFreeBlocks;
+        uint32_t _lowLargest;      // blocks in the smallest largest free run since resetLowWater()
+        uint32_t _lowLargestFree;  // free blocks at that moment
+        uint32_t _failures = 0;
+
+        static uint32_t _blocksFor(size_t size) {
+            return (uint32_t) (1 + (size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+
+        uint32_t _size(uint32_t b) const {
+            return _next[b] - b;
+        }
+
+        void *_data(uint32_t b) {
+            return &_memory[b + 1];
+        }
+
+        uint32_t _block(const void *ptr) const {
+            return (uint32_t) (((const Block *) ptr - _memory.data()) - 1);
+        }
+
+        uint32_t _largestRun() const {
+            uint32_t largest = 0;
+            for (uint32_t b = _nextFree[0]; b != 0; b = _nextFree[b]) {
+                if (_size(b) > largest) {
+                    largest = _size(b);
+                }
+            }
+            return largest;
+        }
+
+        void _used(uint32_t blocks) {
+            _freeBlocks -= blocks;
+            if (_freeBlocks < _minFreeBlocks) {
+                _minFreeBlocks = _freeBlocks;
+            }
+            uint32_t largest = _largestRun();
+            if (largest < _lowLargest) {
+                _lowLargest = largest;
+                _lowLargestFree = _freeBlocks;
+            }
+        }
+
+        void _unlink(uint32_t b) {
+            _nextFree[_prevFree[b]] = _nextFree[b];
+            _prevFree[_nextFree[b]] = _prevFree[b];
+        }
+
+        void _pushFree(uint32_t b) {
+            _nextFree[b] = _nextFree[0];
+            _prevFree[b] = 0;
+            _prevFree[_nextFree[0]] = b;
+            _nextFree[0] = b;
+        }
+
+        /**
+         * Cut the run at b after blocks, returning the second part (which is not on the free list)
+         */
+        uint32_t _split(uint32_t b, uint32_t blocks) {
+            uint32_t rest = b + blocks;
+            _next[rest] = _next[b];
+            _prev[rest] = b;
+            if (_next[b] != _end) {
+                _prev[_next[b]] = rest;
+            }
+            _next[b] = rest;
+            return rest;
+        }
+
+        /**
+         * Join the run at b with the run that follows it
+         */
+        void _merge(uint32_t b, uint32_t next) {
+            _next[b] = _next[next];
+            if (_next[next] != _end) {
+                _prev[_next[next]] = b;
+            }
+        }
+
+        /**
+         * Put the free run at b back, merged with free neighbours
+         */
+        void _release(uint32_t b) {
+            uint32_t next = _next[b];
+            if (next != _end && _isFree[next]) {
+                _unlink(next);
+                _merge(b, next);
+            }
+
+            uint32_t prev = _prev[b];
+            if (prev != 0 && _isFree[prev]) {
+                _merge(prev, b);
+            } else {
+                _pushFree(b);
+            }
+        }
+    };
+
+}
+
+#endif
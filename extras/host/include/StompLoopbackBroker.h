@@ -0,0 +1,518 @@
+/**
+ * An in-process STOMP broker for the host build, attached to one or more mock WebSocketsClients with setPeer().
+ *
+ * It speaks STOMP 1.2 (CONNECT/STOMP, SUBSCRIBE, UNSUBSCRIBE, SEND, ACK, NACK, DISCONNECT, receipts and heart-beats),
+ * optionally inside SockJS framing, and routes each SEND to every subscription on the same destination. Frames for
+ * a client are queued on its socket and arrive on the client's next loop(); receipts can be delayed and heart-beats
+ * are sent from loop(), which must be called as well.
+ *
+ * Faults can be scripted: dropped heart-beats, delayed receipts, and a connection lost in the middle of a frame.
+ */
+
+#ifndef STOMP_HOST_LOOPBACK_BROKER_H
+#define STOMP_HOST_LOOPBACK_BROKER_H
+
+#include <Arduino.h>
+#include <WebSocketsClient.h>
+#include "StompCommandParser.h"
+#include "StompSockJS.h"
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+namespace StompHost {
+
+    class LoopbackBroker : public WebSocketsClient::Peer {
+
+    public:
+        struct Stats {
+            uint32_t connects;
+            uint32_t framesIn;
+            uint32_t framesOut;
+            uint32_t messagesIn;    // SENDs
+            uint32_t messagesOut;   // MESSAGEs, including redeliveries
+            uint32_t acks;
+            uint32_t nacks;
+            uint32_t redeliveries;
+            uint32_t receipts;
+            uint32_t heartbeatsIn;
+            uint32_t heartbeatsOut;
+            uint32_t errors;
+        };
+
+        explicit LoopbackBroker(bool sockjs = false) : _sockjs(sockjs) {
+        }
+
+        /**
+         * The broker's heart-beat header: send is how often it can send them, receive how often it wants them (ms).
+         * Defaults to 0,0
+         */
+        void setHeartbeat(unsigned long send, unsigned long receive) {
+            _heartbeatSend = send;
+            _heartbeatReceive = receive;
+        }
+
+        /**
+         * When true (the default) a NACKed message is delivered again at once with redelivered:true
+         */
+        void setRedeliverOnNack(bool redeliver) {
+            _redeliverOnNack = redeliver;
+        }
+
+        /**
+         * The broker's clock, used for the timestamp header, runs this many ms ahead of millis()
+         */
+        void setClockOffset(long long offset) {
+            _clockOffset = offset;
+        }
+
+        // ---- faults ----
+
+        /**
+         * Stop (or resume) sending heart-beats
+         */
+        void dropHeartbeats(bool drop) {
+            _dropHeartbeats = drop;
+        }
+
+        /**
+         * Hold every RECEIPT back for delay ms
+         */
+        void delayReceipts(unsigned long delay) {
+            _receiptDelay = delay;
+        }
+
+        /**
+         * Lose the connection part way through a frame: after afterFrames more frames have been sent to a client, the
+         * next arrives as the start of a fragmented message and the socket is dropped
+         */
+        void disconnectMidFrame(unsigned int afterFrames = 0) {
+            _cutAfter = (long) afterFrames;
+        }
+
+        /**
+         * Drop every connection from the broker's side
+         */
+        void dropConnections() {
+            std::vector<WebSocketsClient *> clients;
+            for (auto &session: _sessions) {
+                clients.push_back(session.client);
+            }
+            for (auto client: clients) {
+                client->drop();
+            }
+        }
+
+        // ---- driving and inspection ----
+
+        /**
+         * Send heart-beats and delayed frames that are due, and drop clients whose heart-beats stopped
+         */
+        void loop() {
+            unsigned long now = millis();
+
+            for (size_t i = 0; i < _delayed.size();) {
+                if ((long) (now - _delayed[i].due) >= 0) {
+                    Delayed delayed = std::move(_delayed[i]);
+                    _delayed.erase(_delayed.begin() + i);
+                    if (_find(delayed.client)) {
+                        _deliver(delayed.client, delayed.frame);
+                    }
+                } else {
+                    i++;
+                }
+            }
+
+            // delivering can drop a connection (and its session), so collect the clients first
+            std::vector<WebSocketsClient *> due;
+            std::vector<WebSocketsClient *> silent;
+            for (auto &session: _sessions) {
+                if (!session.stomp) {
+                    continue;
+                }
+                if (session.heartbeatOut > 0 && !_dropHeartbeats && now - session.lastSent >= session.heartbeatOut) {
+                    due.push_back(session.client);
+                }
+                if (session.heartbeatIn > 0 && now - session.lastReceived > 2 * session.heartbeatIn) {
+                    silent.push_back(session.client);
+                }
+            }
+            for (auto client: due) {
+                _stats.heartbeatsOut++;
+                _deliver(client, "\n");
+            }
+            for (auto client: silent) {
+                if (_find(client)) {
+                    client->drop();
+                }
+            }
+        }
+
+        /**
+         * Send a MESSAGE to every subscriber of destination, as if another client had sent it
+         * @param headers StompHeaders - Extra headers for the MESSAGE
+         */
+        void publish(const String &destination, const String &body,
+                     const Stomp::StompHeaders &headers = Stomp::StompHeaders()) {
+            _route(destination, body, headers);
+        }
+
+        const Stats &stats() const {
+            return _stats;
+        }
+
+        void resetStats() {
+            _stats = Stats();
+        }
+
+        /**
+         * Messages delivered in CLIENT or CLIENT_INDIVIDUAL mode and not yet acknowledged
+         */
+        size_t unacknowledged() const {
+            return _unacked.size();
+        }
+
+        /**
+         * The number of STOMP sessions (CONNECTED and not yet closed)
+         */
+        size_t sessions() const {
+            size_t count = 0;
+            for (const auto &session: _sessions) {
+                if (session.stomp) {
+                    count++;
+                }
+            }
+            return count;
+        }
+
+        // ---- WebSocketsClient::Peer ----
+
+        void onOpen(WebSocketsClient &client) override {
+            Session session;
+            session.client = &client;
+            _sessions.push_back(std::move(session));
+            if (_sockjs) {
+                client.queueText("o");
+            }
+        }
+
+        void onText(WebSocketsClient &client, const char *payload, size_t length) override {
+            if (_sockjs) {
+                Stomp::StompSockJS::decode(payload, length, [this, &client](String &frame) {
+                    _receive(client, frame);
+                });
+                return;
+            }
+
+            String frame(payload, (unsigned int) length);
+            if (length > 0 && payload[length - 1] == '\0') {
+                frame.remove(length - 1);
+            }
+            _receive(client, frame);
+        }
+
+        void onClose(WebSocketsClient &client) override {
+            for (size_t i = 0; i < _sessions.size(); i++) {
+                if (_sessions[i].client == &client) {
+                    _sessions.erase(_sessions.begin() + i);
+                    break;
+                }
+            }
+            for (size_t i = 0; i < _unacked.size();) {
+                if (_unacked[i].client == &client) {
+                    _unacked.erase(_unacked.begin() + i);
+                } else {
+                    i++;
+                }
+            }
+        }
+
+    private:
+        struct Subscription {
+            String id;
+            String destination;
+            String ack;
+        };
+
+        struct Session {
+            WebSocketsClient *client = nullptr;
+            bool stomp = false;
+            std::vector<Subscription> subscriptions;
+            unsigned long heartbeatOut = 0;
+            unsigned long heartbeatIn = 0;
+            unsigned long lastSent = 0;
+            unsigned long lastReceived = 0;
+        };
+
+        struct Unacked {
+            WebSocketsClient *client;
+            String subscription;
+            String messageId;
+            String destination;
+            String body;
+            Stomp::StompHeaders headers;
+        };
+
+        struct Delayed {
+            WebSocketsClient *client;
+            unsigned long due;
+            String frame;
+        };
+
+        const bool _sockjs;
+        unsigned long _heartbeatSend = 0;
+        unsigned long _heartbeatReceive = 0;
+        bool _redeliverOnNack = true;
+        long long _clockOffset = 0;
+
+        bool _dropHeartbeats = false;
+        unsigned long _receiptDelay = 0;
+        long _cutAfter = -1;
+
+        std::vector<Session> _sessions;
+        std::deque<Unacked> _unacked;
+        std::vector<Delayed> _delayed;
+        uint32_t _nextMessageId = 0;
+        Stats _stats = Stats();
+
+        Session *_find(WebSocketsClient *client) {
+            for (auto &session: _sessions) {
+                if (session.client == client) {
+                    return &session;
+                }
+            }
+            return nullptr;
+        }
+
+        void _receive(WebSocketsClient &client, const String &frame) {
+            Session *session = _find(&client);
+            if (session == nullptr) {
+                return;
+            }
+            session->lastReceived = millis();
+            _stats.framesIn++;
+
+            char first = frame.length() ? frame[0] : '\0';
+            if (first == '\n' || first == '\r' || first == '\0') {
+                _stats.heartbeatsIn++;
+                return;
+            }
+
+            Stomp::StompCommand command = Stomp::StompCommandParser::parse(frame);
+            const String &name = command.command;
+            if (name.equals("CONNECT") || name.equals("STOMP")) {
+                _connect(*session, command);
+                // nothing else is receipted before CONNECTED
+                return;
+            }
+
+            if (!session->stomp) {
+                _error(client, "not connected");
+                return;
+            }
+
+            if (name.equals("SEND")) {
+                _stats.messagesIn++;
+                Stomp::StompHeaders headers;
+                for (uint8_t i = 0; i < command.headers.size(); i++) {
+                    Stomp::StompHeader header = command.headers.get(i);
+                    if (!header.key.equals("destination") && !header.key.equals("receipt") &&
+                        !header.key.equals("content-length")) {
+                        headers.append(header);
+                    }
+                }
+                _route(command.headers.getValue("destination"), command.body, headers);
+            } else if (name.equals("SUBSCRIBE")) {
+                String ack = command.headers.getValue("ack");
+                session->subscriptions.push_back({command.headers.getValue("id"),
+                                                  command.headers.getValue("destination"),
+                                                  ack.length() ? ack : String("auto")});
+            } else if (name.equals("UNSUBSCRIBE")) {
+                String id = command.headers.getValue("id");
+                for (size_t i = 0; i < session->subscriptions.size(); i++) {
+                    if (session->subscriptions[i].id.equals(id)) {
+                        session->subscriptions.erase(session->subscriptions.begin() + i);
+                        break;
+                    }
+                }
+            } else if (name.equals("ACK")) {
+                _stats.acks++;
+                _acknowledge(client, command.headers.getValue("id"), false);
+            } else if (name.equals("NACK")) {
+                _stats.nacks++;
+                _acknowledge(client, command.headers.getValue("id"), true);
+            } else if (name.equals("DISCONNECT")) {
+                session->stomp = false;
+            } else {
+                _error(client, "unknown command " + name);
+                return;
+            }
+
+            String receipt = command.headers.getValue("receipt");
+            if (receipt.length() > 0) {
+                _stats.receipts++;
+                _send(client, "RECEIPT\nreceipt-id:" + receipt + "\n\n", _receiptDelay);
+            }
+        }
+
+        void _connect(Session &session, const Stomp::StompCommand &command) {
+            unsigned long clientSend = 0;
+            unsigned long clientReceive = 0;
+            String heartbeat = command.headers.getValue("heart-beat");
+            int comma = heartbeat.indexOf(',');
+            if (comma != -1) {
+                clientSend = heartbeat.substring(0, comma).toInt();
+                clientReceive = heartbeat.substring(comma + 1).toInt();
+            }
+
+            session.stomp = true;
+            session.heartbeatOut = _heartbeatSend && clientReceive ? std::max(_heartbeatSend, clientReceive) : 0;
+            session.heartbeatIn = _heartbeatReceive && clientSend ? std::max(_heartbeatReceive, clientSend) : 0;
+            session.lastReceived = millis();
+            _stats.connects++;
+
+            _send(*session.client, "CONNECTED\nversion:1.2\nserver:loopback/1.0\nheart-beat:" +
+                                   String(_heartbeatSend) + "," + String(_heartbeatReceive) + "\n\n");
+        }
+
+        void _route(const String &destination, const String &body, const Stomp::StompHeaders &headers) {
+            String messageId = "m-" + String(++_nextMessageId);
+
+            // delivering can drop a connection (and its session), so collect the subscribers first
+            std::vector<std::pair<WebSocketsClient *, Subscription>> subscribers;
+            for (auto &session: _sessions) {
+                for (auto &subscription: session.subscriptions) {
+                    if (session.stomp && subscription.destination.equals(destination)) {
+                        subscribers.emplace_back(session.client, subscription);
+                    }
+                }
+            }
+
+            for (auto &subscriber: subscribers) {
+                const Subscription &subscription = subscriber.second;
+                if (!subscription.ack.equals("auto")) {
+                    _unacked.push_back({subscriber.first, subscription.id, messageId, destination, body, headers});
+                }
+                _message(*subscriber.first, subscription, messageId, destination, body, headers, false);
+            }
+        }
+
+        void _message(WebSocketsClient &client, const Subscription &subscription, const String &messageId,
+                      const String &destination, const String &body, const Stomp::StompHeaders &headers,
+                      bool redelivered) {
+            String frame = "MESSAGE\ndestination:" + destination + "\nsubscription:" + subscription.id +
+                           "\nmessage-id:" + messageId + "\n";
+            if (!subscription.ack.equals("auto")) {
+                frame += "ack:" + messageId + "\n";
+            }
+            if (redelivered) {
+                frame += "redelivered:true\n";
+            }
+            frame += "timestamp:" + String((unsigned long) ((long long) millis() + _clockOffset)) + "\n";
+            for (uint8_t i = 0; i < headers.size(); i++) {
+                Stomp::StompHeader header = headers.get(i);
+                frame += header.key + ":" + header.value + "\n";
+            }
+            frame += "content-length:" + String(body.length()) + "\n\n" + body;
+            _stats.messagesOut++;
+            _send(client, frame);
+        }
+
+        /**
+         * Settle an ACK or NACK. In client mode an ACK also settles every earlier message of the subscription
+         */
+        void _acknowledge(WebSocketsClient &client, const String &id, bool nack) {
+            for (size_t i = 0; i < _unacked.size(); i++) {
+                if (_unacked[i].client != &client || !_unacked[i].messageId.equals(id)) {
+                    continue;
+                }
+
+                Unacked message = _unacked[i];
+                Subscription *subscription = _subscription(client, message.subscription);
+                if (!nack && subscription && subscription->ack.equals("client")) {
+                    for (size_t j = 0; j < i;) {
+                        if (_unacked[j].client == &client && _unacked[j].subscription.equals(message.subscription)) {
+                            _unacked.erase(_unacked.begin() + j);
+                            i--;
+                        } else {
+                            j++;
+                        }
+                    }
+                }
+                _unacked.erase(_unacked.begin() + i);
+
+                if (nack && _redeliverOnNack && subscription) {
+                    _stats.redeliveries++;
+                    _unacked.push_back(message);
+                    _message(client, *subscription, message.messageId, message.destination, message.body,
+                             message.headers, true);
+                }
+                return;
+            }
+        }
+
+        Subscription *_subscription(WebSocketsClient &client, const String &id) {
+            Session *session = _find(&client);
+            if (session == nullptr) {
+                return nullptr;
+            }
+            for (auto &subscription: session->subscriptions) {
+                if (subscription.id.equals(id)) {
+                    return &subscription;
+                }
+            }
+            return nullptr;
+        }
+
+        void _error(WebSocketsClient &client, const String &message) {
+            _stats.errors++;
+            _send(client, "ERROR\nmessage:" + message + "\n\n");
+        }
+
+        void _send(WebSocketsClient &client, const String &frame, unsigned long delay = 0) {
+            if (delay > 0) {
+                _delayed.push_back({&client, millis() + delay, frame});
+                return;
+            }
+            _deliver(&client, frame);
+        }
+
+        /**
+         * Queue a frame (with its NULL terminator, unless it is a heart-beat) on the client's socket
+         */
+        void _deliver(WebSocketsClient *client, const String &frame) {
+            Session *session = _find(client);
+            if (session == nullptr) {
+                return;
+            }
+            session->lastSent = millis();
+            _stats.framesOut++;
+
+            String payload;
+            bool heartbeat = frame.equals("\n");
+            if (_sockjs) {
+                payload = "a" + Stomp::StompSockJS::encode(frame.c_str(), frame.length() + (heartbeat ? 0 : 1));
+            } else {
+                payload = frame;
+                if (!heartbeat) {
+                    payload.concat('\0');
+                }
+            }
+
+            if (_cutAfter == 0) {
+                _cutAfter = -1;
+                client->queueEvent(WStype_FRAGMENT_TEXT_START, payload.substring(0, payload.length() / 2));
+                client->drop();
+                return;
+            }
+            if (_cutAfter > 0) {
+                _cutAfter--;
+            }
+            client->queueText(payload);
+        }
+    };
+
+}
+
+#endif
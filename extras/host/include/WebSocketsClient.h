@@ -0,0 +1,289 @@
+/**
+ * In-memory stand-in for the arduinoWebSockets WebSocketsClient, used by the host build.
+ *
+ * Nothing touches the network. Events are scripted with queueEvent() / queueText() and delivered to the registered
+ * handler from loop(), exactly as the real client delivers them. Outbound frames are recorded in sent() and can also
+ * be forwarded to a transport peer (for example a loopback broker) with setPeer().
+ */
+
+#ifndef STOMP_HOST_WEBSOCKETS_CLIENT_H
+#define STOMP_HOST_WEBSOCKETS_CLIENT_H
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+
+typedef enum {
+    WStype_ERROR,
+    WStype_DISCONNECTED,
+    WStype_CONNECTED,
+    WStype_TEXT,
+    WStype_BIN,
+    WStype_FRAGMENT_TEXT_START,
+    WStype_FRAGMENT_BIN_START,
+    WStype_FRAGMENT,
+    WStype_FRAGMENT_FIN,
+    WStype_PING,
+    WStype_PONG,
+} WStype_t;
+
+class WebSocketsClient {
+
+public:
+    typedef std::function<void(WStype_t type, uint8_t *payload, size_t length)> WebSocketClientEvent;
+
+    /**
+     * Receives everything the client sends, and is told when the socket is opened or closed
+     */
+    class Peer {
+
+    public:
+        virtual ~Peer() = default;
+
+        virtual void onOpen(WebSocketsClient &client) = 0;
+
+        virtual void onText(WebSocketsClient &client, const char *payload, size_t length) = 0;
+
+        virtual void onClose(WebSocketsClient &client) = 0;
+    };
+
+    struct Event {
+        WStype_t type;
+        String payload;
+    };
+
+    void begin(const char *host, uint16_t port, const char *url = "/", const char *protocol = "arduino") {
+        (void) protocol;
+        _host = host;
+        _port = port;
+        _url = url;
+        _ssl = false;
+        _begun++;
+        _open();
+    }
+
+    void begin(const String &host, uint16_t port, const String &url = "/", const String &protocol = "arduino") {
+        begin(host.c_str(), port, url.c_str(), protocol.c_str());
+    }
+
+    void beginSSL(const char *host, uint16_t port, const char *url = "/", const char *fingerprint = "",
+                  const char *protocol = "arduino") {
+        (void) fingerprint;
+        begin(host, port, url, protocol);
+        _ssl = true;
+    }
+
+    void setExtraHeaders(const char *extraHeaders = nullptr) {
+        (void) extraHeaders;
+    }
+
+    /**
+     * How long after losing the connection loop() opens it again; 0 never does. Defaults to 500ms as in the real client
+     */
+    void setReconnectInterval(unsigned long time) {
+        _reconnectInterval = time;
+    }
+
+    void onEvent(WebSocketClientEvent cbEvent) {
+        _handler = std::move(cbEvent);
+    }
+
+    void loop() {
+        ArduinoShim::advanceMicros(_loopMicros);
+        // deliver only what was queued before this call, like one pass of the real client
+        size_t end = _events.size();
+        while (_head < end && _head < _events.size()) {
+            Event event = std::move(_events[_head++]);
+            _deliver(event);
+        }
+        // the queue keeps its capacity, so that steady traffic does not allocate
+        if (_head == _events.size()) {
+            _events.clear();
+            _head = 0;
+        }
+
+        // like the real client, reconnect silently a while after the connection was lost
+        if (_begun > 0 && !_connected && _autoOpen && _reconnectInterval > 0 &&
+            millis() - _closedAt >= _reconnectInterval) {
+            open();
+        }
+    }
+
+    bool sendTXT(const char *payload, size_t length = 0) {
+        if (!_connected || _failSends) {
+            return false;
+        }
+        if (length == 0) length = strlen(payload);
+        if (_recording) _sent.emplace_back(payload, (unsigned int) length);
+        if (_peer) _peer->onText(*this, payload, length);
+        return true;
+    }
+
+    bool sendTXT(String &payload) {
+        return sendTXT(payload.c_str(), payload.length());
+    }
+
+    void disconnect() {
+        if (_connected) {
+            _connected = false;
+            _closedAt = millis();
+            if (_peer) _peer->onClose(*this);
+            queueEvent(WStype_DISCONNECTED);
+        }
+    }
+
+    bool isConnected() const {
+        return _connected;
+    }
+
+    // ---- scripting interface ----
+
+    void setPeer(Peer *peer) {
+        _peer = peer;
+    }
+
+    /**
+     * When false (default true) begin() does not open the socket; call open() to do it later
+     */
+    void setAutoOpen(bool autoOpen) {
+        _autoOpen = autoOpen;
+    }
+
+    /**
+     * Simulated time each loop() spends on the socket (reading, TLS) before delivering anything; needs the manual clock
+     */
+    void setLoopMicros(unsigned long micros) {
+        _loopMicros = micros;
+    }
+
+    /**
+     * Make sendTXT() fail as the real client does on a broken socket
+     */
+    void setFailSends(bool fail) {
+        _failSends = fail;
+    }
+
+    /**
+     * Called with true before and false after each copy of received data the mock makes: payloads waiting in the
+     * queue (on a device, the socket's receive buffers) and the buffer handed to the handler. A soak test uses it to
+     * allocate them from the device's heap
+     */
+    void setReceiveScope(std::function<void(bool enter)> scope) {
+        _receiveScope = std::move(scope);
+    }
+
+    /**
+     * When false (default true) sent frames are not kept in sent(), so that benchmarks do not measure the mock
+     */
+    void setRecording(bool recording) {
+        _recording = recording;
+    }
+
+    void open() {
+        _connected = true;
+        queueEvent(WStype_CONNECTED, _url);
+        if (_peer) _peer->onOpen(*this);
+    }
+
+    /**
+     * Drop the connection from the remote side
+     */
+    void drop() {
+        disconnect();
+    }
+
+    void queueEvent(WStype_t type, const String &payload = String()) {
+        if (_receiveScope) _receiveScope(true);
+        String copy = payload;
+        if (_receiveScope) _receiveScope(false);
+        _events.push_back({type, std::move(copy)});
+    }
+
+    void queueText(const String &payload) {
+        queueEvent(WStype_TEXT, payload);
+    }
+
+    /**
+     * Deliver an event immediately, bypassing the queue
+     */
+    void deliver(WStype_t type, const String &payload = String()) {
+        Event event = {type, payload};
+        _deliver(event);
+    }
+
+    /**
+     * Deliver an event immediately with the caller's buffer, which must be NUL terminated and writable. Nothing is
+     * copied or allocated by the mock
+     */
+    void deliver(WStype_t type, uint8_t *payload, size_t length) {
+        if (_handler) _handler(type, payload, length);
+    }
+
+    size_t pendingEvents() const {
+        return _events.size() - _head;
+    }
+
+    std::vector<String> &sent() {
+        return _sent;
+    }
+
+    const String &host() const {
+        return _host;
+    }
+
+    uint16_t port() const {
+        return _port;
+    }
+
+    const String &url() const {
+        return _url;
+    }
+
+    bool ssl() const {
+        return _ssl;
+    }
+
+    unsigned int beginCount() const {
+        return _begun;
+    }
+
+private:
+    WebSocketClientEvent _handler;
+    std::function<void(bool enter)> _receiveScope;
+    std::vector<Event> _events;
+    size_t _head = 0;
+    std::vector<String> _sent;
+    Peer *_peer = nullptr;
+
+    String _host;
+    uint16_t _port = 0;
+    String _url;
+    bool _ssl = false;
+    bool _connected = false;
+    bool _autoOpen = true;
+    bool _failSends = false;
+    bool _recording = true;
+    unsigned long _reconnectInterval = 500;
+    unsigned long _loopMicros = 0;
+    unsigned long _closedAt = 0;
+    unsigned int _begun = 0;
+
+    void _open() {
+        _connected = false;
+        _events.clear();
+        _head = 0;
+        if (_autoOpen) open();
+    }
+
+    void _deliver(Event &event) {
+        if (!_handler) return;
+        // the real client hands over a NUL terminated, writable buffer
+        if (_receiveScope) _receiveScope(true);
+        String copy = event.payload;
+        if (_receiveScope) _receiveScope(false);
+        static char empty[1] = "";
+        _handler(event.type, copy.begin() ? (uint8_t *) copy.begin() : (uint8_t *) empty, copy.length());
+    }
+};
+
+#endif
@@ -0,0 +1,511 @@
+/**
+ * StompSoak.cpp
+ *
+ * Heap fragmentation soak test. Everything the client allocates (String buffers and operator new) comes from a model
+ * of the ESP8266's umm_malloc heap, while the loopback broker and the harness use the host's heap. Millions of frames
+ * of realistic traffic are then driven through the client: corpus MESSAGEs in AUTO and CLIENT_INDIVIDUAL mode,
+ * telemetry SENDs built on the device, echoes, receipts, heart-beats and periodic reconnects. Simulated time advances
+ * a fixed tick per frame.
+ *
+ * The device heap also holds what the rest of the firmware would: received frames wait in it until the client reads
+ * them, as they wait in the socket's buffers, and each connection holds --resident bytes of long-lived WiFi, TLS and
+ * socket buffers, allocated when the socket opens and freed when it closes.
+ *
+ * Free heap, the largest free block and ESP.getHeapFragmentation()'s metric are sampled over time. The largest free
+ * block is also checked after every device allocation, so each sample reports its low-water mark inside loop() as well,
+ * and the run reports when a 2 KB allocation would first have failed with more than 20 KB free.
+ *
+ *     stomp_soak [--frames N] [--heap BYTES] [--resident BYTES] [--fit best|first] [--tick MS] [--sample N]
+ *                [--reconnect-every N] [--max-frame BYTES] [--seed N] [--csv FILE] [--fail-below BYTES]
+ */
+
+#include <Arduino.h>
+#include <WebSocketsClient.h>
+#include "StompClient.h"
+#include "StompCorpus.h"
+#include "StompHeapModel.h"
+#include "StompLoopbackBroker.h"
+
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifndef STOMP_SOAK_CORPUS
+#define STOMP_SOAK_CORPUS "corpus"
+#endif
+
+namespace {
+
+    StompHost::UmmHeap *deviceHeap = nullptr;
+    bool onDevice = false;
+
+    /**
+     * Allocations made while a device scope is active come from the device heap. Memory is always returned to the
+     * heap it came from
+     */
+    class DeviceScope {
+
+    public:
+        explicit DeviceScope(bool device) : _previous(onDevice) {
+            onDevice = device && deviceHeap != nullptr;
+        }
+
+        ~DeviceScope() {
+            onDevice = _previous;
+        }
+
+    private:
+        bool _previous;
+    };
+
+    struct DeviceOutOfMemory {
+        size_t size;
+    };
+
+    void *allocate(size_t size) {
+        return onDevice ? deviceHeap->malloc(size) : malloc(size);
+    }
+
+    void *reallocate(void *ptr, size_t size) {
+        if (ptr == nullptr) {
+            return allocate(size);
+        }
+        if (deviceHeap && deviceHeap->owns(ptr)) {
+            return deviceHeap->realloc(ptr, size);
+        }
+        return realloc(ptr, size);
+    }
+
+    void release(void *ptr) {
+        if (deviceHeap && deviceHeap->owns(ptr)) {
+            deviceHeap->free(ptr);
+        } else {
+            free(ptr);
+        }
+    }
+
+}
+
+void *operator new(size_t size) {
+    void *p = allocate(size ? size : 1);
+    if (!p) {
+        if (onDevice) {
+            throw DeviceOutOfMemory{size};
+        }
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p) noexcept {
+    release(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    release(p);
+}
+
+namespace {
+
+    struct Options {
+        uint64_t frames = 3500000;  // 48 simulated hours at the default tick
+        size_t heap = 40960;
+        size_t resident = 6144;     // about what a TLS connection with 512-byte fragments holds
+        StompHost::UmmHeap::Fit fit = StompHost::UmmHeap::BEST_FIT;
+        unsigned long tick = 50;
+        uint64_t sample = 10000;
+        uint64_t reconnectEvery = 200000;
+        unsigned int maxFrame = 2048;
+        unsigned int seed = 1;
+        std::string csv;
+        size_t failBelow = 0;
+    };
+
+    struct Message {
+        String body;
+        Stomp::StompHeaders headers;
+    };
+
+    /**
+     * The long-lived buffers of a connection, outside the client: the TLS engine with its receive buffer, the send
+     * buffer and the socket itself
+     */
+    class ResidentBuffers {
+
+    public:
+        explicit ResidentBuffers(size_t bytes) : _bytes(bytes) {
+        }
+
+        ~ResidentBuffers() {
+            release();
+        }
+
+        void allocate() {
+            release();
+            if (_bytes == 0) {
+                return;
+            }
+            const size_t sizes[] = {_bytes * 60 / 100, _bytes * 25 / 100, _bytes - _bytes * 85 / 100};
+            for (uint8_t i = 0; i < 3; i++) {
+                _blocks[i] = sizes[i] ? deviceHeap->malloc(sizes[i]) : nullptr;
+                if (sizes[i] && _blocks[i] == nullptr) {
+                    throw DeviceOutOfMemory{sizes[i]};
+                }
+            }
+        }
+
+        void release() {
+            for (auto &block: _blocks) {
+                if (block) {
+                    deviceHeap->free(block);
+                    block = nullptr;
+                }
+            }
+        }
+
+    private:
+        size_t _bytes;
+        void *_blocks[3] = {nullptr, nullptr, nullptr};
+    };
+
+    /**
+     * Runs the broker in the host's heap, whichever side calls it, and holds the connection's resident buffers on the
+     * device
+     */
+    class HostPeer : public WebSocketsClient::Peer {
+
+    public:
+        HostPeer(StompHost::LoopbackBroker &broker, ResidentBuffers &resident) : _broker(broker), _resident(resident) {
+        }
+
+        void onOpen(WebSocketsClient &client) override {
+            _resident.allocate();
+            DeviceScope host(false);
+            _broker.onOpen(client);
+        }
+
+        void onText(WebSocketsClient &client, const char *payload, size_t length) override {
+            DeviceScope host(false);
+            _broker.onText(client, payload, length);
+        }
+
+        void onClose(WebSocketsClient &client) override {
+            _resident.release();
+            DeviceScope host(false);
+            _broker.onClose(client);
+        }
+
+    private:
+        StompHost::LoopbackBroker &_broker;
+        ResidentBuffers &_resident;
+    };
+
+    /**
+     * The sketch: subscribes on every connect, keeps the last message received, and sends telemetry
+     */
+    struct Device {
+        WebSocketsClient webSocket;
+        Stomp::StompClient client;
+        int topic = -1;
+        int queue = -1;
+        String lastMessage;
+        uint32_t received = 0;
+        uint32_t sequence = 0;
+
+        Device() : client(webSocket, "loopback", 61613, "/ws", false) {
+            webSocket.setRecording(false);
+            client.setHeartbeat(10000, 10000);
+            client.setAckReceipts(true);
+            client.onConnect(Stomp::StompStateHandler(this, &Device::connected));
+        }
+
+        void connected(const Stomp::StompCommand &) {
+            if (topic != -1) {
+                client.unsubscribe(topic);
+                client.unsubscribe(queue);
+            }
+            topic = client.subscribe("/topic/soak", Stomp::AUTO, Stomp::StompMessageHandler(this, &Device::update));
+            queue = client.subscribe("/queue/soak", Stomp::CLIENT_INDIVIDUAL,
+                                     Stomp::StompMessageHandler(this, &Device::command));
+        }
+
+        Stomp::Stomp_Ack_t update(const Stomp::StompCommand &message) {
+            received++;
+            lastMessage = message.body;
+            return Stomp::CONTINUE;
+        }
+
+        Stomp::Stomp_Ack_t command(const Stomp::StompCommand &message) {
+            received++;
+            return message.body.length() > 0 ? Stomp::ACK : Stomp::NACK;
+        }
+
+        void sendTelemetry(unsigned int padding) {
+            String body = "{\"seq\":";
+            body += String(++sequence);
+            body += ",\"uptime\":";
+            body += String(millis());
+            body += ",\"heap\":";
+            body += String((unsigned long) deviceHeap->freeBytes());
+            body += ",\"note\":\"";
+            for (unsigned int i = 0; i < padding; i++) {
+                body += (char) ('a' + i % 26);
+            }
+            body += "\"}";
+            client.sendMessage("/topic/telemetry", body);
+        }
+    };
+
+    struct Sample {
+        uint64_t frame;
+        double hours;
+        size_t free;
+        size_t minFree;
+        size_t largest;
+        size_t lowLargest;      // the smallest largest block inside loop() since the last sample
+        size_t lowLargestFree;  // free heap at that moment
+        uint8_t fragmentation;
+        uint32_t runs;
+        uint32_t failures;
+    };
+
+    std::vector<Message> loadMessages(const Options &options) {
+        static const char *const brokerHeaders[] = {"destination", "subscription", "message-id", "ack", "redelivered",
+                                                    "timestamp", "content-length"};
+        std::vector<Message> messages;
+        for (const auto &corpus: StompHost::loadCorpora(STOMP_SOAK_CORPUS)) {
+            for (const String &frame: corpus.frames) {
+                Stomp::StompCommand parsed = Stomp::StompCommandParser::parse(frame);
+                if (!parsed.command.equals("MESSAGE") || frame.length() > options.maxFrame) {
+                    continue;
+                }
+                Message message;
+                message.body = parsed.body;
+                for (uint8_t i = 0; i < parsed.headers.size(); i++) {
+                    Stomp::StompHeader header = parsed.headers.get(i);
+                    bool set = false;
+                    for (const char *name: brokerHeaders) {
+                        set = set || header.key.equals(name);
+                    }
+                    if (!set) {
+                        message.headers.append(header);
+                    }
+                }
+                messages.push_back(std::move(message));
+            }
+        }
+        return messages;
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc) {
+                return false;
+            }
+            std::string value = argv[++i];
+            if (arg == "--frames") {
+                options.frames = strtoull(value.c_str(), nullptr, 10);
+            } else if (arg == "--heap") {
+                options.heap = strtoul(value.c_str(), nullptr, 10);
+            } else if (arg == "--resident") {
+                options.resident = strtoul(value.c_str(), nullptr, 10);
+            } else if (arg == "--fit") {
+                if (value != "best" && value != "first") {
+                    return false;
+                }
+                options.fit = value == "best" ? StompHost::UmmHeap::BEST_FIT : StompHost::UmmHeap::FIRST_FIT;
+            } else if (arg == "--tick") {
+                options.tick = strtoul(value.c_str(), nullptr, 10);
+            } else if (arg == "--sample") {
+                options.sample = strtoull(value.c_str(), nullptr, 10);
+            } else if (arg == "--reconnect-every") {
+                options.reconnectEvery = strtoull(value.c_str(), nullptr, 10);
+            } else if (arg == "--max-frame") {
+                options.maxFrame = (unsigned int) strtoul(value.c_str(), nullptr, 10);
+            } else if (arg == "--seed") {
+                options.seed = (unsigned int) strtoul(value.c_str(), nullptr, 10);
+            } else if (arg == "--csv") {
+                options.csv = value;
+            } else if (arg == "--fail-below") {
+                options.failBelow = strtoul(value.c_str(), nullptr, 10);
+            } else {
+                return false;
+            }
+        }
+        return options.frames > 0 && options.sample > 0 && options.heap >= 4096 && options.resident < options.heap / 2;
+    }
+
+    Sample sample(uint64_t frame) {
+        Sample s = {frame, millis() / 3600000.0, deviceHeap->freeBytes(), deviceHeap->minFreeBytes(),
+                    deviceHeap->maxFreeBlockSize(), deviceHeap->lowWaterBlockSize(), deviceHeap->lowWaterFreeBytes(),
+                    deviceHeap->fragmentation(), deviceHeap->freeRuns(), deviceHeap->failures()};
+        deviceHeap->resetLowWater();
+        return s;
+    }
+
+    void printSample(FILE *out, const Sample &s) {
+        fprintf(out, "%12llu %8.2f %8zu %8zu %8zu %8zu %5u %6u %8u\n", (unsigned long long) s.frame, s.hours, s.free,
+                s.minFree, s.largest, s.lowLargest, s.fragmentation, s.runs, s.failures);
+    }
+
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--frames N] [--heap BYTES] [--resident BYTES] [--fit best|first] [--tick MS]\n"
+                        "          [--sample N] [--reconnect-every N] [--max-frame BYTES] [--seed N] [--csv FILE]\n"
+                        "          [--fail-below BYTES]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<Message> messages = loadMessages(options);
+    if (messages.empty()) {
+        fprintf(stderr, "no MESSAGE frames of at most %u bytes in %s\n", options.maxFrame, STOMP_SOAK_CORPUS);
+        return 1;
+    }
+
+    FILE *csv = nullptr;
+    if (!options.csv.empty()) {
+        csv = fopen(options.csv.c_str(), "w");
+        if (!csv) {
+            fprintf(stderr, "could not write %s\n", options.csv.c_str());
+            return 1;
+        }
+        fprintf(csv, "frame,hours,free,min_free,largest_block,low_largest_block,low_largest_free,fragmentation,"
+                     "free_runs,failed_allocations\n");
+    }
+
+    ArduinoShim::useManualClock();
+    ArduinoShim::allocHooks() = {reallocate, release};
+    StompHost::UmmHeap heap(options.heap, options.fit);
+    deviceHeap = &heap;
+
+    StompHost::LoopbackBroker broker;
+    broker.setHeartbeat(10000, 10000);
+    ResidentBuffers resident(options.resident);
+    HostPeer peer(broker, resident);
+    std::mt19937 random(options.seed);
+
+    int status = 0;
+    std::vector<Sample> samples;
+    Sample exhausted = {};  // the first sample at which a 2 KB allocation would fail with 20 KB free
+    {
+        DeviceScope device(true);
+        Device sketch;
+        sketch.webSocket.setPeer(&peer);
+        // received frames are copied into the device's heap, even when the broker queues them
+        bool previous = false;
+        sketch.webSocket.setReceiveScope([&previous](bool enter) {
+            if (enter) {
+                previous = onDevice;
+                onDevice = true;
+            } else {
+                onDevice = previous;
+            }
+        });
+
+        {
+            DeviceScope host(false);
+            printf("%12s %8s %8s %8s %8s %8s %5s %6s %8s\n", "frame", "hours", "free", "minfree", "largest", "lowest",
+                   "frag", "runs", "failed");
+        }
+        uint64_t printEvery = options.frames / options.sample > 40 ? options.frames / options.sample / 40 : 1;
+
+        try {
+            sketch.client.begin();
+            for (uint64_t frame = 0; frame < options.frames; frame++) {
+                uint32_t action = random() % 100;
+                if (action < 55) {
+                    const Message &message = messages[random() % messages.size()];
+                    DeviceScope host(false);
+                    broker.publish(action % 2 ? "/topic/soak" : "/queue/soak", message.body, message.headers);
+                } else if (action < 85) {
+                    sketch.sendTelemetry(random() % 360);
+                } else if (action < 90) {
+                    sketch.client.sendMessage("/queue/soak", "{\"echo\":" + String((unsigned long) frame) + "}");
+                }
+
+                ArduinoShim::advanceMillis(options.tick);
+                {
+                    DeviceScope host(false);
+                    broker.loop();
+                    if (options.reconnectEvery > 0 && frame % options.reconnectEvery == options.reconnectEvery - 1) {
+                        broker.dropConnections();
+                    }
+                }
+                sketch.client.loop();
+
+                if (frame % options.sample == options.sample - 1) {
+                    DeviceScope host(false);
+                    samples.push_back(sample(frame + 1));
+                    const Sample &s = samples.back();
+                    if (csv) {
+                        fprintf(csv, "%llu,%.3f,%zu,%zu,%zu,%zu,%zu,%u,%u,%u\n", (unsigned long long) s.frame, s.hours,
+                                s.free, s.minFree, s.largest, s.lowLargest, s.lowLargestFree, s.fragmentation, s.runs,
+                                s.failures);
+                    }
+                    if (samples.size() % printEvery == 0) {
+                        printSample(stdout, s);
+                    }
+                    if (exhausted.frame == 0 && s.lowLargest < 2048 && s.lowLargestFree > 20480) {
+                        exhausted = s;
+                    }
+                    if (s.lowLargest < options.failBelow) {
+                        status = 1;
+                    }
+                }
+            }
+        } catch (const DeviceOutOfMemory &error) {
+            DeviceScope host(false);
+            printf("operator new(%zu) failed on the device heap\n", error.size);
+            samples.push_back(sample(0));
+            status = 1;
+        }
+
+        DeviceScope host(false);
+        printf("\nmessages received %u, broker connects %u\n", sketch.received, broker.stats().connects);
+    }
+
+    if (csv) {
+        fclose(csv);
+    }
+
+    if (!samples.empty()) {
+        const Sample &first = samples.front();
+        const Sample &last = samples.back();
+        uint8_t peak = 0;
+        size_t lowest = first.lowLargest;
+        for (const auto &s: samples) {
+            peak = s.fragmentation > peak ? s.fragmentation : peak;
+            lowest = s.lowLargest < lowest ? s.lowLargest : lowest;
+        }
+        printf("heap %zu bytes, %zu resident per connection, %s fit, %.1f simulated hours\n", options.heap,
+               options.resident, options.fit == StompHost::UmmHeap::BEST_FIT ? "best" : "first", last.hours);
+        printf("free heap        %zu -> %zu (lowest %zu)\n", first.free, last.free, last.minFree);
+        printf("largest block    %zu -> %zu (lowest inside loop() %zu)\n", first.largest, last.largest, lowest);
+        printf("fragmentation    %u%% -> %u%% (peak %u%%)\n", first.fragmentation, last.fragmentation, peak);
+        printf("failed allocs    %u\n", last.failures);
+        if (exhausted.frame > 0) {
+            printf("a 2 KB allocation would first have failed by frame %llu (%.2f h) with %zu bytes free\n",
+                   (unsigned long long) exhausted.frame, exhausted.hours, exhausted.lowLargestFree);
+        }
+    }
+    resident.release();
+    deviceHeap = nullptr;
+    return status;
+}
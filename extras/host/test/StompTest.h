@@ -0,0 +1,158 @@
+/**
+ * A minimal test runner for the host build. STOMP_TEST(name) defines and registers a test, STOMP_CHECK(condition)
+ * records a failure without stopping the test, and STOMP_TEST_MAIN() runs every test in the file (or those whose name
+ * contains the first argument).
+ *
+ * TestClient is a StompClient on the mock socket with a manual clock, for scripting the broker's side of a session.
+ */
+
+#ifndef STOMP_HOST_TEST_H
+#define STOMP_HOST_TEST_H
+
+#include <Arduino.h>
+#include <WebSocketsClient.h>
+#include "StompClient.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace StompTest {
+
+    struct Test {
+        const char *name;
+        void (*function)();
+    };
+
+    inline std::vector<Test> &tests() {
+        static std::vector<Test> registered;
+        return registered;
+    }
+
+    inline int &failures() {
+        static int count = 0;
+        return count;
+    }
+
+    struct Registrar {
+        Registrar(const char *name, void (*function)()) {
+            tests().push_back({name, function});
+        }
+    };
+
+    inline bool check(bool ok, const char *expression, const char *file, int line) {
+        if (!ok) {
+            failures()++;
+            fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+        }
+        return ok;
+    }
+
+    inline int run(int argc, char **argv) {
+        int failedTests = 0;
+        int ran = 0;
+        for (const Test &test: tests()) {
+            if (argc > 1 && strstr(test.name, argv[1]) == nullptr) {
+                continue;
+            }
+            int before = failures();
+            test.function();
+            ran++;
+            bool passed = failures() == before;
+            failedTests += !passed;
+            printf("%-6s %s\n", passed ? "ok" : "FAIL", test.name);
+        }
+        printf("%d of %d tests passed\n", ran - failedTests, ran);
+        return failedTests == 0 && ran > 0 ? 0 : 1;
+    }
+
+    /**
+     * The command line of a frame the client sent
+     */
+    inline String command(const String &frame) {
+        int eol = frame.indexOf('\n');
+        return eol == -1 ? frame : frame.substring(0, eol);
+    }
+
+    /**
+     * A header of a frame the client sent, or "" if absent
+     */
+    inline String header(const String &frame, const char *key) {
+        return Stomp::StompCommandParser::parse(frame).headers.getValue(key);
+    }
+
+    /**
+     * A StompClient on the mock socket. Time only moves with ArduinoShim::advanceMillis()
+     */
+    struct TestClient {
+        WebSocketsClient webSocket;
+        Stomp::StompClient client;
+
+        explicit TestClient(bool sockjs = false) : client(webSocket, "test", 61613, "/ws", sockjs) {
+            ArduinoShim::useManualClock();
+        }
+
+        /**
+         * begin(), then answer CONNECT with CONNECTED. sent() is left holding what the client sent after CONNECTED
+         */
+        void connect(const char *heartBeat = "0,0") {
+            client.begin();
+            client.loop();
+            webSocket.sent().clear();
+            receive(String("CONNECTED\nversion:1.2\nheart-beat:") + heartBeat + "\n\n");
+        }
+
+        /**
+         * Deliver a frame from the broker and run one loop()
+         */
+        void receive(const String &frame) {
+            webSocket.queueText(frame);
+            client.loop();
+        }
+
+        /**
+         * A MESSAGE frame for the given subscription
+         */
+        static String message(int subscription, const String &id, const String &body,
+                              const String &extraHeaders = String()) {
+            return "MESSAGE\ndestination:/queue/test\nsubscription:sub-" + String(subscription) + "\nmessage-id:" + id +
+                   "\nack:" + id + "\n" + extraHeaders + "\n" + body;
+        }
+
+        /**
+         * The command lines of the frames sent since the last call
+         */
+        std::vector<String> sentCommands() {
+            std::vector<String> commands;
+            for (const String &frame: webSocket.sent()) {
+                commands.push_back(command(frame));
+            }
+            webSocket.sent().clear();
+            return commands;
+        }
+
+        /**
+         * The frames sent since the last call
+         */
+        std::vector<String> takeSent() {
+            std::vector<String> frames = webSocket.sent();
+            webSocket.sent().clear();
+            return frames;
+        }
+    };
+
+}
+
+#define STOMP_TEST(name) \
+    static void name(); \
+    static StompTest::Registrar name##Registrar(#name, name); \
+    static void name()
+
+#define STOMP_CHECK(condition) StompTest::check((condition), #condition, __FILE__, __LINE__)
+
+#define STOMP_TEST_MAIN() \
+    int main(int argc, char **argv) { \
+        return StompTest::run(argc, argv); \
+    }
+
+#endif
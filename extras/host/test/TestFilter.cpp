@@ -0,0 +1,231 @@
+/**
+ * StompHeaderFilter: expressions, evaluation against raw frames and rejection in the client
+ */
+
+#include "StompTest.h"
+
+using namespace Stomp;
+
+namespace {
+
+    const String frame = StompTest::TestClient::message(0, "m-1", "type:alarm",
+                                                        "type:reading\npriority:high\nlabel:front door\n");
+
+    struct Received {
+        int count = 0;
+
+        Stomp_Ack_t handle(const StompCommand &) {
+            count++;
+            return ACK;
+        }
+    };
+
+}
+
+STOMP_TEST(compileAcceptsEveryOperator) {
+    StompHeaderFilter filter;
+    STOMP_CHECK(filter.compile("type == reading"));
+    STOMP_CHECK(filter.compile("type!=reading"));
+    STOMP_CHECK(filter.compile("type in (reading, alarm)"));
+    STOMP_CHECK(filter.compile("type exists && priority == high && label == 'front door'"));
+}
+
+STOMP_TEST(compileRejectsMalformedExpressions) {
+    StompHeaderFilter filter;
+    const char *bad[] = {
+            "",
+            "type",
+            "type ==",
+            "type = reading",
+            "type in reading",
+            "type in (reading",
+            "type in ()",
+            "type == 'reading",
+            "type == reading &&",
+            "type == reading || priority == high",
+            "a exists && b exists && c exists && d exists && e exists",
+    };
+    for (const char *expression: bad) {
+        if (!STOMP_CHECK(!filter.compile(expression))) {
+            fprintf(stderr, "    compiled: %s\n", expression);
+        }
+    }
+    STOMP_CHECK(!filter.valid());
+    STOMP_CHECK(!filter.matches(frame));
+    STOMP_CHECK(!filter.compile(nullptr));
+}
+
+STOMP_TEST(equalsAndNotEquals) {
+    STOMP_CHECK(StompHeaderFilter("type == reading").matches(frame));
+    STOMP_CHECK(!StompHeaderFilter("type == read").matches(frame));
+    STOMP_CHECK(!StompHeaderFilter("type == readings").matches(frame));
+    STOMP_CHECK(!StompHeaderFilter("type != reading").matches(frame));
+    STOMP_CHECK(StompHeaderFilter("type != alarm").matches(frame));
+    // absent headers: == is false, != is true
+    STOMP_CHECK(!StompHeaderFilter("missing == x").matches(frame));
+    STOMP_CHECK(StompHeaderFilter("missing != x").matches(frame));
+}
+
+STOMP_TEST(inAndExists) {
+    STOMP_CHECK(StompHeaderFilter("type in (alarm, reading)").matches(frame));
+    STOMP_CHECK(!StompHeaderFilter("type in (alarm,status)").matches(frame));
+    STOMP_CHECK(!StompHeaderFilter("missing in (x)").matches(frame));
+    STOMP_CHECK(StompHeaderFilter("priority exists").matches(frame));
+    STOMP_CHECK(!StompHeaderFilter("missing exists").matches(frame));
+}
+
+STOMP_TEST(quotedValuesAndConjunctions) {
+    STOMP_CHECK(StompHeaderFilter("label == 'front door'").matches(frame));
+    STOMP_CHECK(StompHeaderFilter("label in (\"back door\", \"front door\")").matches(frame));
+    STOMP_CHECK(StompHeaderFilter("type == reading && priority == high").matches(frame));
+    STOMP_CHECK(!StompHeaderFilter("type == reading && priority == low").matches(frame));
+}
+
+STOMP_TEST(bodyIsNotSearched) {
+    // the body reads "type:alarm"
+    STOMP_CHECK(!StompHeaderFilter("type == alarm").matches(frame));
+}
+
+STOMP_TEST(escapedHeaderValuesAreDecoded) {
+    String escaped = StompTest::TestClient::message(0, "m-1", "", "device-id:5C\\cCF\\c7F\\c01\\c02\\c03\n"
+                                                                  "path:C\\\\temp\n");
+    STOMP_CHECK(StompHeaderFilter("device-id == 5C:CF:7F:01:02:03").matches(escaped));
+    STOMP_CHECK(StompHeaderFilter("device-id in (00:00:00:00:00:00, 5C:CF:7F:01:02:03)").matches(escaped));
+    STOMP_CHECK(!StompHeaderFilter("device-id != 5C:CF:7F:01:02:03").matches(escaped));
+    STOMP_CHECK(!StompHeaderFilter("device-id == 5C:CF:7F:01:02").matches(escaped));
+    STOMP_CHECK(StompHeaderFilter("path == C\\temp").matches(escaped));
+    // unescaped colons, as sent by STOMP 1.0 brokers, still match
+    STOMP_CHECK(StompHeaderFilter("device-id == 5C:CF:7F:01:02:03").matches(
+            StompTest::TestClient::message(0, "m-1", "", "device-id:5C:CF:7F:01:02:03\n")));
+}
+
+STOMP_TEST(crlfFramesAreFilteredOnTheirHeaders) {
+    String crlf = "MESSAGE\r\nsubscription:sub-0\r\ntype:reading\r\n\r\ntype:alarm\r\n";
+    STOMP_CHECK(StompHeaderFilter("type == reading").matches(crlf));
+    STOMP_CHECK(!StompHeaderFilter("type == alarm").matches(crlf));
+}
+
+STOMP_TEST(rejectionsAreCounted) {
+    StompHeaderFilter filter("type == alarm");
+    filter.matches(frame);
+    filter.matches(frame);
+    STOMP_CHECK(filter.rejected() == 2);
+}
+
+STOMP_TEST(clientDropsAndAcknowledgesRejectedMessages) {
+    StompTest::TestClient t;
+    Received received;
+    StompHeaderFilter filter("type == alarm");
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL, StompMessageHandler(&received, &Received::handle));
+    t.client.setFilter(id, &filter);
+    t.takeSent();
+
+    t.receive(StompTest::TestClient::message(id, "m-1", "", "type:reading\n"));
+    STOMP_CHECK(received.count == 0);
+    std::vector<String> sent = t.takeSent();
+    STOMP_CHECK(sent.size() == 1 && StompTest::command(sent[0]).equals("ACK"));
+    STOMP_CHECK(sent.size() == 1 && StompTest::header(sent[0], "id").equals("m-1"));
+
+    t.receive(StompTest::TestClient::message(id, "m-2", "", "type:alarm\n"));
+    STOMP_CHECK(received.count == 1);
+}
+
+STOMP_TEST(continueLeavesRejectedMessagesUnacknowledged) {
+    StompTest::TestClient t;
+    Received received;
+    StompHeaderFilter filter("type == alarm");
+    filter.setRejected(CONTINUE);
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL, StompMessageHandler(&received, &Received::handle));
+    t.client.setFilter(id, &filter);
+    t.takeSent();
+
+    t.receive(StompTest::TestClient::message(id, "m-1", "", "type:reading\n"));
+    STOMP_CHECK(received.count == 0);
+    STOMP_CHECK(t.takeSent().empty());
+}
+
+STOMP_TEST(clientModeAcknowledgesRejectionsCumulatively) {
+    StompTest::TestClient t;
+    Received received;
+    StompHeaderFilter filter("type == alarm");
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT, StompMessageHandler(&received, &Received::handle));
+    t.client.setFilter(id, &filter);
+    t.takeSent();
+
+    // a selective filter: one ACK, for the newest, covers a run of rejections
+    t.webSocket.queueText(StompTest::TestClient::message(id, "m-1", "", "type:reading\n"));
+    t.webSocket.queueText(StompTest::TestClient::message(id, "m-2", "", "type:reading\n"));
+    t.client.loop();
+    STOMP_CHECK(received.count == 0);
+    std::vector<String> sent = t.takeSent();
+    STOMP_CHECK(sent.size() == 1 && StompTest::header(sent[0], "id").equals("m-2"));
+    t.client.loop();
+    STOMP_CHECK(t.takeSent().empty());
+
+    // an accepted message's ACK covers the rejections before it
+    t.webSocket.queueText(StompTest::TestClient::message(id, "m-3", "", "type:reading\n"));
+    t.webSocket.queueText(StompTest::TestClient::message(id, "m-4", "", "type:alarm\n"));
+    t.client.loop();
+    sent = t.takeSent();
+    STOMP_CHECK(received.count == 1);
+    STOMP_CHECK(sent.size() == 1 && StompTest::header(sent[0], "id").equals("m-4"));
+}
+
+STOMP_TEST(clientModeWaitsForMessagesTheSketchHolds) {
+    struct Holder {
+        StompCommand kept;
+
+        Stomp_Ack_t handle(const StompCommand &message) {
+            kept = message;
+            return CONTINUE;
+        }
+    } holder;
+
+    StompTest::TestClient t;
+    StompHeaderFilter filter("type == alarm");
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT, StompMessageHandler(&holder, &Holder::handle));
+    t.client.setFilter(id, &filter);
+    t.takeSent();
+
+    // m-1 is held: an ACK of m-2 would settle it too
+    t.receive(StompTest::TestClient::message(id, "m-1", "", "type:alarm\n"));
+    t.receive(StompTest::TestClient::message(id, "m-2", "", "type:reading\n"));
+    t.client.loop();
+    STOMP_CHECK(t.takeSent().empty());
+
+    // once the sketch settles m-1, the rejection is acknowledged
+    t.client.ack(holder.kept);
+    t.client.loop();
+    std::vector<String> sent = t.takeSent();
+    STOMP_CHECK(sent.size() == 2);
+    STOMP_CHECK(sent.size() == 2 && StompTest::header(sent[0], "id").equals("m-1") &&
+                StompTest::header(sent[1], "id").equals("m-2"));
+}
+
+STOMP_TEST(rejectionsOfAClosedSessionAreNotAcknowledged) {
+    StompTest::TestClient t;
+    Received received;
+    StompHeaderFilter filter("type == alarm");
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT, StompMessageHandler(&received, &Received::handle));
+    t.client.setFilter(id, &filter);
+    t.takeSent();
+
+    t.webSocket.queueText(StompTest::TestClient::message(id, "m-1", "", "type:reading\n"));
+    t.webSocket.drop();
+    t.client.loop();
+    ArduinoShim::advanceMillis(500);
+    t.client.loop();
+    t.client.loop();
+    t.receive("CONNECTED\nversion:1.2\n\n");
+    t.client.loop();
+    for (const String &frame: t.takeSent()) {
+        STOMP_CHECK(!StompTest::command(frame).equals("ACK"));
+    }
+}
+
+STOMP_TEST_MAIN()
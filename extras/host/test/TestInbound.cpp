@@ -0,0 +1,176 @@
+/**
+ * The inbound queue: deferred dispatch, priority lanes, the loop() time budget and overflow
+ */
+
+#include "StompTest.h"
+
+using namespace Stomp;
+
+namespace {
+
+    typedef StompTest::TestClient TestClient;
+
+    struct Recorder {
+        std::vector<String> bodies;
+        unsigned long workMicros = 0;
+
+        Stomp_Ack_t handle(const StompCommand &message) {
+            bodies.push_back(message.body);
+            ArduinoShim::advanceMicros(workMicros);
+            return ACK;
+        }
+
+        String order() const {
+            String out;
+            for (const String &body: bodies) out += body;
+            return out;
+        }
+    };
+
+}
+
+STOMP_TEST(framesWaitForDispatch) {
+    TestClient t;
+    Recorder recorder;
+    t.client.setInboundQueue(true);
+    t.connect();
+    STOMP_CHECK(t.client.state() == CONNECTED);   // CONNECTED itself goes through the queue
+    int id = t.client.subscribe("/queue/test", AUTO, StompMessageHandler(&recorder, &Recorder::handle));
+
+    for (int i = 0; i < 3; i++) {
+        t.webSocket.queueText(TestClient::message(id, "m-" + String(i), String(i)));
+    }
+    t.client.loop();
+    STOMP_CHECK(recorder.order().equals("012"));
+    STOMP_CHECK(t.client.inboundBacklog() == 0);
+    STOMP_CHECK(t.client.inboundHighWater() >= 3);
+}
+
+STOMP_TEST(higherPrioritiesAreDispatchedFirst) {
+    TestClient t;
+    Recorder recorder;
+    t.client.setInboundQueue(true);
+    t.connect();
+    int low = t.client.subscribe("/queue/low", AUTO, StompMessageHandler(&recorder, &Recorder::handle));
+    int high = t.client.subscribe("/queue/high", AUTO, StompMessageHandler(&recorder, &Recorder::handle));
+    t.client.setPriority(high, STOMP_INBOUND_LANES - 1);
+
+    t.webSocket.queueText(TestClient::message(low, "m-1", "a"));
+    t.webSocket.queueText(TestClient::message(low, "m-2", "b"));
+    t.webSocket.queueText(TestClient::message(high, "m-3", "C"));
+    t.client.loop();
+    STOMP_CHECK(recorder.order().equals("Cab"));
+}
+
+STOMP_TEST(waitingLanesAreNotStarved) {
+    StompInboundQueue queue;
+    for (int i = 0; i < 2; i++) {
+        String frame = "low" + String(i);
+        queue.push(frame, 0);
+    }
+    String out;
+    int served = 0;
+    bool lowServed = false;
+    // keep the high lane busy: the low lane still gets a turn within the limit
+    for (int i = 0; i <= STOMP_LANE_STARVATION_LIMIT && !lowServed; i++) {
+        String frame = "high";
+        queue.push(frame, STOMP_INBOUND_LANES - 1);
+        queue.pop(out);
+        served++;
+        lowServed = out.startsWith("low");
+    }
+    STOMP_CHECK(lowServed);
+    STOMP_CHECK(served == STOMP_LANE_STARVATION_LIMIT + 1);
+}
+
+STOMP_TEST(budgetLeavesTheRestForTheNextLoop) {
+    TestClient t;
+    Recorder recorder;
+    recorder.workMicros = 400;
+    t.client.setInboundQueue(true);
+    t.connect();
+    int id = t.client.subscribe("/queue/test", AUTO, StompMessageHandler(&recorder, &Recorder::handle));
+
+    for (int i = 0; i < 5; i++) {
+        t.webSocket.queueText(TestClient::message(id, "m-" + String(i), String(i)));
+    }
+    t.client.loop(1000);
+    STOMP_CHECK(recorder.bodies.size() == 3);
+    STOMP_CHECK(t.client.inboundBacklog() == 2);
+    STOMP_CHECK(t.client.budgetExceeded() == 1);
+    t.client.loop(1000);
+    STOMP_CHECK(recorder.order().equals("01234"));
+}
+
+STOMP_TEST(fullLaneDispatchesItsOldestAtOnce) {
+    TestClient t;
+    Recorder recorder;
+    recorder.workMicros = 1;
+    t.client.setInboundQueue(true);
+    t.connect();
+    int id = t.client.subscribe("/queue/test", AUTO, StompMessageHandler(&recorder, &Recorder::handle));
+
+    for (int i = 0; i < STOMP_INBOUND_QUEUE_DEPTH + 2; i++) {
+        t.webSocket.queueText(TestClient::message(id, "m-" + String(i), String(i) + ","));
+    }
+    t.client.loop(1);   // the budget runs out after the one frame every loop() dispatches
+    STOMP_CHECK(t.client.inboundOverflows() == 2);
+    STOMP_CHECK(recorder.order().equals("0,1,2,"));
+    STOMP_CHECK(t.client.inboundBacklog() == STOMP_INBOUND_QUEUE_DEPTH - 1);
+}
+
+STOMP_TEST(slowSocketStillLeavesTimeForOneFrame) {
+    TestClient t;
+    Recorder recorder;
+    t.client.setInboundQueue(true);
+    t.connect();
+    int id = t.client.subscribe("/queue/test", AUTO, StompMessageHandler(&recorder, &Recorder::handle));
+    t.webSocket.setLoopMicros(500);   // TLS alone uses up the budget
+
+    for (int i = 0; i < 4; i++) {
+        t.webSocket.queueText(TestClient::message(id, "m-" + String(i), String(i)));
+    }
+    for (int i = 0; i < 4; i++) {
+        t.client.loop(100);
+        STOMP_CHECK(recorder.bodies.size() == (size_t) i + 1);
+    }
+    STOMP_CHECK(recorder.order().equals("0123"));
+    STOMP_CHECK(t.client.inboundOverflows() == 0);
+    STOMP_CHECK(t.client.budgetExceeded() == 3);   // not counted when nothing is left
+}
+
+STOMP_TEST(disconnectDiscardsTheBacklog) {
+    TestClient t;
+    Recorder recorder;
+    recorder.workMicros = 400;
+    t.client.setInboundQueue(true);
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL, StompMessageHandler(&recorder, &Recorder::handle));
+
+    for (int i = 0; i < 5; i++) {
+        t.webSocket.queueText(TestClient::message(id, "m-" + String(i), String(i)));
+    }
+    t.client.loop(1000);
+    STOMP_CHECK(t.client.inboundBacklog() == 2);
+    STOMP_CHECK(t.takeSent().size() == 4);   // SUBSCRIBE and three ACKs
+
+    // the socket drops with m-3 and m-4 still queued, and comes back
+    t.webSocket.drop();
+    t.client.loop();
+    STOMP_CHECK(t.client.inboundBacklog() == 0);
+    ArduinoShim::advanceMillis(500);
+    t.client.loop();
+    t.client.loop();
+    t.receive("CONNECTED\nversion:1.2\n\n");
+    t.client.loop();
+    STOMP_CHECK(t.client.state() == CONNECTED);
+    STOMP_CHECK(recorder.order().equals("012"));
+
+    // nothing from the old session is ACKed on the new one
+    std::vector<String> sent = t.takeSent();
+    for (const String &frame: sent) {
+        STOMP_CHECK(!StompTest::command(frame).equals("ACK"));
+    }
+}
+
+STOMP_TEST_MAIN()
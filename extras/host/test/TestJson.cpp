@@ -0,0 +1,119 @@
+/**
+ * StompJsonDecoder: field types, range checks, escapes, skipped values and malformed input
+ */
+
+#include "StompTest.h"
+
+using namespace Stomp;
+
+namespace {
+
+    struct Reading {
+        int8_t small;
+        int32_t count;
+        uint16_t port;
+        int64_t big;
+        float temperature;
+        double precise;
+        bool on;
+        char name[8];
+    };
+
+    const StompJsonField readingFields[] = {
+            STOMP_JSON_FIELD(Reading, small, JSON_INT),
+            STOMP_JSON_FIELD(Reading, count, JSON_INT),
+            STOMP_JSON_FIELD(Reading, port, JSON_UINT),
+            STOMP_JSON_FIELD(Reading, big, JSON_INT),
+            STOMP_JSON_FIELD(Reading, temperature, JSON_FLOAT),
+            STOMP_JSON_FIELD(Reading, precise, JSON_FLOAT),
+            STOMP_JSON_FIELD(Reading, on, JSON_BOOL),
+            STOMP_JSON_FIELD_KEY(Reading, name, "device", JSON_STRING),
+    };
+
+    const StompJsonSchema reading(readingFields);
+
+    bool decode(const char *json, Reading &out, uint32_t *present = nullptr) {
+        out = Reading();
+        return StompJsonDecoder::decode(json, reading, &out, present);
+    }
+
+}
+
+STOMP_TEST(decodesEveryType) {
+    Reading r;
+    uint32_t present;
+    STOMP_CHECK(decode("{\"small\":-128,\"count\":123456,\"port\":65535,\"big\":-9223372036854775808,"
+                       "\"temperature\":21.5,\"precise\":0.125,\"on\":true,\"device\":\"pump\"}", r, &present));
+    STOMP_CHECK(r.small == -128);
+    STOMP_CHECK(r.count == 123456);
+    STOMP_CHECK(r.port == 65535);
+    STOMP_CHECK(r.big == INT64_MIN);
+    STOMP_CHECK(r.temperature == 21.5f);
+    STOMP_CHECK(r.precise == 0.125);
+    STOMP_CHECK(r.on);
+    STOMP_CHECK(strcmp(r.name, "pump") == 0);
+    STOMP_CHECK(present == 0xFF);
+}
+
+STOMP_TEST(absentAndNullFieldsAreLeftAlone) {
+    Reading r;
+    uint32_t present;
+    STOMP_CHECK(decode(" { \"count\" : 7 , \"port\" : null } ", r, &present));
+    STOMP_CHECK(r.count == 7 && r.port == 0);
+    STOMP_CHECK(present == 1u << 1);
+    STOMP_CHECK(decode("{}", r, &present) && present == 0);
+}
+
+STOMP_TEST(valuesOutOfRangeFail) {
+    Reading r;
+    STOMP_CHECK(!decode("{\"small\":128}", r));
+    STOMP_CHECK(decode("{\"small\":127}", r));
+    STOMP_CHECK(!decode("{\"port\":65536}", r));
+    STOMP_CHECK(!decode("{\"port\":-1}", r));
+    STOMP_CHECK(!decode("{\"count\":1.5}", r));
+    STOMP_CHECK(!decode("{\"big\":99999999999999999999}", r));
+    STOMP_CHECK(!decode("{\"on\":1}", r));
+}
+
+STOMP_TEST(stringsAreUnescapedAndBounded) {
+    Reading r;
+    STOMP_CHECK(decode("{\"device\":\"a\\\"b\\\\c\\n\"}", r));
+    STOMP_CHECK(strcmp(r.name, "a\"b\\c\n") == 0);
+    STOMP_CHECK(decode("{\"device\":\"\\u00e9\\u20ac\"}", r));
+    STOMP_CHECK(strcmp(r.name, "\xC3\xA9\xE2\x82\xAC") == 0);
+    STOMP_CHECK(decode("{\"device\":\"1234567\"}", r));
+    STOMP_CHECK(!decode("{\"device\":\"12345678\"}", r));   // no room for the terminator
+    STOMP_CHECK(!decode("{\"device\":\"\\q\"}", r));
+    STOMP_CHECK(!decode("{\"device\":7}", r));
+}
+
+STOMP_TEST(unknownKeysAndNestedValuesAreSkipped) {
+    Reading r;
+    STOMP_CHECK(decode("{\"meta\":{\"a\":[1,{\"b\":\"}]\"}],\"c\":null},\"list\":[[],[2]],\"x\":-1e3,"
+                       "\"count\":9}", r));
+    STOMP_CHECK(r.count == 9);
+}
+
+STOMP_TEST(malformedJsonFails) {
+    Reading r;
+    const char *bad[] = {
+            "",
+            "[]",
+            "{",
+            "{\"count\":}",
+            "{\"count\" 1}",
+            "{\"count\":1,}",
+            "{\"count\":1} trailing",
+            "{count:1}",
+            "{\"meta\":{\"a\":1}",
+            "{\"meta\":[1,2}",
+            "{\"device\":\"open",
+    };
+    for (const char *json: bad) {
+        if (!STOMP_CHECK(!decode(json, r))) {
+            fprintf(stderr, "    accepted: %s\n", json);
+        }
+    }
+}
+
+STOMP_TEST_MAIN()
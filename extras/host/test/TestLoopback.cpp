@@ -0,0 +1,254 @@
+/**
+ * End to end against the loopback broker, with its scripted faults: lost heart-beats, late receipts and a connection
+ * cut in the middle of a frame
+ */
+
+#include "StompTest.h"
+#include "StompLoopbackBroker.h"
+
+using namespace Stomp;
+
+namespace {
+
+    /**
+     * A client on a loopback broker, subscribing to /queue/test on every connect
+     */
+    struct Session {
+        StompHost::LoopbackBroker broker;
+        StompTest::TestClient t;
+        std::vector<String> received;
+        int subscription = -1;
+        int disconnects = 0;
+
+        explicit Session(bool sockjs = false) : broker(sockjs), t(sockjs) {
+            t.webSocket.setPeer(&broker);
+            t.client.onConnect(StompStateHandler(this, &Session::connected));
+            t.client.onDisconnect(StompStateHandler(this, &Session::disconnected));
+        }
+
+        void connected(const StompCommand &) {
+            subscription = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL,
+                                              StompMessageHandler(this, &Session::message));
+        }
+
+        void disconnected(const StompCommand &) {
+            disconnects++;
+        }
+
+        Stomp_Ack_t message(const StompCommand &message) {
+            received.push_back(message.body);
+            return ACK;
+        }
+
+        /**
+         * Run the client and the broker for ms, in steps of step ms
+         */
+        void run(unsigned long ms, unsigned long step = 10) {
+            for (unsigned long elapsed = 0; elapsed < ms; elapsed += step) {
+                ArduinoShim::advanceMillis(step);
+                t.client.loop();
+                broker.loop();
+            }
+        }
+
+        bool start() {
+            t.client.begin();
+            run(50);
+            return t.client.state() == CONNECTED;
+        }
+    };
+
+}
+
+STOMP_TEST(messagesRoundTrip) {
+    Session s;
+    STOMP_CHECK(s.start());
+    s.t.client.sendMessage("/queue/test", "hello");
+    s.run(50);
+    STOMP_CHECK(s.received.size() == 1 && s.received[0].equals("hello"));
+    STOMP_CHECK(s.broker.stats().acks == 1);
+    STOMP_CHECK(s.broker.unacknowledged() == 0);
+}
+
+STOMP_TEST(heartbeatsKeepTheConnection) {
+    Session s;
+    s.broker.setHeartbeat(1000, 1000);
+    s.t.client.setHeartbeat(1000, 1000);
+    STOMP_CHECK(s.start());
+    s.run(10000);
+    STOMP_CHECK(s.t.client.state() == CONNECTED);
+    STOMP_CHECK(s.t.client.heartbeatMisses() == 0);
+    STOMP_CHECK(s.broker.stats().connects == 1);
+    STOMP_CHECK(s.broker.stats().heartbeatsIn >= 9 && s.broker.stats().heartbeatsOut >= 9);
+}
+
+STOMP_TEST(droppedHeartbeatsForceAReconnect) {
+    Session s;
+    s.broker.setHeartbeat(1000, 0);
+    s.t.client.setHeartbeat(0, 1000);
+    STOMP_CHECK(s.start());
+    s.run(3000);
+    STOMP_CHECK(s.t.client.heartbeatMisses() == 0);
+
+    s.broker.dropHeartbeats(true);
+    unsigned long waited = 0;
+    while (s.t.client.heartbeatMisses() == 0 && waited < 10000) {
+        s.run(10);
+        waited += 10;
+    }
+    STOMP_CHECK(s.t.client.heartbeatMisses() == 1);
+    STOMP_CHECK(waited <= 1000 * (STOMP_HEARTBEAT_TOLERANCE + 1));
+    STOMP_CHECK(s.t.client.state() != CONNECTED);
+
+    // the broker is still there: the client reconnects and is served again
+    s.broker.dropHeartbeats(false);
+    s.run(1000);
+    STOMP_CHECK(s.t.client.state() == CONNECTED);
+    STOMP_CHECK(s.broker.stats().connects == 2);
+    s.broker.publish("/queue/test", "after");
+    s.run(50);
+    STOMP_CHECK(s.received.size() == 1 && s.received[0].equals("after"));
+}
+
+STOMP_TEST(lateDisconnectReceiptStillCompletes) {
+    Session s;
+    s.broker.delayReceipts(3000);
+    STOMP_CHECK(s.start());
+    s.t.client.disconnect();
+    s.run(2900);
+    STOMP_CHECK(s.t.client.state() == DISCONNECTING);
+    s.run(200);
+    STOMP_CHECK(s.t.client.state() == DISCONNECTED);
+    STOMP_CHECK(s.disconnects == 1);   // the handler runs on the receipt
+    STOMP_CHECK(s.broker.sessions() == 0);
+}
+
+STOMP_TEST(receiptLaterThanTheTimeoutIsIgnored) {
+    Session s;
+    s.broker.delayReceipts(3000);
+    s.t.client.setStateTimeout(DISCONNECTING, 1000);
+    STOMP_CHECK(s.start());
+    s.t.webSocket.setReconnectInterval(0);   // stay closed afterwards
+    s.t.client.disconnect();
+    s.run(1100);
+    STOMP_CHECK(s.t.client.state() == DISCONNECTED);
+    STOMP_CHECK(!s.t.webSocket.isConnected());
+    s.run(3000);
+    STOMP_CHECK(s.t.client.state() == DISCONNECTED);
+    STOMP_CHECK(s.disconnects == 0);
+}
+
+STOMP_TEST(ackReceiptsArriveLate) {
+    Session s;
+    s.broker.delayReceipts(500);
+    s.t.client.setAckReceipts(true);
+    STOMP_CHECK(s.start());
+    s.broker.publish("/queue/test", "a");
+    s.run(20);
+    STOMP_CHECK(s.received.size() == 1);
+    STOMP_CHECK(s.t.client.pendingReceipts() == 1);
+    s.run(500);
+    STOMP_CHECK(s.t.client.pendingReceipts() == 0);
+}
+
+STOMP_TEST(frameCutByDisconnectIsDiscarded) {
+    Session s;
+    STOMP_CHECK(s.start());
+    s.broker.disconnectMidFrame(1);
+    s.broker.publish("/queue/test", "whole");
+    s.broker.publish("/queue/test", "cut");
+    s.run(20);
+    STOMP_CHECK(s.received.size() == 1 && s.received[0].equals("whole"));
+    STOMP_CHECK(s.t.client.state() != CONNECTED);
+
+    s.run(1000);
+    STOMP_CHECK(s.t.client.state() == CONNECTED);
+    STOMP_CHECK(s.broker.stats().connects == 2);
+    s.broker.publish("/queue/test", "next");
+    s.run(50);
+    STOMP_CHECK(s.received.size() == 2 && s.received[1].equals("next"));
+}
+
+namespace {
+
+    /**
+     * A client on a loopback broker with a CLIENT mode batch subscription to /queue/test
+     */
+    struct BatchSession {
+        StompHost::LoopbackBroker broker;
+        StompTest::TestClient t;
+        StompBatchBuffer buffer;
+        std::vector<String> handled;
+
+        BatchSession() : buffer(4) {
+            t.webSocket.setPeer(&broker);
+        }
+
+        Stomp_Ack_t handle(StompBatch &batch) {
+            for (uint8_t i = 0; i < batch.count; i++) {
+                handled.push_back(batch.messages[i].body);
+            }
+            return ACK;
+        }
+
+        bool start() {
+            t.client.begin();
+            for (int i = 0; i < 5; i++) {
+                ArduinoShim::advanceMillis(10);
+                t.client.loop();
+            }
+            t.client.subscribeBatch("/queue/test", CLIENT, buffer, StompBatchHandler(this, &BatchSession::handle));
+            t.client.loop();
+            return t.client.state() == CONNECTED;
+        }
+    };
+
+}
+
+STOMP_TEST(batchesAreSettledBeforeDisconnect) {
+    BatchSession s;
+    STOMP_CHECK(s.start());
+    s.t.client.setAckReceipts(true);
+    s.broker.publish("/queue/test", "a");
+    s.t.client.loop();
+    STOMP_CHECK(s.t.client.pendingReceipts() == 1);
+
+    // b arrives while disconnectGracefully() waits for a's receipt
+    s.broker.publish("/queue/test", "b");
+    STOMP_CHECK(s.t.client.disconnectGracefully(200));
+    STOMP_CHECK(s.handled.size() == 2);
+    STOMP_CHECK(s.broker.unacknowledged() == 0);
+}
+
+STOMP_TEST(batchesOfAClosedSessionAreDropped) {
+    BatchSession s;
+    STOMP_CHECK(s.start());
+    s.t.webSocket.setRecording(true);
+
+    // old-1 arrives after DISCONNECT, and is still in the batch when the session ends
+    s.broker.publish("/queue/test", "old-1");
+    STOMP_CHECK(s.t.client.disconnectGracefully(200));
+    STOMP_CHECK(s.handled.empty());
+    STOMP_CHECK(s.buffer.count() == 0);
+    s.t.takeSent();
+
+    s.t.client.begin();
+    s.t.client.loop();
+    for (const String &frame: s.t.takeSent()) {
+        STOMP_CHECK(!StompTest::command(frame).equals("ACK"));
+    }
+    STOMP_CHECK(s.handled.empty());
+}
+
+STOMP_TEST(sockjsSessionRoundTrip) {
+    Session s(true);
+    STOMP_CHECK(s.start());
+    STOMP_CHECK(s.broker.sessions() == 1);
+    s.t.client.sendMessage("/queue/test", "line 1\nline \"2\"\t\\");
+    s.run(50);
+    STOMP_CHECK(s.received.size() == 1 && s.received[0].equals("line 1\nline \"2\"\t\\"));
+    STOMP_CHECK(s.broker.stats().acks == 1);
+    STOMP_CHECK(s.broker.stats().errors == 0);
+}
+
+STOMP_TEST_MAIN()
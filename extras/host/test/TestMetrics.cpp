@@ -0,0 +1,71 @@
+/**
+ * StompMetrics: the histograms, and what the client counts in each direction
+ */
+
+#include "StompTest.h"
+
+using namespace Stomp;
+
+STOMP_TEST(histogramPercentilesAreBucketBounds) {
+    StompHistogram histogram;
+    STOMP_CHECK(histogram.percentile(50) == 0 && histogram.min() == 0);
+    for (uint32_t value = 1; value <= 100; value++) {
+        histogram.record(value);
+    }
+    STOMP_CHECK(histogram.count() == 100);
+    STOMP_CHECK(histogram.min() == 1 && histogram.max() == 100 && histogram.mean() == 50);
+    STOMP_CHECK(histogram.percentile(50) == 63);   // 50 is in [32, 64)
+    STOMP_CHECK(histogram.percentile(100) == 100);
+    histogram.reset();
+    STOMP_CHECK(histogram.count() == 0 && histogram.max() == 0);
+}
+
+STOMP_TEST(frameSizesAreSplitByDirection) {
+    StompTest::TestClient t;
+    t.connect();
+    const StompMetrics &metrics = t.client.metrics();
+    uint32_t in = metrics.frameSizeIn.count();
+    uint32_t out = metrics.frameSizeOut.count();
+    STOMP_CHECK(in == metrics.framesIn && out == metrics.framesOut);
+
+    String big = "0123456789";
+    for (int i = 0; i < 6; i++) {
+        big += big;
+    }
+    t.client.sendMessage("/queue/test", big);
+    STOMP_CHECK(metrics.frameSizeOut.count() == out + 1 && metrics.frameSizeOut.max() > big.length());
+    STOMP_CHECK(metrics.frameSizeIn.count() == in && metrics.frameSizeIn.max() < big.length());
+
+    t.receive(StompTest::TestClient::message(0, "m-1", "x"));
+    STOMP_CHECK(metrics.frameSizeIn.count() == in + 1);
+    STOMP_CHECK(metrics.frameSizeOut.count() == out + 1);
+}
+
+STOMP_TEST(refusedSendsAreNotCountedAsSent) {
+    StompTest::TestClient t;
+    t.connect();
+    const StompMetrics &metrics = t.client.metrics();
+    uint32_t out = metrics.frameSizeOut.count();
+    uint32_t bytes = metrics.bytesOut;
+
+    t.webSocket.setFailSends(true);
+    t.client.sendMessage("/queue/test", "lost");
+    STOMP_CHECK(metrics.sendFailures == 1);
+    STOMP_CHECK(metrics.frameSizeOut.count() == out && metrics.bytesOut == bytes);
+    STOMP_CHECK(metrics.sendMicros.count() > 0);   // the attempt still took time
+}
+
+STOMP_TEST(heartbeatsAreCountedOnce) {
+    StompTest::TestClient t;
+    t.connect("1000,1000");
+    uint32_t before = t.client.metrics().heartbeatsIn;
+    t.receive("\n");
+    STOMP_CHECK(t.client.metrics().heartbeatsIn == before + 1);
+
+    String json;
+    t.client.metrics().toJson(json);
+    STOMP_CHECK(json.indexOf("\"hbIn\":" + String(before + 1) + ",") >= 0);
+    STOMP_CHECK(json.indexOf("\"sizeIn\":{") >= 0 && json.indexOf("\"sizeOut\":{") >= 0);
+}
+
+STOMP_TEST_MAIN()
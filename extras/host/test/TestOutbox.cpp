@@ -0,0 +1,148 @@
+/**
+ * Store-and-forward: the ring outbox (wrap, epochs, TTL) and the client's queueing and replay
+ */
+
+#include "StompTest.h"
+
+using namespace Stomp;
+
+namespace {
+
+    /**
+     * A ring outbox in a block the test owns, so that a "reboot" can re-attach to it
+     */
+    class BlockOutbox : public StompRingOutbox {
+
+    public:
+        BlockOutbox(uint8_t *block, uint32_t size) {
+            _attach(block, size);
+        }
+    };
+
+    String frame(int n, unsigned int size = 20) {
+        String text = "SEND\ndestination:/q\n\n" + String(n) + ":";
+        while (text.length() < size) text += "x";
+        return text;
+    }
+
+}
+
+STOMP_TEST(ringKeepsOrderAcrossWrap) {
+    ArduinoShim::useManualClock();
+    uint32_t block[48] = {};
+    BlockOutbox outbox((uint8_t *) block, sizeof(block));
+
+    String out;
+    StompOutboxRecord record;
+    int next = 0;
+    int pushed = 0;
+    // keep the ring part full for several laps, so that records wrap around the end of the block
+    for (int lap = 0; lap < 60; lap++) {
+        while (outbox.push(frame(pushed, 30 + pushed % 17), 0)) pushed++;
+        STOMP_CHECK(outbox.size() > 0);
+        for (int i = 0; i < 2 && outbox.peek(out, record); i++) {
+            STOMP_CHECK(out.equals(frame(next, 30 + next % 17)));
+            outbox.pop();
+            next++;
+        }
+    }
+    while (outbox.peek(out, record)) {
+        STOMP_CHECK(out.equals(frame(next, 30 + next % 17)));
+        outbox.pop();
+        next++;
+    }
+    STOMP_CHECK(next == pushed);
+    STOMP_CHECK(pushed > 120);
+    STOMP_CHECK(outbox.size() == 0);
+}
+
+STOMP_TEST(ringRefusesWhatDoesNotFit) {
+    uint32_t block[16] = {};
+    BlockOutbox outbox((uint8_t *) block, sizeof(block));
+    STOMP_CHECK(!outbox.push(frame(0, 200), 0));
+    STOMP_CHECK(outbox.push(frame(1, 20), 0));
+    STOMP_CHECK(outbox.size() == 1);
+}
+
+STOMP_TEST(ttlExpiresFrames) {
+    ArduinoShim::useManualClock();
+    uint32_t block[64] = {};
+    BlockOutbox outbox((uint8_t *) block, sizeof(block));
+    outbox.push(frame(0), 1000);
+    outbox.push(frame(1), 0);
+
+    String out;
+    StompOutboxRecord record;
+    outbox.peek(out, record);
+    STOMP_CHECK(!outbox.expired(record));
+    ArduinoShim::advanceMillis(1000);
+    STOMP_CHECK(outbox.expired(record));
+    outbox.pop();
+    outbox.peek(out, record);
+    STOMP_CHECK(!outbox.expired(record));   // no TTL
+}
+
+STOMP_TEST(newEpochExpiresFramesWithTtl) {
+    ArduinoShim::useManualClock();
+    uint32_t block[64] = {};
+    {
+        BlockOutbox before((uint8_t *) block, sizeof(block));
+        before.push(frame(0), 60000);
+        before.push(frame(1), 0);
+    }
+    BlockOutbox after((uint8_t *) block, sizeof(block));
+    STOMP_CHECK(after.size() == 2);
+
+    String out;
+    StompOutboxRecord record;
+    after.peek(out, record);
+    STOMP_CHECK(after.expired(record));     // the clock restarted with the boot, so a TTL cannot be trusted
+    after.pop();
+    after.peek(out, record);
+    STOMP_CHECK(!after.expired(record));
+    STOMP_CHECK(out.equals(frame(1)));
+}
+
+STOMP_TEST(clientQueuesWhileDisconnectedAndReplaysInOrder) {
+    StompTest::TestClient t;
+    StompRamOutbox outbox;
+    t.client.setOutbox(&outbox);
+    t.client.setOutboxReplayInterval(0);
+
+    STOMP_CHECK(t.client.sendMessage("/queue/a", "first"));
+    STOMP_CHECK(t.client.sendMessage("/queue/a", "second"));
+    STOMP_CHECK(outbox.size() == 2);
+
+    t.connect();
+    t.client.sendMessage("/queue/a", "third");  // queued behind the others to keep order
+    for (int i = 0; i < 3; i++) {
+        t.client.loop();
+    }
+    std::vector<String> sent = t.takeSent();
+    STOMP_CHECK(sent.size() == 3);
+    STOMP_CHECK(sent.size() == 3 && sent[0].indexOf("\n\nfirst") != -1 && sent[1].indexOf("\n\nsecond") != -1 &&
+                sent[2].indexOf("\n\nthird") != -1);
+    STOMP_CHECK(outbox.size() == 0);
+}
+
+STOMP_TEST(clientDropsExpiredFramesOnReplay) {
+    StompTest::TestClient t;
+    StompRamOutbox outbox;
+    t.client.setOutbox(&outbox);
+    t.client.setOutboxReplayInterval(0);
+
+    t.client.sendMessage("/queue/a", "stale", 500);
+    t.client.sendMessage("/queue/a", "kept");
+    ArduinoShim::advanceMillis(600);
+    t.connect();
+    t.client.loop();
+    std::vector<String> sent = t.takeSent();
+    STOMP_CHECK(sent.size() == 1 && sent[0].indexOf("kept") != -1);
+}
+
+STOMP_TEST(sendFailsWithoutOutboxWhenDisconnected) {
+    StompTest::TestClient t;
+    STOMP_CHECK(!t.client.sendMessage("/queue/a", "lost"));
+}
+
+STOMP_TEST_MAIN()
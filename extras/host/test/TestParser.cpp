@@ -0,0 +1,70 @@
+/**
+ * StompCommandParser: full parsing and peeking at headers of a raw frame
+ */
+
+#include "StompTest.h"
+
+using namespace Stomp;
+
+STOMP_TEST(parsesCommandHeadersAndBody) {
+    StompCommand frame = StompCommandParser::parse(
+            "MESSAGE\ndestination:/queue/a\nmessage-id:7\ncontent-type:text/plain\n\nhello world");
+    STOMP_CHECK(frame.command.equals("MESSAGE"));
+    STOMP_CHECK(frame.headers.size() == 3);
+    STOMP_CHECK(frame.headers.getValue("destination").equals("/queue/a"));
+    STOMP_CHECK(frame.headers.getValue("message-id").equals("7"));
+    STOMP_CHECK(frame.body.equals("hello world"));
+}
+
+STOMP_TEST(parsesFrameWithoutBody) {
+    StompCommand frame = StompCommandParser::parse("RECEIPT\nreceipt-id:r-1\n\n");
+    STOMP_CHECK(frame.command.equals("RECEIPT"));
+    STOMP_CHECK(frame.headers.getValue("receipt-id").equals("r-1"));
+    STOMP_CHECK(frame.body.length() == 0);
+}
+
+STOMP_TEST(headerValueMayContainColons) {
+    StompCommand frame = StompCommandParser::parse("MESSAGE\ndevice-id:5C:CF:7F:01:02:03\n\n");
+    STOMP_CHECK(frame.headers.getValue("device-id").equals("5C:CF:7F:01:02:03"));
+}
+
+STOMP_TEST(headerCountIsBounded) {
+    String text = "MESSAGE\n";
+    for (int i = 0; i < STOMP_MAX_COMMAND_HEADERS + 4; i++) {
+        text += "h" + String(i) + ":" + String(i) + "\n";
+    }
+    StompCommand frame = StompCommandParser::parse(text + "\nbody");
+    STOMP_CHECK(frame.headers.size() == STOMP_MAX_COMMAND_HEADERS);
+    STOMP_CHECK(frame.body.equals("body"));
+}
+
+STOMP_TEST(peekFindsHeaderWithoutParsing) {
+    String text = "MESSAGE\nsubscription:sub-3\nmessage-id:m-9\n\nbody";
+    unsigned int length = 0;
+    const char *value = StompCommandParser::peekHeader(text, "message-id", &length);
+    STOMP_CHECK(value != nullptr && length == 3 && strncmp(value, "m-9", length) == 0);
+    STOMP_CHECK(StompCommandParser::peekHeader(text, "ack", &length) == nullptr);
+}
+
+STOMP_TEST(peekMatchesWholeHeaderNames) {
+    String text = "MESSAGE\nmessage-id-old:1\nmessage-id:2\n\n";
+    unsigned int length = 0;
+    const char *value = StompCommandParser::peekHeader(text, "message-id", &length);
+    STOMP_CHECK(value != nullptr && length == 1 && *value == '2');
+}
+
+STOMP_TEST(peekStopsAtBody) {
+    String text = "MESSAGE\nsubscription:sub-0\n\nmessage-id:from-the-body";
+    unsigned int length = 0;
+    STOMP_CHECK(StompCommandParser::peekHeader(text, "message-id", &length) == nullptr);
+}
+
+STOMP_TEST(peekStopsAtCrlfBody) {
+    String text = "MESSAGE\r\nsubscription:sub-0\r\n\r\nmessage-id:from-the-body\r\n";
+    unsigned int length = 0;
+    const char *value = StompCommandParser::peekHeader(text, "subscription", &length);
+    STOMP_CHECK(value != nullptr && length == 5 && strncmp(value, "sub-0", length) == 0);
+    STOMP_CHECK(StompCommandParser::peekHeader(text, "message-id", &length) == nullptr);
+}
+
+STOMP_TEST_MAIN()
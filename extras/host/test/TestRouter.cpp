@@ -0,0 +1,151 @@
+/**
+ * StompTopicRouter: wildcard matching, combined decisions and capacity
+ */
+
+#include "StompTest.h"
+#include "StompTopicRouter.h"
+
+using namespace Stomp;
+
+namespace {
+
+    struct Calls {
+        int a = 0;
+        int b = 0;
+        int c = 0;
+        Stomp_Ack_t reply = ACK;
+
+        Stomp_Ack_t handleA(const StompCommand &) {
+            a++;
+            return reply;
+        }
+
+        Stomp_Ack_t handleB(const StompCommand &) {
+            b++;
+            return CONTINUE;
+        }
+
+        Stomp_Ack_t handleC(const StompCommand &) {
+            c++;
+            return NACK;
+        }
+    };
+
+    StompCommand to(const char *destination) {
+        StompCommand message;
+        message.command = "MESSAGE";
+        message.headers.append("destination", destination);
+        return message;
+    }
+
+}
+
+STOMP_TEST(literalPatternsMatchExactly) {
+    Calls calls;
+    StompTopicRouter router;
+    router.add("/topic/a/b", StompMessageHandler(&calls, &Calls::handleA));
+    STOMP_CHECK(router.route(to("/topic/a/b")) == ACK && calls.a == 1);
+    router.route(to("/topic/a"));
+    router.route(to("/topic/a/b/c"));
+    router.route(to("/topic/a/bc"));
+    STOMP_CHECK(calls.a == 1);
+}
+
+STOMP_TEST(starMatchesOneSegment) {
+    Calls calls;
+    StompTopicRouter router('.');
+    router.add("sensors.*.temperature", StompMessageHandler(&calls, &Calls::handleA));
+    router.route(to("sensors.kitchen.temperature"));
+    router.route(to("sensors.temperature"));
+    router.route(to("sensors.a.b.temperature"));
+    STOMP_CHECK(calls.a == 1);
+}
+
+STOMP_TEST(hashMatchesZeroOrMoreSegments) {
+    Calls calls;
+    StompTopicRouter router('.');
+    router.add("sensors.#", StompMessageHandler(&calls, &Calls::handleA));
+    router.add("#.alarm", StompMessageHandler(&calls, &Calls::handleB));
+    router.route(to("sensors"));
+    router.route(to("sensors.kitchen"));
+    router.route(to("sensors.kitchen.alarm"));
+    router.route(to("doors.alarm"));
+    router.route(to("alarm"));
+    STOMP_CHECK(calls.a == 3);
+    STOMP_CHECK(calls.b == 3);
+}
+
+STOMP_TEST(handlerRunsOnceWhenSeveralPathsMatch) {
+    Calls calls;
+    StompTopicRouter router('.');
+    StompMessageHandler handler(&calls, &Calls::handleA);
+    router.add("#.x.#", handler);
+    router.route(to("x.x.x"));
+    STOMP_CHECK(calls.a == 1);
+}
+
+STOMP_TEST(nackWinsOverAckOverContinue) {
+    Calls calls;
+    StompTopicRouter router;
+    router.add("/t/#", StompMessageHandler(&calls, &Calls::handleB));
+    STOMP_CHECK(router.route(to("/t/x")) == CONTINUE);
+    router.add("/t/x", StompMessageHandler(&calls, &Calls::handleA));
+    STOMP_CHECK(router.route(to("/t/x")) == ACK);
+    router.add("/t/*", StompMessageHandler(&calls, &Calls::handleC));
+    STOMP_CHECK(router.route(to("/t/x")) == NACK);
+}
+
+STOMP_TEST(unmatchedDecisionIsConfigurable) {
+    StompTopicRouter router;
+    STOMP_CHECK(router.route(to("/nothing")) == ACK);
+    router.setUnmatched(NACK);
+    STOMP_CHECK(router.route(to("/nothing")) == NACK);
+    StompCommand noDestination;
+    STOMP_CHECK(router.route(noDestination) == NACK);
+}
+
+STOMP_TEST(addFailsWhenFull) {
+    Calls calls;
+    StompTopicRouter router;
+    int added = 0;
+    while (router.add("/r/" + String(added), StompMessageHandler(&calls, &Calls::handleA))) {
+        added++;
+    }
+    // the root, "" and "r" take three nodes, each route one more
+    STOMP_CHECK(added == STOMP_ROUTER_MAX_NODES - 3);
+    // existing nodes still take new routes
+    STOMP_CHECK(router.add("/r/0", StompMessageHandler(&calls, &Calls::handleB)));
+}
+
+STOMP_TEST(failedAddReleasesItsNodes) {
+    Calls calls;
+    StompTopicRouter router;
+    for (int i = 0; i < STOMP_ROUTER_MAX_NODES - 4; i++) {
+        router.add("/r/" + String(i), StompMessageHandler(&calls, &Calls::handleA));
+    }
+    // one node is left: a pattern needing two fails, and must not keep the first
+    STOMP_CHECK(!router.add("/r/a/b", StompMessageHandler(&calls, &Calls::handleB)));
+    STOMP_CHECK(router.add("/r/c", StompMessageHandler(&calls, &Calls::handleB)));
+    router.route(to("/r/a"));
+    router.route(to("/r/a/b"));
+    STOMP_CHECK(calls.b == 0);
+    router.route(to("/r/c"));
+    router.route(to("/r/0"));
+    STOMP_CHECK(calls.b == 1 && calls.a == 1);
+}
+
+STOMP_TEST(routesThroughClientSubscription) {
+    StompTest::TestClient t;
+    Calls calls;
+    StompTopicRouter router;
+    router.add("/queue/test", StompMessageHandler(&calls, &Calls::handleA));
+    t.connect();
+    int id = t.client.subscribe("/queue/#", CLIENT_INDIVIDUAL, router);
+    t.takeSent();
+    t.receive(StompTest::TestClient::message(id, "m-1", "x"));
+    STOMP_CHECK(calls.a == 1);
+    std::vector<String> sent = t.sentCommands();
+    STOMP_CHECK(sent.size() == 1 && sent[0].equals("ACK"));
+}
+
+STOMP_TEST_MAIN()
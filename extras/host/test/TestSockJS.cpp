@@ -0,0 +1,161 @@
+/**
+ * SockJS framing: StompSockJS::encode/decode, and the client's side of the session (o, h, a[...], c[...])
+ */
+
+#include "StompTest.h"
+
+using namespace Stomp;
+
+namespace {
+
+    std::vector<String> decode(const String &payload, bool *ok = nullptr) {
+        std::vector<String> messages;
+        bool decoded = StompSockJS::decode(payload.c_str(), payload.length(), [&messages](String &message) {
+            messages.push_back(message);
+        });
+        if (ok) {
+            *ok = decoded;
+        }
+        return messages;
+    }
+
+    /**
+     * A frame as one JSON string of an 'a' frame, with its terminator
+     */
+    String quoted(const String &frame) {
+        String encoded = StompSockJS::encode(frame.c_str(), frame.length() + 1);
+        return encoded.substring(1, encoded.length() - 1);
+    }
+
+}
+
+STOMP_TEST(encodeEscapesForJson) {
+    const char frame[] = "SEND\ndestination:/q\n\n\"quoted\" \\ tab\t\r";
+    STOMP_CHECK(StompSockJS::encode(frame, strlen(frame)).equals(
+            "[\"SEND\\ndestination:/q\\n\\n\\\"quoted\\\" \\\\ tab\\t\\r\"]"));
+    // the NULL terminator and other control characters become \u escapes
+    STOMP_CHECK(StompSockJS::encode("A\x01", 3).equals("[\"A\\u0001\\u0000\"]"));
+}
+
+STOMP_TEST(roundTripsEveryByte) {
+    String frame = "MESSAGE\ndestination:/q\n\n";
+    for (int c = 1; c < 256; c++) {
+        frame.concat((char) c);
+    }
+    // with its terminator, as the client sends it; decode() removes the terminator
+    String encoded = StompSockJS::encode(frame.c_str(), frame.length() + 1);
+    bool ok;
+    std::vector<String> messages = decode("a" + encoded, &ok);
+    STOMP_CHECK(ok);
+    STOMP_CHECK(messages.size() == 1 && messages[0].equals(frame));
+    // a client's frame, without the 'a'
+    messages = decode(encoded, &ok);
+    STOMP_CHECK(ok && messages.size() == 1 && messages[0].equals(frame));
+}
+
+STOMP_TEST(decodesSeveralMessages) {
+    bool ok;
+    std::vector<String> messages = decode("a[\"one\\u0000\", \"two\" ,\"\\u00e9\\/\"]", &ok);
+    STOMP_CHECK(ok);
+    STOMP_CHECK(messages.size() == 3);
+    STOMP_CHECK(messages.size() == 3 && messages[0].equals("one") && messages[1].equals("two") &&
+                messages[2].equals("\xC3\xA9/"));
+    STOMP_CHECK(decode("a[]", &ok).empty() && ok);
+}
+
+STOMP_TEST(rejectsMalformedFrames) {
+    const char *bad[] = {
+            "",
+            "a",
+            "a\"x\"",
+            "a[\"open",
+            "a[\"x\"",
+            "a[\"x\" \"y\"]",
+            "a[1]",
+            "a[\"\\u00g0\"]",
+            "a[\"\\u00\"]",
+            "a[\"x\\",
+    };
+    for (const char *payload: bad) {
+        bool ok = true;
+        decode(payload, &ok);
+        if (!STOMP_CHECK(!ok)) {
+            fprintf(stderr, "    accepted: %s\n", payload);
+        }
+    }
+    // messages before the error are still handed over
+    bool ok;
+    std::vector<String> messages = decode("a[\"first\",2]", &ok);
+    STOMP_CHECK(!ok && messages.size() == 1);
+}
+
+STOMP_TEST(clientConnectsAfterTheOpenFrame) {
+    StompTest::TestClient t(true);
+    t.client.begin();
+    t.client.loop();
+    STOMP_CHECK(t.webSocket.sent().empty());   // the socket is open but the SockJS session is not
+    STOMP_CHECK(t.client.state() == CONNECTING);
+
+    t.receive("o");
+    STOMP_CHECK(t.client.state() == OPENING);
+    std::vector<String> sent = t.takeSent();
+    STOMP_CHECK(sent.size() == 1);
+    std::vector<String> frames = sent.empty() ? std::vector<String>() : decode(sent[0]);
+    STOMP_CHECK(frames.size() == 1 && StompTest::command(frames[0]).equals("CONNECT"));
+
+    t.receive("a[" + quoted("CONNECTED\nversion:1.2\n\n") + "]");
+    STOMP_CHECK(t.client.state() == CONNECTED);
+}
+
+STOMP_TEST(clientUnwrapsAndWrapsFrames) {
+    struct Received {
+        std::vector<String> bodies;
+
+        Stomp_Ack_t handle(const StompCommand &message) {
+            bodies.push_back(message.body);
+            return ACK;
+        }
+    } received;
+
+    StompTest::TestClient t(true);
+    t.client.begin();
+    t.client.loop();
+    t.receive("o");
+    t.receive("a[" + quoted("CONNECTED\nversion:1.2\n\n") + "]");
+    int id = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL, StompMessageHandler(&received, &Received::handle));
+    t.takeSent();
+
+    // two MESSAGEs in one 'a' frame, each with its terminator
+    String first = quoted(StompTest::TestClient::message(id, "m-1", "one"));
+    String second = quoted(StompTest::TestClient::message(id, "m-2", "two\nlines"));
+    t.receive("a[" + first + "," + second + "]");
+    STOMP_CHECK(received.bodies.size() == 2);
+    STOMP_CHECK(received.bodies.size() == 2 && received.bodies[1].equals("two\nlines"));
+
+    // each ACK goes out as a JSON array of one string
+    std::vector<String> acks;
+    for (const String &payload: t.takeSent()) {
+        std::vector<String> frames = decode(payload);
+        STOMP_CHECK(frames.size() == 1);
+        for (const String &frame: frames) {
+            acks.push_back(StompTest::command(frame) + " " + StompTest::header(frame, "id"));
+        }
+    }
+    STOMP_CHECK(acks.size() == 2 && acks[0].equals("ACK m-1") && acks[1].equals("ACK m-2"));
+}
+
+STOMP_TEST(clientCountsSockJSHeartbeats) {
+    StompTest::TestClient t(true);
+    t.client.begin();
+    t.client.loop();
+    t.receive("o");
+    t.receive("a[" + quoted("CONNECTED\nversion:1.2\n\n") + "]");
+    uint32_t before = t.client.metrics().heartbeatsIn;
+    t.receive("h");
+    t.receive("h");
+    STOMP_CHECK(t.client.metrics().heartbeatsIn == before + 2);
+    t.receive("c[3000,\"Go away!\"]");
+    STOMP_CHECK(t.client.state() == CONNECTED);   // the socket close that follows is what counts
+}
+
+STOMP_TEST_MAIN()
@@ -0,0 +1,156 @@
+/**
+ * The connection state machine: transitions, state timeouts, heart-beat negotiation and loss
+ */
+
+#include "StompTest.h"
+
+using namespace Stomp;
+
+namespace {
+
+    struct Transitions {
+        int count = 0;
+        Stomp_State_t from = DISCONNECTED;
+        Stomp_State_t to = DISCONNECTED;
+
+        void changed(Stomp_State_t previous, Stomp_State_t next, Stomp_Event_t) {
+            count++;
+            from = previous;
+            to = next;
+        }
+    };
+
+}
+
+STOMP_TEST(connectsThroughOpening) {
+    StompTest::TestClient t;
+    STOMP_CHECK(t.client.state() == DISCONNECTED);
+    t.client.begin();
+    STOMP_CHECK(t.client.state() == CONNECTING);
+    t.client.loop();
+    STOMP_CHECK(t.client.state() == OPENING);
+    std::vector<String> sent = t.sentCommands();
+    STOMP_CHECK(sent.size() == 1 && sent[0].equals("CONNECT"));
+    t.receive("CONNECTED\nversion:1.2\n\n");
+    STOMP_CHECK(t.client.state() == CONNECTED);
+    STOMP_CHECK(t.client.stateEntries(CONNECTED) == 1);
+}
+
+STOMP_TEST(connectingTimesOutAndRetries) {
+    StompTest::TestClient t;
+    t.webSocket.setAutoOpen(false);
+    t.client.setStateTimeout(CONNECTING, 1000);
+    t.client.begin();
+    ArduinoShim::advanceMillis(999);
+    t.client.loop();
+    STOMP_CHECK(t.client.stateEntries(CONNECTING) == 1);
+    ArduinoShim::advanceMillis(1);
+    t.client.loop();
+    STOMP_CHECK(t.client.state() == CONNECTING);
+    STOMP_CHECK(t.client.stateEntries(CONNECTING) == 2);
+}
+
+STOMP_TEST(openingTimesOutWithoutConnected) {
+    StompTest::TestClient t;
+    t.client.setStateTimeout(OPENING, 2000);
+    t.client.begin();
+    t.client.loop();
+    STOMP_CHECK(t.client.state() == OPENING);
+    ArduinoShim::advanceMillis(2000);
+    t.client.loop();
+    STOMP_CHECK(t.client.state() == CONNECTING);
+    STOMP_CHECK(!t.webSocket.isConnected());
+}
+
+STOMP_TEST(errorWhileOpeningDisconnects) {
+    StompTest::TestClient t;
+    t.client.begin();
+    t.client.loop();
+    t.receive("ERROR\nmessage:bad credentials\n\n");
+    STOMP_CHECK(t.client.state() == DISCONNECTED);
+}
+
+STOMP_TEST(disconnectCompletesOnReceipt) {
+    StompTest::TestClient t;
+    Transitions transitions;
+    t.client.onStateChange(StompTransitionHandler(&transitions, &Transitions::changed));
+    t.connect();
+    t.takeSent();
+
+    t.client.disconnect();
+    STOMP_CHECK(t.client.state() == DISCONNECTING);
+    std::vector<String> sent = t.takeSent();
+    STOMP_CHECK(sent.size() == 1 && StompTest::command(sent[0]).equals("DISCONNECT"));
+    String receipt = sent.empty() ? String() : StompTest::header(sent[0], "receipt");
+
+    int before = transitions.count;
+    t.receive("RECEIPT\nreceipt-id:" + receipt + "\n\n");
+    t.client.loop();   // delivers the socket close that follows
+    STOMP_CHECK(t.client.state() == DISCONNECTED);
+    STOMP_CHECK(transitions.count == before + 1);
+    STOMP_CHECK(transitions.from == DISCONNECTING && transitions.to == DISCONNECTED);
+    STOMP_CHECK(t.client.stateEntries(DISCONNECTED) == 2);  // the initial state and this one
+    STOMP_CHECK(!t.webSocket.isConnected());
+}
+
+STOMP_TEST(disconnectingTimesOutWithoutReceipt) {
+    StompTest::TestClient t;
+    t.connect();
+    t.client.setStateTimeout(DISCONNECTING, 500);
+    t.client.disconnect();
+    ArduinoShim::advanceMillis(500);
+    t.client.loop();
+    STOMP_CHECK(t.client.state() == DISCONNECTED);
+    STOMP_CHECK(!t.webSocket.isConnected());
+}
+
+STOMP_TEST(socketLossReconnects) {
+    StompTest::TestClient t;
+    t.connect();
+    t.webSocket.drop();
+    t.client.loop();
+    STOMP_CHECK(t.client.state() == CONNECTING);
+    ArduinoShim::advanceMillis(500);
+    t.client.loop();   // the socket reopens
+    t.client.loop();
+    STOMP_CHECK(t.client.state() == OPENING);
+}
+
+STOMP_TEST(heartbeatsAreNegotiated) {
+    StompTest::TestClient t;
+    t.client.setHeartbeat(1000, 3000);
+    t.connect("5000,2000");
+    // we send every max(cx, sy), and expect data every max(cy, sx)
+    STOMP_CHECK(t.client.outgoingHeartbeat() == 2000);
+    STOMP_CHECK(t.client.incomingHeartbeat() == 5000);
+
+    t.takeSent();
+    ArduinoShim::advanceMillis(2000);
+    t.client.loop();
+    std::vector<String> sent = t.takeSent();
+    STOMP_CHECK(sent.size() == 1 && sent[0].equals("\n"));
+}
+
+STOMP_TEST(heartbeatOffWhenEitherSideDeclines) {
+    StompTest::TestClient t;
+    t.client.setHeartbeat(0, 3000);
+    t.connect("0,2000");
+    STOMP_CHECK(t.client.outgoingHeartbeat() == 0);
+    STOMP_CHECK(t.client.incomingHeartbeat() == 0);
+}
+
+STOMP_TEST(silentBrokerIsDropped) {
+    StompTest::TestClient t;
+    t.client.setHeartbeat(0, 1000);
+    t.connect("1000,0");
+    ArduinoShim::advanceMillis(1000 * STOMP_HEARTBEAT_TOLERANCE);
+    t.client.loop();
+    STOMP_CHECK(t.client.state() == CONNECTED);
+    ArduinoShim::advanceMillis(1);
+    t.client.loop();
+    STOMP_CHECK(t.client.heartbeatMisses() == 1);
+    STOMP_CHECK(t.client.state() == CONNECTING);
+    STOMP_CHECK(!t.webSocket.isConnected());
+}
+
+STOMP_TEST_MAIN()
@@ -0,0 +1,377 @@
+/**
+ * Per-subscription features: de-duplication, retry with dead-lettering, and batches with their acknowledgements
+ */
+
+#include "StompTest.h"
+
+using namespace Stomp;
+
+namespace {
+
+    typedef StompTest::TestClient TestClient;
+
+    struct Handler {
+        int calls = 0;
+        Stomp_Ack_t reply = ACK;
+        int deadLetters = 0;
+        uint8_t deadAttempts = 0;
+
+        Stomp_Ack_t handle(const StompCommand &) {
+            calls++;
+            return reply;
+        }
+
+        void deadLetter(const StompCommand &, uint8_t attempts) {
+            deadLetters++;
+            deadAttempts = attempts;
+        }
+    };
+
+    struct Batches {
+        int calls = 0;
+        uint8_t lastCount = 0;
+        uint32_t nackMask = 0;
+        Stomp_Ack_t reply = ACK;
+
+        Stomp_Ack_t handle(StompBatch &batch) {
+            calls++;
+            lastCount = batch.count;
+            for (uint8_t i = 0; i < batch.count; i++) {
+                if ((nackMask >> i) & 1) {
+                    batch.nack(i);
+                }
+            }
+            return reply;
+        }
+    };
+
+    /**
+     * "ACK m-1" for each frame sent
+     */
+    std::vector<String> acks(TestClient &t) {
+        std::vector<String> out;
+        for (const String &frame: t.takeSent()) {
+            out.push_back(StompTest::command(frame) + " " + StompTest::header(frame, "id"));
+        }
+        return out;
+    }
+
+    bool sentExactly(TestClient &t, std::vector<String> expected) {
+        std::vector<String> actual = acks(t);
+        bool same = actual.size() == expected.size();
+        for (size_t i = 0; same && i < actual.size(); i++) {
+            same = actual[i].equals(expected[i]);
+        }
+        if (!same) {
+            for (const String &frame: actual) fprintf(stderr, "    sent: %s\n", frame.c_str());
+        }
+        return same;
+    }
+
+}
+
+STOMP_TEST(duplicatesAreAcknowledgedButNotHandled) {
+    TestClient t;
+    Handler handler;
+    StompDedupWindow window;
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL, StompMessageHandler(&handler, &Handler::handle));
+    t.client.setDeduplication(id, &window);
+    t.takeSent();
+
+    t.receive(TestClient::message(id, "m-1", "a"));
+    t.receive(TestClient::message(id, "m-1", "a"));
+    t.receive(TestClient::message(id, "m-2", "b"));
+    STOMP_CHECK(handler.calls == 2);
+    STOMP_CHECK(window.duplicates() == 1);
+    STOMP_CHECK(sentExactly(t, {"ACK m-1", "ACK m-1", "ACK m-2"}));
+}
+
+STOMP_TEST(clientModeDoesNotAcknowledgeDuplicates) {
+    TestClient t;
+    Handler handler;
+    handler.reply = CONTINUE;
+    StompDedupWindow window;
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT, StompMessageHandler(&handler, &Handler::handle));
+    t.client.setDeduplication(id, &window);
+    t.takeSent();
+
+    // m-2 is still held by the sketch: an ACK of the duplicate m-1 would settle it
+    t.receive(TestClient::message(id, "m-1", "a"));
+    t.receive(TestClient::message(id, "m-2", "b"));
+    t.receive(TestClient::message(id, "m-1", "a"));
+    STOMP_CHECK(handler.calls == 2);
+    STOMP_CHECK(window.duplicates() == 1);
+    STOMP_CHECK(t.takeSent().empty());
+}
+
+STOMP_TEST(nackedMessagesAreNotRemembered) {
+    TestClient t;
+    Handler handler;
+    handler.reply = NACK;
+    StompDedupWindow window;
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL, StompMessageHandler(&handler, &Handler::handle));
+    t.client.setDeduplication(id, &window);
+
+    t.receive(TestClient::message(id, "m-1", "a"));
+    t.receive(TestClient::message(id, "m-1", "a"));
+    STOMP_CHECK(handler.calls == 2);
+    STOMP_CHECK(window.duplicates() == 0);
+}
+
+STOMP_TEST(dedupWindowForgetsTheOldest) {
+    StompDedupWindow window;
+    for (int i = 0; i <= STOMP_DEDUP_WINDOW; i++) {
+        window.record(StompDedupWindow::hash("m-" + String(i)));
+    }
+    STOMP_CHECK(!window.contains(StompDedupWindow::hash("m-0")));
+    STOMP_CHECK(window.contains(StompDedupWindow::hash("m-1")));
+    STOMP_CHECK(window.contains(StompDedupWindow::hash("m-" + String(STOMP_DEDUP_WINDOW))));
+}
+
+STOMP_TEST(retryDelaysGrowAndAreCapped) {
+    StompRetryPolicy policy = {100, 500, 5, StompDeadLetterHandler(), nullptr};
+    STOMP_CHECK(StompRetryAttempts::delay(policy, 1) == 100);
+    STOMP_CHECK(StompRetryAttempts::delay(policy, 2) == 200);
+    STOMP_CHECK(StompRetryAttempts::delay(policy, 3) == 400);
+    STOMP_CHECK(StompRetryAttempts::delay(policy, 4) == 500);
+    STOMP_CHECK(StompRetryAttempts::delay(policy, 200) == 500);
+}
+
+STOMP_TEST(nackIsDeferredByTheRetryPolicy) {
+    TestClient t;
+    Handler handler;
+    handler.reply = NACK;
+    StompRetryPolicy policy = {100, 1000, 3, StompDeadLetterHandler(&handler, &Handler::deadLetter), nullptr};
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL, StompMessageHandler(&handler, &Handler::handle));
+    t.client.setRetryPolicy(id, &policy);
+    t.takeSent();
+
+    t.receive(TestClient::message(id, "m-1", "a"));
+    STOMP_CHECK(t.takeSent().empty());
+    ArduinoShim::advanceMillis(99);
+    t.client.loop();
+    STOMP_CHECK(t.takeSent().empty());
+    ArduinoShim::advanceMillis(1);
+    t.client.loop();
+    STOMP_CHECK(sentExactly(t, {"NACK m-1"}));
+
+    // the second attempt waits twice as long
+    t.receive(TestClient::message(id, "m-1", "a"));
+    ArduinoShim::advanceMillis(199);
+    t.client.loop();
+    STOMP_CHECK(t.takeSent().empty());
+    ArduinoShim::advanceMillis(1);
+    t.client.loop();
+    STOMP_CHECK(sentExactly(t, {"NACK m-1"}));
+}
+
+STOMP_TEST(exhaustedMessagesAreDeadLettered) {
+    TestClient t;
+    Handler handler;
+    handler.reply = NACK;
+    StompRetryPolicy policy = {10, 10, 3, StompDeadLetterHandler(&handler, &Handler::deadLetter), nullptr};
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL, StompMessageHandler(&handler, &Handler::handle));
+    t.client.setRetryPolicy(id, &policy);
+    t.takeSent();
+
+    for (int attempt = 1; attempt < 3; attempt++) {
+        t.receive(TestClient::message(id, "m-1", "a"));
+        ArduinoShim::advanceMillis(10);
+        t.client.loop();
+        STOMP_CHECK(sentExactly(t, {"NACK m-1"}));
+    }
+    STOMP_CHECK(handler.deadLetters == 0);
+
+    t.receive(TestClient::message(id, "m-1", "a"));
+    STOMP_CHECK(handler.deadLetters == 1 && handler.deadAttempts == 3);
+    STOMP_CHECK(sentExactly(t, {"ACK m-1"}));
+}
+
+STOMP_TEST(retryNeedsClientIndividualMode) {
+    TestClient t;
+    Handler handler;
+    handler.reply = NACK;
+    StompRetryPolicy policy = {1000, 1000, 3, StompDeadLetterHandler(), nullptr};
+    t.connect();
+    int client = t.client.subscribe("/queue/a", CLIENT, StompMessageHandler(&handler, &Handler::handle));
+    int individual = t.client.subscribe("/queue/b", CLIENT_INDIVIDUAL, StompMessageHandler(&handler, &Handler::handle));
+    STOMP_CHECK(!t.client.setRetryPolicy(client, &policy));
+    STOMP_CHECK(t.client.setRetryPolicy(individual, &policy));
+    STOMP_CHECK(t.client.setRetryPolicy(client, nullptr));
+    STOMP_CHECK(!t.client.setRetryPolicy(99, &policy));
+    t.takeSent();
+
+    // the CLIENT subscription NACKs at once, before any later ACK can settle the message
+    t.receive(TestClient::message(client, "m-1", "a"));
+    STOMP_CHECK(sentExactly(t, {"NACK m-1"}));
+}
+
+STOMP_TEST(successSettlesTheAttempts) {
+    TestClient t;
+    Handler handler;
+    handler.reply = NACK;
+    StompRetryPolicy policy = {10, 10, 2, StompDeadLetterHandler(&handler, &Handler::deadLetter), nullptr};
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL, StompMessageHandler(&handler, &Handler::handle));
+    t.client.setRetryPolicy(id, &policy);
+
+    t.receive(TestClient::message(id, "m-1", "a"));
+    handler.reply = ACK;
+    t.receive(TestClient::message(id, "m-1", "a"));
+    handler.reply = NACK;
+    t.receive(TestClient::message(id, "m-1", "a"));  // counts from one again
+    STOMP_CHECK(handler.deadLetters == 0);
+}
+
+STOMP_TEST(keyHeaderCountsRedeliveriesWithNewMessageIds) {
+    TestClient t;
+    Handler handler;
+    handler.reply = NACK;
+    StompRetryPolicy policy = {10, 10, 3, StompDeadLetterHandler(&handler, &Handler::deadLetter), "job-id"};
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL, StompMessageHandler(&handler, &Handler::handle));
+    t.client.setRetryPolicy(id, &policy);
+    t.takeSent();
+
+    // as RabbitMQ does, each redelivery has a new message-id
+    for (int attempt = 1; attempt < 3; attempt++) {
+        t.receive(TestClient::message(id, "m-" + String(attempt), "a", "job-id:7\nredelivered:true\n"));
+        ArduinoShim::advanceMillis(10);
+        t.client.loop();
+        STOMP_CHECK(sentExactly(t, {"NACK m-" + String(attempt)}));
+    }
+    t.receive(TestClient::message(id, "m-3", "a", "job-id:7\nredelivered:true\n"));
+    STOMP_CHECK(handler.deadLetters == 1 && handler.deadAttempts == 3);
+    STOMP_CHECK(sentExactly(t, {"ACK m-3"}));
+
+    // without the key header, the message-id is used
+    t.receive(TestClient::message(id, "m-4", "b"));
+    t.receive(TestClient::message(id, "m-5", "b"));
+    STOMP_CHECK(handler.deadLetters == 1);
+}
+
+STOMP_TEST(deferredNackIsDroppedAfterReconnect) {
+    TestClient t;
+    Handler handler;
+    handler.reply = NACK;
+    StompRetryPolicy policy = {1000, 1000, 5, StompDeadLetterHandler(), nullptr};
+    t.connect();
+    int id = t.client.subscribe("/queue/test", CLIENT_INDIVIDUAL, StompMessageHandler(&handler, &Handler::handle));
+    t.client.setRetryPolicy(id, &policy);
+    t.receive(TestClient::message(id, "m-1", "a"));
+
+    t.webSocket.drop();
+    t.client.loop();
+    ArduinoShim::advanceMillis(500);
+    t.client.loop();
+    t.client.loop();
+    t.receive("CONNECTED\nversion:1.2\n\n");
+    STOMP_CHECK(t.client.state() == CONNECTED);
+    t.takeSent();
+
+    ArduinoShim::advanceMillis(500);
+    t.client.loop();
+    STOMP_CHECK(t.takeSent().empty());   // the broker redelivers m-1 to the new session anyway
+}
+
+STOMP_TEST(batchIndividualAcksEachMessage) {
+    TestClient t;
+    Batches batches;
+    batches.nackMask = 0b010;
+    StompBatchBuffer buffer(4);
+    t.connect();
+    int id = t.client.subscribeBatch("/queue/test", CLIENT_INDIVIDUAL, buffer,
+                                     StompBatchHandler(&batches, &Batches::handle));
+    t.takeSent();
+
+    t.webSocket.queueText(TestClient::message(id, "m-1", "a"));
+    t.webSocket.queueText(TestClient::message(id, "m-2", "b"));
+    t.webSocket.queueText(TestClient::message(id, "m-3", "c"));
+    t.client.loop();
+    STOMP_CHECK(batches.calls == 1 && batches.lastCount == 3);
+    STOMP_CHECK(sentExactly(t, {"ACK m-1", "NACK m-2", "ACK m-3"}));
+}
+
+STOMP_TEST(batchFlushesWhenFull) {
+    TestClient t;
+    Batches batches;
+    StompBatchBuffer buffer(2);
+    t.connect();
+    int id = t.client.subscribeBatch("/queue/test", CLIENT_INDIVIDUAL, buffer,
+                                     StompBatchHandler(&batches, &Batches::handle));
+
+    for (int i = 0; i < 5; i++) {
+        t.webSocket.queueText(TestClient::message(id, "m-" + String(i), "x"));
+    }
+    t.client.loop();
+    STOMP_CHECK(batches.calls == 3);
+    STOMP_CHECK(batches.lastCount == 1);   // the remainder, flushed at the end of loop()
+}
+
+STOMP_TEST(batchClientAckIsCumulative) {
+    TestClient t;
+    Batches batches;
+    StompBatchBuffer buffer(8);
+    t.connect();
+    int id = t.client.subscribeBatch("/queue/test", CLIENT, buffer, StompBatchHandler(&batches, &Batches::handle));
+    t.takeSent();
+
+    for (int i = 1; i <= 4; i++) {
+        t.webSocket.queueText(TestClient::message(id, "m-" + String(i), "x"));
+    }
+    t.client.loop();
+    STOMP_CHECK(sentExactly(t, {"ACK m-4"}));
+}
+
+STOMP_TEST(batchClientAckStopsBeforeEachNack) {
+    TestClient t;
+    Batches batches;
+    batches.nackMask = 0b00110;
+    StompBatchBuffer buffer(8);
+    t.connect();
+    int id = t.client.subscribeBatch("/queue/test", CLIENT, buffer, StompBatchHandler(&batches, &Batches::handle));
+    t.takeSent();
+
+    for (int i = 1; i <= 5; i++) {
+        t.webSocket.queueText(TestClient::message(id, "m-" + String(i), "x"));
+    }
+    t.client.loop();
+    STOMP_CHECK(sentExactly(t, {"ACK m-1", "NACK m-2", "NACK m-3", "ACK m-5"}));
+}
+
+STOMP_TEST(batchNackRejectsEveryMessage) {
+    TestClient t;
+    Batches batches;
+    batches.reply = NACK;
+    StompBatchBuffer buffer(8);
+    t.connect();
+    int id = t.client.subscribeBatch("/queue/test", CLIENT, buffer, StompBatchHandler(&batches, &Batches::handle));
+    t.takeSent();
+
+    t.webSocket.queueText(TestClient::message(id, "m-1", "x"));
+    t.webSocket.queueText(TestClient::message(id, "m-2", "x"));
+    t.client.loop();
+    STOMP_CHECK(sentExactly(t, {"NACK m-1", "NACK m-2"}));
+}
+
+STOMP_TEST(batchContinueLeavesMessagesUnacknowledged) {
+    TestClient t;
+    Batches batches;
+    batches.reply = CONTINUE;
+    StompBatchBuffer buffer(8);
+    t.connect();
+    int id = t.client.subscribeBatch("/queue/test", CLIENT, buffer, StompBatchHandler(&batches, &Batches::handle));
+    t.takeSent();
+
+    t.webSocket.queueText(TestClient::message(id, "m-1", "x"));
+    t.client.loop();
+    STOMP_CHECK(batches.calls == 1);
+    STOMP_CHECK(t.takeSent().empty());
+}
+
+STOMP_TEST_MAIN()
@@ -3,6 +3,8 @@
 #ifndef STOMP_H
 #define STOMP_H
 
+#include "StompDelegate.h"
+
 #ifndef STOMP_MAX_COMMAND_HEADERS
 #define STOMP_MAX_COMMAND_HEADERS 16
 #endif
@@ -36,10 +38,11 @@ namespace Stomp {
  * The current state of the STOMP connection
  */
     typedef enum {
-        OPENING,
+        OPENING,        // socket open, CONNECT sent, waiting for CONNECTED
         CONNECTED,
-        DISCONNECTING,
-        DISCONNECTED
+        DISCONNECTING,  // DISCONNECT sent, waiting for its receipt
+        DISCONNECTED,
+        CONNECTING      // waiting for the socket to open (or re-open)
     } Stomp_State_t;
 
     typedef struct {
@@ -59,32 +62,46 @@ namespace Stomp {
             StompHeader h;
             h.key = std::move(key);
             h.value = std::move(value);
-            append(h);
+            append(std::move(h));
         }
 
         /**
          * Append a new header. Silently drop the header if STOMP_MAX_COMMAND_HEADERS is exceeded
          */
         void append(StompHeader h) {
+            if (size() >= STOMP_MAX_COMMAND_HEADERS) return;
             _idx++;
-            if (_idx + 1 >= STOMP_MAX_COMMAND_HEADERS) return;
-            _headers[_idx] = h;
+            _headers[_idx] = std::move(h);
         }
 
-        uint8_t size() {
+        uint8_t size() const {
             return _idx + 1;
         }
 
-        StompHeader get(uint8_t idx) {
+        StompHeader get(uint8_t idx) const {
             return _headers[idx];
         }
 
+        /**
+         * Return the value of the header with the given key, or nullptr if there is none. Does not allocate
+         */
+        const String *find(const char *key) const {
+
+            for (uint8_t i = 0; i < size(); i++) {
+                if (_headers[i].key.equals(key)) {
+                    return &_headers[i].value;
+                }
+            }
+
+            return nullptr;
+        }
+
         /**
          * Return the value of the header with the given key
          */
-        String getValue(const String &key) {
+        String getValue(const String &key) const {
 
-            for (uint8_t i = 0; i < _idx; i++) {
+            for (uint8_t i = 0; i < size(); i++) {
                 if (_headers[i].key.equals(key)) {
                     return _headers[i].value;
                 }
@@ -107,19 +124,118 @@ namespace Stomp {
     } StompCommand;
 
 /**
- * Signature of functions which handle incoming MESSAGEs
+ * Handler for incoming MESSAGEs. Accepts a function such as
+ *     Stomp_Ack_t handle(const StompCommand &message)
+ * (or one taking the command by value), a bound member function, or a small capturing lambda.
  */
-    typedef Stomp_Ack_t (*StompMessageHandler)(const StompCommand message);
+    typedef StompDelegate<Stomp_Ack_t(const StompCommand &)> StompMessageHandler;
 
 /**
- * Signature of functions which handle other types of incoming command
+ * Handler for other types of incoming command
  */
-    typedef void (*StompStateHandler)(const StompCommand message);
+    typedef StompDelegate<void(const StompCommand &)> StompStateHandler;
+
+    class StompTopicRouter;
+
+    class StompDedupWindow;
+
+    class StompHeaderFilter;
+
+    struct StompRetryPolicy;
+
+    class StompBatchBuffer;
+
+/**
+ * In CLIENT mode an ACK is cumulative, so the messages the client drops itself (rejected by a filter, or duplicates)
+ * are acknowledged together, by one ACK of the newest, once no earlier message is still held by a handler's CONTINUE or
+ * a batch. Messages are numbered as they arrive to tell which ACKs cover which.
+ */
+    struct StompCumulativeAck {
+        uint32_t received = 0;    // messages seen on the subscription
+        String dropped;           // ack id of the newest dropped message not yet covered by an ACK
+        uint32_t droppedSeq = 0;
+        String held;              // ack id of the newest message a handler kept with CONTINUE
+        uint32_t heldSeq = 0;
+        uint32_t batchSeq = 0;    // number of the newest message added to the batch
+
+        uint32_t next() {
+            return ++received;
+        }
+
+        void drop(const char *ackId, unsigned int length, uint32_t seq) {
+            dropped = String();
+            dropped.concat(ackId, length);
+            droppedSeq = seq;
+        }
+
+        void hold(const String &ackId, uint32_t seq) {
+            held = ackId;
+            heldSeq = seq;
+        }
+
+        /**
+         * An ACK or NACK of message seq has been sent: it settled everything up to it
+         */
+        void settled(uint32_t seq) {
+            if (dropped.length() > 0 && droppedSeq <= seq) {
+                dropped = String();
+            }
+            if (held.length() > 0 && heldSeq <= seq) {
+                held = String();
+            }
+        }
+
+        /**
+         * The sketch acknowledged a message itself; if it was the newest one held, nothing earlier is held any more
+         */
+        void settled(const String &ackId) {
+            if (held.length() > 0 && held.equals(ackId)) {
+                settled(heldSeq);
+            }
+        }
+
+        /**
+         * Whether dropped messages can be acknowledged now, given how many messages a batch still holds
+         */
+        bool ready(uint8_t batched) const {
+            return dropped.length() > 0 && held.length() == 0 && batched == 0;
+        }
+
+        /**
+         * Forget everything: ack ids are only valid in the session which received them
+         */
+        void reset() {
+            *this = StompCumulativeAck();
+        }
+    };
 
     typedef struct {
         long id;
         StompMessageHandler messageHandler;
+        StompTopicRouter *router;
+        StompDedupWindow *dedup;
+        StompHeaderFilter *filter;
+        const StompRetryPolicy *retry;
+        StompBatchBuffer *batch;
+        Stomp_AckMode_t ackMode;
+        uint8_t priority;
+        StompCumulativeAck cumulative;  // CLIENT mode only
+        long nextFree;  // next free id while this slot is unused
     } StompSubscription;
+
+/**
+ * A broker endpoint
+ */
+    typedef struct {
+        const char *host;
+        int port;
+        const char *url;
+    } StompBroker;
+
+/**
+ * Notified with the broker's index when a connection to a broker is established
+ */
+    typedef StompDelegate<void(uint8_t index)> StompBrokerHandler;
 }
 
 #endif
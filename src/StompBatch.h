@@ -0,0 +1,99 @@
+#ifndef STOMP_BATCH_H
+#define STOMP_BATCH_H
+
+#include "Stomp.h"
+
+// The most messages a batch can hold (at most 32)
+#ifndef STOMP_BATCH_SIZE
+#define STOMP_BATCH_SIZE 8
+#endif
+
+namespace Stomp {
+
+/**
+ * The messages delivered to a batch handler, oldest first. Mark the ones to reject with nack(i).
+ */
+    struct StompBatch {
+        StompCommand *messages;
+        uint8_t count;
+        uint32_t nacks;
+
+        void nack(uint8_t index) {
+            nacks |= (uint32_t) 1 << index;
+        }
+
+        bool nacked(uint8_t index) const {
+            return (nacks >> index) & 1;
+        }
+    };
+
+/**
+ * Handler for a batch of MESSAGEs. Return ACK to acknowledge every message not marked with nack(), NACK to reject the
+ * whole batch, or CONTINUE to acknowledge them yourself.
+ */
+    typedef StompDelegate<Stomp_Ack_t(StompBatch &batch)> StompBatchHandler;
+
+/**
+ * Collects one subscription's messages until the batch is full or StompClient::loop() finishes.
+ */
+    class StompBatchBuffer {
+
+    public:
+        explicit StompBatchBuffer(uint8_t size = STOMP_BATCH_SIZE) : _count(0) {
+            setSize(size);
+        }
+
+        void setSize(uint8_t size) {
+            _size = size == 0 ? 1 : size < STOMP_BATCH_SIZE ? size : STOMP_BATCH_SIZE;
+        }
+
+        /**
+         * Take the message into the batch
+         * @return bool - true if the batch is now full
+         */
+        bool add(StompCommand &message) {
+            if (_count < _size) {
+                _messages[_count++] = std::move(message);
+            }
+            return full();
+        }
+
+        bool full() const {
+            return _count >= _size;
+        }
+
+        uint8_t count() const {
+            return _count;
+        }
+
+        StompBatch batch() {
+            return {_messages, _count, 0};
+        }
+
+        void clear() {
+            for (uint8_t i = 0; i < _count; i++) {
+                _messages[i] = StompCommand();
+            }
+            _count = 0;
+        }
+
+        void setHandler(StompBatchHandler handler) {
+            _handler = handler;
+        }
+
+        StompBatchHandler handler() const {
+            return _handler;
+        }
+
+    private:
+        static_assert(STOMP_BATCH_SIZE <= 32, "StompBatch marks NACKs in a 32-bit mask");
+
+        StompBatchHandler _handler;
+        StompCommand _messages[STOMP_BATCH_SIZE];
+        uint8_t _size;
+        uint8_t _count;
+    };
+
+}
+
+#endif
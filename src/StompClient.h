@@ -11,12 +11,71 @@
 #ifndef STOMP_CLIENT
 #define STOMP_CLIENT
 
-#ifndef STOMP_MAX_SUBSCRIPTIONS
-#define STOMP_MAX_SUBSCRIPTIONS 8
+// Default heart-beat intervals (ms) advertised in CONNECT. 0 means "cannot send" / "do not want"
+#ifndef STOMP_HEARTBEAT_SEND
+#define STOMP_HEARTBEAT_SEND 10000
+#endif
+
+#ifndef STOMP_HEARTBEAT_RECEIVE
+#define STOMP_HEARTBEAT_RECEIVE 0
+#endif
+
+// The broker is presumed dead after this many negotiated receive intervals without any inbound data
+#ifndef STOMP_HEARTBEAT_TOLERANCE
+#define STOMP_HEARTBEAT_TOLERANCE 2
+#endif
+
+// In adaptive mode the outbound heart-beat interval is shortened down to (negotiated interval / this value)
+#ifndef STOMP_HEARTBEAT_MAX_DIVISOR
+#define STOMP_HEARTBEAT_MAX_DIVISOR 4
+#endif
+
+// Minimum gap (ms) between frames replayed from the outbox after a reconnect
+#ifndef STOMP_OUTBOX_REPLAY_INTERVAL
+#define STOMP_OUTBOX_REPLAY_INTERVAL 100
+#endif
+
+#ifndef STOMP_MAX_BROKERS
+#define STOMP_MAX_BROKERS 4
+#endif
+
+// Consecutive failed connection attempts after which we fail over to another broker
+#ifndef STOMP_BROKER_MAX_FAILURES
+#define STOMP_BROKER_MAX_FAILURES 2
+#endif
+
+// Default per-state timeouts (ms): socket open, CONNECT -> CONNECTED, DISCONNECT -> receipt. 0 disables
+#ifndef STOMP_TIMEOUT_CONNECTING
+#define STOMP_TIMEOUT_CONNECTING 15000
+#endif
+
+#ifndef STOMP_TIMEOUT_OPENING
+#define STOMP_TIMEOUT_OPENING 10000
+#endif
+
+#ifndef STOMP_TIMEOUT_DISCONNECTING
+#define STOMP_TIMEOUT_DISCONNECTING 5000
 #endif
 
 #include "Stomp.h"
+#include "StompBatch.h"
 #include "StompCommandParser.h"
+#include "StompDedup.h"
+#include "StompFlightRecorder.h"
+#include "StompHeaderFilter.h"
+#include "StompInboundQueue.h"
+#include "StompJson.h"
+#include "StompLog.h"
+#include "StompMetrics.h"
+#include "StompOutbox.h"
+#include "StompProfiler.h"
+#include "StompRetry.h"
+#include "StompSockJS.h"
+#include "StompStateMachine.h"
+#include "StompSubscriptions.h"
+#include "StompTimers.h"
+#include "StompTracer.h"
+#include "StompTopicRouter.h"
 #include <WebSocketsClient.h>
 
 namespace Stomp {
@@ -39,16 +98,51 @@ namespace Stomp {
                 const int port,
                 const char *url,
                 const bool sockjs
-        ) : _wsClient(wsClient), _host(host), _port(port), _url(url), _sockjs(sockjs), _user(nullptr), _id(0),
-            _state(DISCONNECTED), _connectHandler(nullptr), _disconnectHandler(nullptr), _receiptHandler(nullptr),
-            _errorHandler(nullptr), _heartbeats(0), _commandCount(0) {
+        ) : StompClient(wsClient, nullptr, 0, sockjs) {
+            _singleBroker.host = host;
+            _singleBroker.port = port;
+            _singleBroker.url = url;
+            _brokers = &_singleBroker;
+            _brokerCount = 1;
+        }
+
+        /**
+           Constructs a new StompClient which fails over between several brokers.
+           Brokers are tried in the order given until one has been measured; after that the fastest healthy broker is
+           preferred whenever the current one fails STOMP_BROKER_MAX_FAILURES times in a row.
+           @param wsClient WebSocketsClient
+           @param brokers StompBroker*      - The brokers to use. The array must outlive the client
+           @param brokerCount uint8_t       - The number of brokers, at most STOMP_MAX_BROKERS
+           @param sockjs bool               - Set to true to indicate that the connections use SockJS protocol
+        */
+        StompClient(
+                WebSocketsClient &wsClient,
+                const StompBroker *brokers,
+                uint8_t brokerCount,
+                const bool sockjs
+        ) : _wsClient(wsClient), _brokers(brokers),
+            _brokerCount(brokerCount < STOMP_MAX_BROKERS ? brokerCount : STOMP_MAX_BROKERS), _sockjs(sockjs),
+            _user(nullptr), _id(0), _machine(_transitions(), _transitionCount(), DISCONNECTED), _connectHandler(nullptr), _disconnectHandler(nullptr),
+            _receiptHandler(nullptr), _errorHandler(nullptr), _commandCount(0),
+            _outbox(nullptr), _outboxInterval(STOMP_OUTBOX_REPLAY_INTERVAL), _lastReplayed(0), _ackReceipts(false),
+            _pendingReceipts(0), _brokerHandler(nullptr), _currentBroker(0), _ssl(false), _failoverPending(false),
+            _attemptStarted(0), _queueInbound(false), _inboundHighWater(0), _budgetExceeded(0),
+            _inboundOverflows(0) {
 
             _wsClient.onEvent([this](WStype_t type, uint8_t *payload, size_t length) {
                 this->_handleWebSocketEvent(type, payload, length);
             });
 
-            for (auto &_subscription: _subscriptions) {
-                _subscription.id = -1;
+            for (auto &stats: _brokerStats) {
+                stats = {0, 0, 0, false};
+            }
+
+            _machine.setTimeout(CONNECTING, STOMP_TIMEOUT_CONNECTING);
+            _machine.setTimeout(OPENING, STOMP_TIMEOUT_OPENING);
+            _machine.setTimeout(DISCONNECTING, STOMP_TIMEOUT_DISCONNECTING);
+
+            for (auto &pending: _delayedNacks) {
+                pending.timer = -1;
             }
 
         }
@@ -60,60 +154,269 @@ namespace Stomp {
            This method initiates the websocket connection, waits for it to be set-up, then establishes the STOMP connection
         */
         void begin() {
-            // connect to websocket
-            _wsClient.begin(_host, _port, _socketUrl());
-            _wsClient.setExtraHeaders();
+            _ssl = false;
+            _beginBroker(_currentBroker);
         }
 
         void beginSSL() {
-            // connect to websocket
-            _wsClient.beginSSL(_host, _port, _socketUrl().c_str());
-            _wsClient.setExtraHeaders();
+            _ssl = true;
+            _beginBroker(_currentBroker);
         }
 
         void loop() {
-            _wsClient.loop();
-            _doHeartbeat();
+            loop(0);
+        }
+
+        /**
+         * Service the connection, dispatching queued inbound frames (see setInboundQueue) until the time budget has
+         * been used. At least one queued frame is dispatched per call; anything left over is dispatched on the next.
+         * @param budgetMicros unsigned long - Time allowed for this call in microseconds, 0 for no limit
+         */
+        void loop(unsigned long budgetMicros) {
+            STOMP_PROFILE(PHASE_LOOP);
+            unsigned long start = micros();
+            {
+                STOMP_PROFILE(PHASE_SOCKET);
+                _wsClient.loop();
+            }
+            _dispatchInbound(start, budgetMicros);
+            _flushBatches();
+            _ackDropped();
+            {
+                STOMP_PROFILE(PHASE_TIMERS);
+                _timers.run();
+            }
+            _checkStateTimeout();
+            if (_failoverPending) {
+                _failoverPending = false;
+                _beginBroker(_selectBroker());
+            }
+            {
+                STOMP_PROFILE(PHASE_OUTBOX);
+                _replayOutbox();
+            }
+            {
+                STOMP_PROFILE(PHASE_HEARTBEAT);
+                _doHeartbeat();
+            }
+            if (_inbound.empty()) {
+                StompLog::drain();
+            }
+        }
+
+        /**
+         * When enabled, received frames are queued (up to STOMP_INBOUND_QUEUE_DEPTH) instead of being handled inside
+         * the socket callback, and are dispatched from loop() within its time budget, yielding between frames.
+         * If the queue is full the oldest frame is dispatched immediately to make room. Frames still queued when the
+         * socket closes are discarded: the broker redelivers unacknowledged messages to the next session.
+         */
+        void setInboundQueue(bool enabled) {
+            _queueInbound = enabled;
+        }
+
+        /**
+         * Set the dispatch priority of a subscription's messages when the inbound queue is in use.
+         * Priorities run from 0 (lowest, the default) to STOMP_INBOUND_LANES - 1; other frames such as RECEIPT use
+         * the highest lane. Queued messages of a higher priority are dispatched first.
+         */
+        void setPriority(int subscription, uint8_t priority) {
+            StompSubscription *sub = _subscriptions.get(subscription);
+            if (sub) {
+                sub->priority = priority;
+            }
+        }
+
+        /**
+         * The number of received frames waiting to be dispatched
+         */
+        uint16_t inboundBacklog() const {
+            return _inbound.size();
+        }
+
+        /**
+         * The largest backlog seen
+         */
+        uint16_t inboundHighWater() const {
+            return _inboundHighWater;
+        }
+
+        /**
+         * The number of loop() calls which ran out of budget with frames still queued
+         */
+        uint32_t budgetExceeded() const {
+            return _budgetExceeded;
+        }
+
+        /**
+         * The number of frames dispatched inside the socket callback because the queue was full
+         */
+        uint32_t inboundOverflows() const {
+            return _inboundOverflows;
+        }
+
+        /**
+         * The current connection state
+         */
+        Stomp_State_t state() const {
+            return _machine.state();
+        }
+
+        /**
+         * Limit the time spent in a state before recovery starts. CONNECTING and OPENING time out by counting a
+         * failed attempt against the broker and reconnecting; DISCONNECTING times out by closing the socket.
+         * @param state Stomp_State_t     - CONNECTING, OPENING or DISCONNECTING
+         * @param timeout unsigned long   - ms, 0 for no limit
+         */
+        void setStateTimeout(Stomp_State_t state, unsigned long timeout) {
+            _machine.setTimeout(state, timeout);
+        }
+
+        /**
+         * Total time (ms) spent in the given state since the client was created
+         */
+        unsigned long timeInState(Stomp_State_t state) const {
+            return _machine.totalTimeIn(state);
+        }
+
+        /**
+         * The number of times the given state has been entered
+         */
+        uint32_t stateEntries(Stomp_State_t state) const {
+            return _machine.entries(state);
+        }
+
+        /**
+         * Called on every state change, with the event which caused it
+         */
+        void onStateChange(StompTransitionHandler handler) {
+            _machine.onTransition(handler);
+        }
+
+        /**
+         * Choose the broker to try first, e.g. the last good broker saved by an onBrokerConnected handler.
+         * Call before begin()
+         */
+        void setPreferredBroker(uint8_t index) {
+            if (index < _brokerCount) {
+                _currentBroker = index;
+            }
+        }
+
+        /**
+         * The index of the broker currently in use
+         */
+        uint8_t currentBroker() const {
+            return _currentBroker;
+        }
+
+        /**
+         * Smoothed time (ms) taken to open the socket to the given broker, 0 if never measured
+         */
+        unsigned long brokerConnectLatency(uint8_t index) const {
+            return index < _brokerCount ? _brokerStats[index].connectLatency : 0;
+        }
+
+        /**
+         * Smoothed time (ms) between sending CONNECT to the given broker and receiving CONNECTED, 0 if never measured
+         */
+        unsigned long brokerStompLatency(uint8_t index) const {
+            return index < _brokerCount ? _brokerStats[index].stompLatency : 0;
+        }
+
+        /**
+         * Called with the broker's index each time a STOMP connection is established. Persist the index (EEPROM,
+         * RTC memory...) and pass it to setPreferredBroker() on the next boot to go straight to the last good broker.
+         */
+        void onBrokerConnected(StompBrokerHandler handler) {
+            _brokerHandler = handler;
         }
 
         /**
            Make a new subscription. Number incrementally
            Returns the id of the new subscription
-           Returns -1 if maximum number of subscriptions (set by STOMP_MAX_SUBSCRIPTIONS) has been exceeded
+           Returns -1 if the maximum number of subscriptions (STOMP_MAX_SUBSCRIPTIONS, or STOMP_SUBSCRIPTIONS_LIMIT if
+           the table may grow) has been reached. Ids of cancelled subscriptions are reused
            @param queue char*                 - The name of the queue to which to subscribe
            @param ackType Stomp_AckMode_t     - The acknowledgement mode to use for received messages
            @param handler StompMessageHandler - The callback function to execute when a message is received
            @return int                        - The numeric id of the subscription, or -1 if no slots are available
         */
         int subscribe(const String &queue, Stomp_AckMode_t ackType, StompMessageHandler handler) {
-            // Scan for an unused subscription slot
-            for (int i = 0; i < STOMP_MAX_SUBSCRIPTIONS; i++) {
-
-                if (_subscriptions[i].id == -1) {
-
-                    _subscriptions[i].id = i;
-                    _subscriptions[i].messageHandler = handler;
-
-                    String ack;
-                    switch (ackType) {
-                        case AUTO:
-                            ack = "auto";
-                            break;
-                        case CLIENT:
-                            ack = "client";
-                            break;
-                        case CLIENT_INDIVIDUAL:
-                            ack = "client-individual";
-                            break;
-                    }
+            StompSubscription *subscription = _subscribe(queue, ackType);
+            if (subscription == nullptr) {
+                return -1;
+            }
+
+            subscription->messageHandler = handler;
+            return subscription->id;
+        }
+
+        /**
+           Make one broker subscription whose messages are dispatched locally by a StompTopicRouter.
+           Subscribe to a broker wildcard (e.g. "/topic/sensors.#") and register the fine-grained patterns with the
+           router. The acknowledgement sent is the router's combined decision.
+           @param queue char*                 - The name of the queue or wildcard to which to subscribe
+           @param ackType Stomp_AckMode_t     - The acknowledgement mode to use for received messages
+           @param router StompTopicRouter     - The router to dispatch to. Must outlive the subscription
+           @return int                        - The numeric id of the subscription, or -1 if no slots are available
+        */
+        int subscribe(const String &queue, Stomp_AckMode_t ackType, StompTopicRouter &router) {
+            StompSubscription *subscription = _subscribe(queue, ackType);
+            if (subscription == nullptr) {
+                return -1;
+            }
 
-                    String lines[4] = {"SUBSCRIBE", "id:sub-" + String(i), "destination:" + queue, "ack:" + ack};
-                    _send(lines, 4);
+            subscription->router = &router;
+            return subscription->id;
+        }
 
-                    return i;
+        /**
+           Subscribe to a queue whose message bodies are JSON objects of a fixed shape. Each body is decoded into
+           target, without allocating, before handler is called with it; bodies which do not decode are NACKed.
+           @param queue char*                 - The name of the queue to which to subscribe
+           @param ackType Stomp_AckMode_t     - The acknowledgement mode to use for received messages
+           @param schema StompJsonSchema      - The fields to decode. Must outlive the subscription
+           @param target T                    - The struct to decode into. Reset to T() before each message
+           @param handler Stomp_Ack_t(T &)    - Called with the decoded struct
+           @return int                        - The numeric id of the subscription, or -1 if no slots are available
+        */
+        template<typename T>
+        int subscribe(const String &queue, Stomp_AckMode_t ackType, const StompJsonSchema &schema, T &target,
+                      Stomp_Ack_t (*handler)(T &value)) {
+            const StompJsonSchema *fields = &schema;
+            T *value = &target;
+            return subscribe(queue, ackType, [fields, value, handler](const StompCommand &message) {
+                *value = T();
+                if (!StompJsonDecoder::decode(message.body.c_str(), *fields, value)) {
+                    return NACK;
                 }
+                return handler(*value);
+            });
+        }
+
+        /**
+           Subscribe to a queue whose messages are handled in batches. Messages are collected in buffer and passed to
+           handler together when the buffer is full, or at the end of loop(). In CLIENT mode the batch is acknowledged
+           with a single cumulative ACK (plus a NACK for each message the handler marks). disconnectGracefully() hands
+           over what has arrived before sending DISCONNECT; when the session ends, messages still in the buffer are
+           discarded (the broker redelivers them), except in AUTO mode where they are handed over.
+           @param queue char*                 - The name of the queue to which to subscribe
+           @param ackType Stomp_AckMode_t     - The acknowledgement mode to use for received messages
+           @param buffer StompBatchBuffer     - Storage for the pending messages. Must outlive the subscription
+           @param handler StompBatchHandler   - Called with each batch
+           @return int                        - The numeric id of the subscription, or -1 if no slots are available
+        */
+        int subscribeBatch(const String &queue, Stomp_AckMode_t ackType, StompBatchBuffer &buffer,
+                           StompBatchHandler handler) {
+            StompSubscription *subscription = _subscribe(queue, ackType);
+            if (subscription == nullptr) {
+                return -1;
             }
-            return -1;
+
+            buffer.clear();
+            buffer.setHandler(handler);
+            subscription->batch = &buffer;
+            return subscription->id;
         }
 
         /**
@@ -121,44 +424,209 @@ namespace Stomp {
            @param subscription int - The subscription number previously returned by the subscribe() method
         */
         void unsubscribe(int subscription) {
+            StompSubscription *sub = _subscriptions.get(subscription);
+            if (sub && sub->batch) {
+                sub->batch->clear();
+            }
+            if (!_subscriptions.remove(subscription)) {
+                return;
+            }
+
             String msg[2] = {"UNSUBSCRIBE", "id:sub-" + String(subscription)};
             _send(msg, 2);
+        }
+
+        /**
+         * Suppress redelivered messages on a subscription. The message-ids the handler has accepted (ACK or CONTINUE)
+         * are remembered in window; when one arrives again the handler is not called and it is acknowledged: at once
+         * in CLIENT_INDIVIDUAL mode, and in CLIENT mode by one cumulative ACK sent from loop() once it settles nothing
+         * the sketch still holds. NACKed messages are not remembered, so their redelivery is handled normally.
+         * @param subscription int         - The subscription number returned by subscribe()
+         * @param window StompDedupWindow* - The memory to use, which must outlive the subscription. nullptr disables
+         */
+        void setDeduplication(int subscription, StompDedupWindow *window) {
+            StompSubscription *sub = _subscriptions.get(subscription);
+            if (sub) {
+                sub->dedup = window;
+            }
+        }
+
+        /**
+         * Only pass a subscription's messages to its handler when their headers match filter. The filter runs on the
+         * raw frame, so rejected messages are never parsed; they are acknowledged or left alone as the filter's
+         * setRejected() says. In CLIENT mode one cumulative ACK covers them, sent from loop() once it settles nothing
+         * the sketch still holds.
+         * @param subscription int           - The subscription number returned by subscribe()
+         * @param filter StompHeaderFilter*  - The compiled filter, which must outlive the subscription. nullptr disables
+         */
+        void setFilter(int subscription, StompHeaderFilter *filter) {
+            StompSubscription *sub = _subscriptions.get(subscription);
+            if (sub) {
+                sub->filter = filter;
+            }
+        }
+
+        /**
+         * Hold back the NACKs of a subscription's handler so that a failing message is not redelivered in a tight
+         * loop. Each NACK of a message is sent after an exponentially growing delay; once the message has been NACKed
+         * policy.maxAttempts times it is passed to policy.deadLetter and ACKed instead. If the broker gives redeliveries
+         * a new message-id, set policy.keyHeader (see StompRetryPolicy). Only CLIENT_INDIVIDUAL subscriptions can retry:
+         * in CLIENT mode the ACK of a later message would settle the one waiting for its NACK.
+         * @param subscription int          - The subscription number returned by subscribe()
+         * @param policy StompRetryPolicy*  - The policy, which must outlive the subscription. nullptr NACKs at once
+         * @return bool                     - false if there is no such subscription, or it is not CLIENT_INDIVIDUAL
+         */
+        bool setRetryPolicy(int subscription, const StompRetryPolicy *policy) {
+            StompSubscription *sub = _subscriptions.get(subscription);
+            if (sub == nullptr || (policy != nullptr && sub->ackMode != CLIENT_INDIVIDUAL)) {
+                return false;
+            }
+            sub->retry = policy;
+            return true;
+        }
 
-            _subscriptions[subscription].id = -1;
-            _subscriptions[subscription].messageHandler = nullptr;
+        /**
+         * The client's timers, run from loop(). Use them to schedule work without blocking in delay()
+         */
+        StompTimers &timers() {
+            return _timers;
         }
 
         /**
          * Acknowledge receipt of the message
          * @param message StompCommand - The message being acknowledged
          */
-        void ack(StompCommand message) {
-            String msg[2] = {"ACK", "id:" + message.headers.getValue("ack")};
-            _send(msg, 2);
+        void ack(const StompCommand &message) {
+            _releaseHold(message);
+            _sendAck("ACK", message);
         }
 
         /**
          * Reject receipt of the message with the given messageId
          * @param message StompCommand - The message being rejected
          */
-        void nack(StompCommand message) {
-            String msg[2] = {"NACK", "id:" + message.headers.getValue("ack")};
-            _send(msg, 2);
+        void nack(const StompCommand &message) {
+            StompSubscription *subscription = _subscriptions.get(
+                    StompSubscriptionTable::parseId(message.headers.find("subscription")));
+            const String *messageId = message.headers.find("message-id");
+            if (subscription && subscription->dedup && messageId) {
+                subscription->dedup->forget(StompDedupWindow::hash(*messageId));
+            }
+
+            _releaseHold(message);
+            _sendAck("NACK", message);
+        }
+
+        /**
+         * Request receipts for every ACK and NACK, so that disconnectGracefully() can wait until the broker has
+         * processed them
+         */
+        void setAckReceipts(bool ackReceipts) {
+            _ackReceipts = ackReceipts;
+        }
+
+        /**
+         * The number of ACK/NACK receipts not yet received
+         */
+        uint32_t pendingReceipts() const {
+            return _pendingReceipts;
         }
 
+        /**
+         * Start disconnecting. The socket is closed, and the disconnect handler called, once the broker's receipt for
+         * the DISCONNECT frame arrives (or the DISCONNECTING timeout expires). If we are not connected yet, the
+         * connection attempt is simply abandoned.
+         */
         void disconnect() {
-            String msg[2] = {"DISCONNECT", "receipt:" + String(_commandCount)};
+            Stomp_State_t state = _machine.state();
+            if (state != CONNECTED) {
+                // Nothing to tell the broker: just abandon the connection attempt
+                if (state != DISCONNECTED && state != DISCONNECTING) {
+                    _machine.fire(EVENT_CLOSE);
+                    _closeSocket();
+                }
+                return;
+            }
+
+            _disconnectReceipt = "disconnect-" + String(_commandCount);
+            _receiptTimer.sent(_commandCount, millis());
+            String msg[2] = {"DISCONNECT", "receipt:" + _disconnectReceipt};
+            _machine.fire(EVENT_DISCONNECT);
             _send(msg, 2);
         }
 
-        void sendMessage(const String &destination, const String &message) {
-            String lines[4] = {"SEND", "destination:" + destination, "", message};
-            _send(lines, 4);
+        /**
+         * Disconnect without losing anything in flight, e.g. before deep sleep. Blocks, servicing the socket, until:
+         * the outbox has been flushed, all ACK/NACK receipts (see setAckReceipts) have arrived, DISCONNECT has been
+         * sent and its receipt received. The socket is then closed. If the timeout expires first the socket is
+         * closed anyway.
+         * @param timeout unsigned long - Maximum time to block, in ms
+         * @return bool                 - true if the disconnect completed cleanly within the timeout
+         */
+        bool disconnectGracefully(unsigned long timeout) {
+            unsigned long start = millis();
+            bool clean = false;
+
+            if (_machine.state() == CONNECTED) {
+                _flushBatches();
+                _ackDropped();
+                clean = _flushOutbox(start, timeout) &&
+                        _waitUntil([this]() { return _pendingReceipts == 0; }, start, timeout);
+
+                disconnect();
+                clean = _waitUntil([this]() { return _machine.state() == DISCONNECTED; }, start, timeout) && clean;
+            }
+
+            if (_machine.state() != DISCONNECTED) {
+                _machine.fire(EVENT_CLOSE);
+                _closeSocket();
+            }
+
+            return clean;
+        }
+
+        /**
+         * Send a message. If an outbox has been set, messages which cannot be sent right now are queued and
+         * replayed in order after the connection is re-established.
+         * @param destination String - The destination to send to
+         * @param message String     - The message body
+         * @param ttl unsigned long  - Milliseconds after which a queued message is dropped instead of sent, 0 for never
+         * @return bool              - true if the message was sent or queued
+         */
+        bool sendMessage(const String &destination, const String &message, unsigned long ttl = 0) {
+            String lines[7] = {"SEND", "destination:" + destination};
+            uint8_t nlines = _sendLines(destination, message, lines);
+            return _sendOrQueue(_serialise(lines, nlines), ttl);
+        }
+
+        bool sendMessageAndHeaders(const String &destination, const String &message, const StompHeaders &headers,
+                                   unsigned long ttl = 0) {
+            String lines[7] = {"SEND", "destination:" + destination};
+            uint8_t nlines = _sendLines(destination, message, lines);
+            return _sendOrQueue(_serialiseWithHeaders(lines, nlines, headers), ttl);
+        }
+
+        /**
+         * Trace the latency of every SEND and MESSAGE (see StompTracer). nullptr stops tracing
+         */
+        void setTracer(StompTracer *tracer) {
+            _tracer = tracer;
+        }
+
+        /**
+         * Use the given store for messages sent while disconnected. Pass nullptr to stop queueing.
+         * @param outbox StompOutbox* - e.g. StompRamOutbox, StompLittleFSOutbox or StompMmapOutbox
+         */
+        void setOutbox(StompOutbox *outbox) {
+            _outbox = outbox;
         }
 
-        void sendMessageAndHeaders(const String &destination, const String &message, const StompHeaders &headers) {
-            String lines[4] = {"SEND", "destination:" + destination, "", message};
-            _sendWithHeaders(lines, 4, headers);
+        /**
+         * Set the minimum gap between frames replayed from the outbox, so a reconnect does not flood the broker
+         * @param interval unsigned long - milliseconds, 0 to replay one frame on every loop()
+         */
+        void setOutboxReplayInterval(unsigned long interval) {
+            _outboxInterval = interval;
         }
 
         void onConnect(StompStateHandler handler) {
@@ -181,34 +649,174 @@ namespace Stomp {
             _user = user;
         }
 
+        /**
+         * Set the heart-beat intervals advertised in the CONNECT frame. Takes effect on the next connection.
+         * The intervals actually used are negotiated with the broker as described in the STOMP 1.1 specification.
+         * @param sendInterval unsigned long    - Smallest interval (ms) at which we can send heart-beats, 0 for never
+         * @param receiveInterval unsigned long - Interval (ms) at which we want to receive heart-beats, 0 for never
+         */
+        void setHeartbeat(unsigned long sendInterval, unsigned long receiveInterval) {
+            _heartbeatSendInterval = sendInterval;
+            _heartbeatReceiveInterval = receiveInterval;
+        }
+
+        /**
+         * In adaptive mode outbound heart-beats are sent as late as the negotiated interval allows while the link is
+         * healthy, and progressively earlier (down to 1/STOMP_HEARTBEAT_MAX_DIVISOR of the interval) when inbound
+         * data arrives late or a send fails. Real outbound traffic relaxes the interval again.
+         */
+        void setAdaptiveHeartbeat(bool adaptive) {
+            _adaptiveHeartbeat = adaptive;
+            _heartbeatDivisor = 1;
+        }
+
+        /**
+         * The negotiated interval (ms) at which we send heart-beats, or 0 if none are sent
+         */
+        unsigned long outgoingHeartbeat() const {
+            return _heartbeatOutgoing;
+        }
+
+        /**
+         * The negotiated interval (ms) at which the broker sends heart-beats, or 0 if none are expected
+         */
+        unsigned long incomingHeartbeat() const {
+            return _heartbeatIncoming;
+        }
+
+        /**
+         * Counters and latency histograms covering everything the client has done
+         */
+        const StompMetrics &metrics() const {
+            return _metrics;
+        }
+
+        void resetMetrics() {
+            _metrics.reset();
+        }
+
+        /**
+         * Send a JSON snapshot of metrics() to destination every interval ms while connected
+         * @param destination String    - Where to send the snapshot
+         * @param interval unsigned long - ms between snapshots. 0 stops publishing
+         * @return bool                  - false if no timer was free
+         */
+        bool publishMetrics(const String &destination, unsigned long interval) {
+            _timers.cancel(_metricsTimer);
+            _metricsTimer = -1;
+            _metricsDestination = destination;
+            if (interval == 0) {
+                return true;
+            }
+
+            _metricsTimer = _timers.start(interval, [this]() {
+                this->_publishMetrics();
+            }, interval);
+            return _metricsTimer != -1;
+        }
+
+        /**
+         * Record every frame sent and received in recorder (nullptr to stop)
+         */
+        void setFlightRecorder(StompFlightRecorder *recorder) {
+            _recorder = recorder;
+        }
+
+        /**
+         * Send the flight recorder's contents, as text, to destination
+         * @return bool - false if there is no recorder or the frame could not be sent
+         */
+        bool publishFlightRecord(const String &destination) {
+            if (_recorder == nullptr) {
+                return false;
+            }
+            return sendMessage(destination, _recorder->toString());
+        }
+
+        /**
+         * The number of times the connection was dropped because the broker stopped sending
+         */
+        uint32_t heartbeatMisses() const {
+            return _metrics.heartbeatMisses;
+        }
+
     private:
-        const long _preferredHeartbeat = 10000;
+
+        typedef struct {
+            unsigned long connectLatency;
+            unsigned long stompLatency;
+            uint8_t failures;
+            bool measured;
+        } BrokerStats;
 
         WebSocketsClient &_wsClient;
-        const char *_host;
-        const int _port;
-        const char *_url;
+        StompBroker _singleBroker;
+        const StompBroker *_brokers;
+        uint8_t _brokerCount;
         const bool _sockjs;
         const char *_user;
 
         long _id;
         unsigned long _lastSent = millis();
-        unsigned long _heartbeatInterval = 0;
+        unsigned long _lastReceived = millis();
+
+        unsigned long _heartbeatSendInterval = STOMP_HEARTBEAT_SEND;
+        unsigned long _heartbeatReceiveInterval = STOMP_HEARTBEAT_RECEIVE;
+        unsigned long _heartbeatOutgoing = 0;
+        unsigned long _heartbeatIncoming = 0;
+        bool _adaptiveHeartbeat = false;
+        uint8_t _heartbeatDivisor = 1;
 
-        Stomp_State_t _state;
+        StompStateMachine _machine;
 
-        StompSubscription _subscriptions[STOMP_MAX_SUBSCRIPTIONS];
+        StompSubscriptionTable _subscriptions;
 
         StompStateHandler _connectHandler;
         StompStateHandler _disconnectHandler;
         StompStateHandler _receiptHandler;
         StompStateHandler _errorHandler;
 
-        uint32_t _heartbeats;
+        StompMetrics _metrics;
+        StompReceiptTimer _receiptTimer;
+        String _metricsDestination;
+        int8_t _metricsTimer = -1;
+        StompFlightRecorder *_recorder = nullptr;
+        StompTracer *_tracer = nullptr;
         uint32_t _commandCount;
 
+        StompOutbox *_outbox;
+        unsigned long _outboxInterval;
+        unsigned long _lastReplayed;
+
+        bool _ackReceipts;
+        uint32_t _pendingReceipts;
+        String _disconnectReceipt;
+
+        StompBrokerHandler _brokerHandler;
+        BrokerStats _brokerStats[STOMP_MAX_BROKERS];
+        uint8_t _currentBroker;
+        bool _ssl;
+        bool _failoverPending;
+        unsigned long _attemptStarted;
+
+        bool _queueInbound;
+        StompInboundQueue _inbound;
+        uint16_t _inboundHighWater;
+        uint32_t _budgetExceeded;
+        uint32_t _inboundOverflows;
+
+        StompTimers _timers;
+        StompRetryAttempts _retryAttempts;
+
+        struct DelayedNack {
+            String ackId;
+            uint32_t session;  // the CONNECTED entry count when the NACK was deferred
+            int8_t timer;
+        };
+        DelayedNack _delayedNacks[STOMP_MAX_DELAYED_NACKS];
+
         String _socketUrl() {
-            String socketUrl = _url;
+            String socketUrl = _brokers[_currentBroker].url;
             if (_sockjs) {
                 socketUrl += random(0, 999);
                 socketUrl += "/";
@@ -219,34 +827,223 @@ namespace Stomp {
             return socketUrl;
         }
 
-        void _handleWebSocketEvent(WStype_t type, uint8_t *payload, size_t length) {
-            String text = (char *) payload;
-            Serial.println("Event");
-            Serial.println(text);
+        void _beginBroker(uint8_t index) {
+            _currentBroker = index;
+            _attemptStarted = millis();
+            _machine.fire(EVENT_BEGIN);
 
-            switch (type) {
-                case WStype_DISCONNECTED:
-                    _state = DISCONNECTED;
-                    break;
+            const StompBroker &broker = _brokers[index];
+            if (_ssl) {
+                _wsClient.beginSSL(broker.host, broker.port, _socketUrl().c_str());
+            } else {
+                _wsClient.begin(broker.host, broker.port, _socketUrl());
+            }
+            _wsClient.setExtraHeaders();
+        }
 
-                case WStype_CONNECTED:
-                    _connectStomp();
-                    break;
+        /**
+         * Pick the broker for the next attempt: the measured healthy broker with the lowest CONNECTED latency,
+         * otherwise the next untried healthy broker in list order. If every broker has failed, start over.
+         */
+        uint8_t _selectBroker() {
+            int best = -1;
+            for (uint8_t i = 0; i < _brokerCount; i++) {
+                const BrokerStats &stats = _brokerStats[i];
+                if (i == _currentBroker || stats.failures >= STOMP_BROKER_MAX_FAILURES || !stats.measured) continue;
+                if (best == -1 || stats.stompLatency < _brokerStats[best].stompLatency) {
+                    best = i;
+                }
+            }
 
-                case WStype_TEXT:
+            for (uint8_t n = 1; best == -1 && n < _brokerCount; n++) {
+                uint8_t i = (_currentBroker + n) % _brokerCount;
+                if (_brokerStats[i].failures < STOMP_BROKER_MAX_FAILURES) {
+                    best = i;
+                }
+            }
+
+            if (best == -1) {
+                for (uint8_t i = 0; i < _brokerCount; i++) {
+                    _brokerStats[i].failures = 0;
+                }
+                best = (_currentBroker + 1) % _brokerCount;
+            }
+
+            return best;
+        }
+
+        static unsigned long _smooth(unsigned long average, unsigned long sample, bool measured) {
+            return measured ? (average * 3 + sample) / 4 : sample;
+        }
+
+        /**
+         * Every state change goes through this table. Anything not listed is ignored.
+         * CONNECTING covers the socket library's own silent reconnect attempts, so it is re-entered (restarting its
+         * timeout) when the socket closes or an attempt times out.
+         */
+        static const StompTransition *_transitions(uint8_t *count = nullptr) {
+            static const StompTransition table[] = {
+                    {DISCONNECTED,  EVENT_BEGIN,         CONNECTING},
+                    {DISCONNECTED,  EVENT_SOCKET_OPEN,   OPENING},
+                    // no SOCKET_CLOSED: the close that follows a DISCONNECT receipt is not a new state
+
+                    {CONNECTING,    EVENT_BEGIN,         CONNECTING},
+                    {CONNECTING,    EVENT_SOCKET_OPEN,   OPENING},
+                    {CONNECTING,    EVENT_SOCKET_CLOSED, CONNECTING},
+                    {CONNECTING,    EVENT_TIMEOUT,       CONNECTING},
+                    {CONNECTING,    EVENT_CLOSE,         DISCONNECTED},
+
+                    {OPENING,       EVENT_BEGIN,         CONNECTING},
+                    {OPENING,       EVENT_CONNECTED,     CONNECTED},
+                    {OPENING,       EVENT_ERROR,         DISCONNECTED},
+                    {OPENING,       EVENT_SOCKET_CLOSED, CONNECTING},
+                    {OPENING,       EVENT_TIMEOUT,       CONNECTING},
+                    {OPENING,       EVENT_CLOSE,         DISCONNECTED},
+
+                    {CONNECTED,     EVENT_BEGIN,         CONNECTING},
+                    {CONNECTED,     EVENT_ERROR,         DISCONNECTED},
+                    {CONNECTED,     EVENT_DISCONNECT,    DISCONNECTING},
+                    {CONNECTED,     EVENT_SOCKET_CLOSED, CONNECTING},
+                    {CONNECTED,     EVENT_TIMEOUT,       CONNECTING},
+                    {CONNECTED,     EVENT_CLOSE,         DISCONNECTED},
+
+                    {DISCONNECTING, EVENT_RECEIPT,       DISCONNECTED},
+                    {DISCONNECTING, EVENT_ERROR,         DISCONNECTED},
+                    {DISCONNECTING, EVENT_SOCKET_CLOSED, DISCONNECTED},
+                    {DISCONNECTING, EVENT_TIMEOUT,       DISCONNECTED},
+                    {DISCONNECTING, EVENT_CLOSE,         DISCONNECTED},
+            };
+            if (count) {
+                *count = sizeof(table) / sizeof(table[0]);
+            }
+            return table;
+        }
+
+        static uint8_t _transitionCount() {
+            uint8_t count;
+            _transitions(&count);
+            return count;
+        }
+
+        /**
+         * Recover from a state which has outlived its timeout
+         */
+        void _checkStateTimeout() {
+            if (!_machine.timedOut()) {
+                return;
+            }
+
+            Stomp_State_t state = _machine.state();
+            _machine.fire(EVENT_TIMEOUT);
+
+            switch (state) {
+                case CONNECTING:
+                    // the socket library keeps retrying in the background; just count the failure
+                    _brokerFailed();
+                    break;
+
+                case OPENING:
+                    _brokerFailed();
+                    _closeSocket();
+                    break;
+
+                case DISCONNECTING:
+                    _closeSocket();
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        /**
+         * Close the socket ourselves. The session ends now, whenever the socket library reports the close
+         */
+        void _closeSocket() {
+            _wsClient.disconnect();
+            _endSession();
+        }
+
+        /**
+         * Drop what the closed session left behind: its frames must not be handled (or ACKed) once the next session
+         * has started, and the broker redelivers its unacknowledged messages anyway. Batches in AUTO mode are handed
+         * over instead, since the broker considers their messages delivered
+         */
+        void _endSession() {
+            _inbound.clear();
+            _subscriptions.forEach([this](StompSubscription &subscription) {
+                subscription.cumulative.reset();
+                if (subscription.batch && subscription.batch->count() > 0) {
+                    if (subscription.ackMode == AUTO) {
+                        this->_flushBatch(subscription);
+                    } else {
+                        subscription.batch->clear();
+                    }
+                }
+            });
+        }
+
+        /**
+         * Count a failed attempt against the current broker and fail over if it has failed too often
+         */
+        void _brokerFailed() {
+            BrokerStats &stats = _brokerStats[_currentBroker];
+            if (stats.failures < 255) {
+                stats.failures++;
+            }
+            if (_brokerCount > 1 && stats.failures >= STOMP_BROKER_MAX_FAILURES) {
+                STOMP_LOG_INFO("failing over from broker ", _currentBroker);
+                _failoverPending = true;
+            }
+        }
+
+        void _handleWebSocketEvent(WStype_t type, uint8_t *payload, size_t length) {
+            String text = (char *) payload;
+            STOMP_LOG_TRACE("event ", (int) type, ": ", text);
+
+            switch (type) {
+                case WStype_DISCONNECTED:
+                    if (_machine.state() == OPENING) {
+                        _brokerFailed();
+                    }
+                    _attemptStarted = millis();
+                    _machine.fire(EVENT_SOCKET_CLOSED);
+                    _endSession();
+                    _heartbeatOutgoing = 0;
+                    _heartbeatIncoming = 0;
+                    _pendingReceipts = 0;
+                    break;
+
+                case WStype_CONNECTED: {
+                    BrokerStats &stats = _brokerStats[_currentBroker];
+                    stats.connectLatency = _smooth(stats.connectLatency, millis() - _attemptStarted, stats.measured);
+                    // over SockJS, CONNECT waits for the session's open frame
+                    if (!_sockjs) {
+                        _connectStomp();
+                    }
+                    break;
+                }
+
+                case WStype_TEXT:
+
+                    _receivedData();
 
                     if (_sockjs) {
                         if (payload[0] == 'h') {
-                            _heartbeats++;
+                            _metrics.heartbeatsIn++;
                         } else if (payload[0] == 'o') {
                             _connectStomp();
                         } else if (payload[0] == 'a') {
-                            StompCommand command = StompCommandParser::parse(text);
-                            _handleCommand(command);
+                            if (!StompSockJS::decode(text.c_str(), text.length(), [this](String &frame) {
+                                _receiveFrame(frame);
+                            })) {
+                                STOMP_LOG_WARN("malformed SockJS frame");
+                            }
+                        } else if (payload[0] == 'c') {
+                            STOMP_LOG_INFO("SockJS session closed ", text);
                         }
                     } else {
-                        StompCommand command = StompCommandParser::parse(text);
-                        _handleCommand(command);
+                        _receiveFrame(text);
                     }
 
                     break;
@@ -256,31 +1053,197 @@ namespace Stomp {
             }
         }
 
+        /**
+         * Handle a received frame now, or queue it for loop()
+         */
+        void _receiveFrame(String &text) {
+            if (!_queueInbound) {
+                _handleFrame(text);
+                return;
+            }
+
+            uint8_t priority = _framePriority(text);
+            if (_inbound.full(priority)) {
+                String oldest;
+                _inbound.popLane(priority, oldest);
+                _inboundOverflows++;
+                _handleFrame(oldest);
+            }
+
+            _inbound.push(text, priority);
+            if (_inbound.size() > _inboundHighWater) {
+                _inboundHighWater = _inbound.size();
+            }
+        }
+
+        /**
+         * MESSAGEs take their subscription's priority; everything else goes in the highest lane
+         */
+        uint8_t _framePriority(const String &text) {
+            if (!text.startsWith("MESSAGE")) {
+                return STOMP_INBOUND_LANES - 1;
+            }
+
+            unsigned int length;
+            const char *value = StompCommandParser::peekHeader(text, "subscription", &length);
+            StompSubscription *subscription = _subscriptions.get(StompSubscriptionTable::parseId(value, length));
+            return subscription ? subscription->priority : 0;
+        }
+
+        void _handleFrame(const String &text) {
+            _metrics.framesIn++;
+            _metrics.bytesIn += text.length();
+            _metrics.frameSizeIn.record(text.length());
+            if (_recorder) {
+                _recorder->record(text, false);
+            }
+
+            char first = text.length() ? text[0] : '\0';
+            if (first == '\n' || first == '\r' || first == '\0') {
+                // A bare EOL is the broker's heart-beat
+                _metrics.heartbeatsIn++;
+                return;
+            }
+
+            unsigned long start = micros();
+            StompCommand command;
+            {
+                STOMP_PROFILE(PHASE_PARSE);
+                if (text.startsWith("MESSAGE") && _filteredOut(text)) {
+                    return;
+                }
+                command = StompCommandParser::parse(text);
+            }
+            unsigned long parsed = micros();
+            _metrics.parseMicros.record(parsed - start);
+
+            {
+                STOMP_PROFILE(PHASE_DISPATCH);
+                _handleCommand(command);
+            }
+            _metrics.dispatchMicros.record(micros() - parsed);
+        }
+
+        /**
+         * Apply the subscription's header filter to a raw MESSAGE frame
+         * @return bool - true if the message was rejected (and acknowledged if need be)
+         */
+        bool _filteredOut(const String &text) {
+            unsigned int length;
+            const char *value = StompCommandParser::peekHeader(text, "subscription", &length);
+            StompSubscription *subscription = _subscriptions.get(StompSubscriptionTable::parseId(value, length));
+            if (subscription == nullptr || subscription->filter == nullptr || subscription->filter->matches(text)) {
+                return false;
+            }
+
+            uint32_t seq = subscription->cumulative.next();
+            if (subscription->filter->rejectWith() != ACK || subscription->ackMode == AUTO) {
+                return true;
+            }
+            value = StompCommandParser::peekHeader(text, "ack", &length);
+            if (value == nullptr) {
+                return true;
+            }
+            if (subscription->ackMode == CLIENT_INDIVIDUAL) {
+                String id;
+                id.concat(value, length);
+                _sendAck("ACK", id);
+            } else {
+                // in CLIENT mode an ACK is cumulative: it waits until it settles nothing still held (see _ackDropped)
+                subscription->cumulative.drop(value, length, seq);
+            }
+            return true;
+        }
+
+        /**
+         * Dispatch queued frames until the queue is empty or the budget (measured from start) is used up. At least one
+         * frame is dispatched, even if the socket used the whole budget, so that the queue drains from loop() rather
+         * than by overflowing inside the socket callback
+         */
+        void _dispatchInbound(unsigned long start, unsigned long budgetMicros) {
+            String frame;
+            while (!_inbound.empty()) {
+                _inbound.pop(frame);
+                _handleFrame(frame);
+                yield();
+
+                if (budgetMicros > 0 && !_inbound.empty() && micros() - start >= budgetMicros) {
+                    _budgetExceeded++;
+                    return;
+                }
+            }
+        }
+
         void _doHeartbeat() {
-            if (_heartbeatInterval <= 0) {
+            if (_machine.state() != CONNECTED) {
+                return;
+            }
+
+            unsigned long now = millis();
+
+            if (_heartbeatIncoming > 0 && now - _lastReceived > _heartbeatIncoming * STOMP_HEARTBEAT_TOLERANCE) {
+                // Nothing heard from the broker for too long: drop the socket and let it reconnect
+                _metrics.heartbeatMisses++;
+                STOMP_LOG_WARN("no heart-beat from broker for ", now - _lastReceived, " ms");
+                _lastReceived = now;
+                _brokerFailed();
+                _machine.fire(EVENT_TIMEOUT);
+                _closeSocket();
                 return;
             }
 
-            if (millis() - _lastSent > _heartbeatInterval) {
+            if (_heartbeatOutgoing > 0 && now - _lastSent >= _heartbeatOutgoing / _heartbeatDivisor) {
                 _sendHeartbeat();
             }
         }
 
         void _sendHeartbeat() {
             String msg = "\n";
-            Serial.println("SENDING HEARTBEAT");
-            Serial.println();
+            STOMP_LOG_TRACE("send heart-beat");
+            if (_recorder) {
+                _recorder->record(msg, true);
+            }
 
-            _wsClient.sendTXT(msg.c_str(), msg.length());
+            bool sent;
+            {
+                STOMP_PROFILE(PHASE_SEND);
+                sent = _transmit(msg, msg.length());
+            }
+            if (!sent) {
+                _heartbeatShaky();
+            }
             _lastSent = millis();
             _commandCount++;
         }
 
+        /**
+         * Record inbound data (any frame counts as a heart-beat) and, in adaptive mode, whether it arrived late
+         */
+        void _receivedData() {
+            unsigned long now = millis();
+            if (_heartbeatIncoming > 0 && now - _lastReceived > _heartbeatIncoming) {
+                _heartbeatShaky();
+            }
+            _lastReceived = now;
+        }
+
+        void _heartbeatShaky() {
+            if (_adaptiveHeartbeat && _heartbeatDivisor < STOMP_HEARTBEAT_MAX_DIVISOR) {
+                _heartbeatDivisor *= 2;
+            }
+        }
+
+        void _heartbeatHealthy() {
+            if (_heartbeatDivisor > 1) {
+                _heartbeatDivisor /= 2;
+            }
+        }
+
         void _connectStomp() {
-            if (_state != OPENING) {
-                _state = OPENING;
+            if (_machine.fire(EVENT_SOCKET_OPEN)) {
 
-                String heartbeatHeader = "heart-beat:" + String(_preferredHeartbeat) + ",0";
+                String heartbeatHeader = "heart-beat:" + String(_heartbeatSendInterval) + "," +
+                                         String(_heartbeatReceiveInterval);
                 String msg[5] = {"CONNECT", "accept-version:1.1,1.0", heartbeatHeader};
                 int current_length = 3;
 
@@ -292,7 +1255,7 @@ namespace Stomp {
             }
         }
 
-        void _handleCommand(const StompCommand &command) {
+        void _handleCommand(StompCommand &command) {
 
             if (command.command.equals("CONNECTED")) {
 
@@ -316,53 +1279,176 @@ namespace Stomp {
         }
 
         void _handleConnected(const StompCommand &command) {
-            if (_state != CONNECTED) {
-                _state = CONNECTED;
-                parseHeartbeat(command);
+            if (_machine.state() == OPENING) {
+                unsigned long latency = _machine.timeInState();
+                _machine.fire(EVENT_CONNECTED);
+                _metrics.connects++;
+                STOMP_LOG_INFO("connected to broker ", _currentBroker, " in ", latency, " ms");
+                _negotiateHeartbeat(command);
+
+                BrokerStats &stats = _brokerStats[_currentBroker];
+                stats.stompLatency = _smooth(stats.stompLatency, latency, stats.measured);
+                stats.measured = true;
+                stats.failures = 0;
+                if (_brokerHandler) {
+                    _brokerHandler(_currentBroker);
+                }
+
                 if (_connectHandler) {
                     _connectHandler(command);
                 }
             }
         }
 
-        void parseHeartbeat(const StompCommand &command) {
-            StompHeaders headers = command.headers;
-            const String &heartBeatHeader = headers.getValue("heart-beat");
+        /**
+         * Apply the broker's heart-beat:sx,sy header to our own cx,cy.
+         * We send every max(cx, sy) unless either is 0; we expect data every max(cy, sx) unless either is 0.
+         * A missing header means the broker does not do heart-beats at all.
+         */
+        void _negotiateHeartbeat(const StompCommand &command) {
+            const String heartBeatHeader = command.headers.getValue("heart-beat");
+
+            _heartbeatOutgoing = 0;
+            _heartbeatIncoming = 0;
+            _heartbeatDivisor = 1;
+            _lastReceived = millis();
+
+            int comma = heartBeatHeader.indexOf(',');
+            if (comma == -1) {
+                return;
+            }
+
+            unsigned long serverSend = heartBeatHeader.substring(0, comma).toInt();
+            unsigned long serverReceive = heartBeatHeader.substring(comma + 1).toInt();
 
-            if (!String("").equals(heartBeatHeader)) {
-                String heartbeatInterval = heartBeatHeader.substring(heartBeatHeader.indexOf(','),
-                                                                     heartBeatHeader.length());
-                _heartbeatInterval = max(heartBeatHeader.toInt(), _preferredHeartbeat);
-                Serial.println("Got heartbeat interval: " + String(_heartbeatInterval));
-                Serial.println();
+            if (_heartbeatSendInterval > 0 && serverReceive > 0) {
+                _heartbeatOutgoing = _heartbeatSendInterval > serverReceive ? _heartbeatSendInterval : serverReceive;
             }
+            if (_heartbeatReceiveInterval > 0 && serverSend > 0) {
+                _heartbeatIncoming = _heartbeatReceiveInterval > serverSend ? _heartbeatReceiveInterval : serverSend;
+            }
+
+            STOMP_LOG_DEBUG("heart-beat send: ", _heartbeatOutgoing, " receive: ", _heartbeatIncoming);
         }
 
-        void _handleMessage(StompCommand message) {
-            String sub = message.headers.getValue("subscription");
-            if (!sub.startsWith("sub-")) {
+        /**
+         * Allocate a subscription slot and send SUBSCRIBE for it
+         */
+        StompSubscription *_subscribe(const String &queue, Stomp_AckMode_t ackType) {
+            StompSubscription *subscription = _subscriptions.add();
+            if (subscription == nullptr) {
+                return nullptr;
+            }
+
+            subscription->ackMode = ackType;
+
+            String ack;
+            switch (ackType) {
+                case AUTO:
+                    ack = "auto";
+                    break;
+                case CLIENT:
+                    ack = "client";
+                    break;
+                case CLIENT_INDIVIDUAL:
+                    ack = "client-individual";
+                    break;
+            }
+
+            String lines[4] = {"SUBSCRIBE", "id:sub-" + String(subscription->id), "destination:" + queue,
+                               "ack:" + ack};
+            _send(lines, 4);
+
+            return subscription;
+        }
+
+        void _handleMessage(StompCommand &message) {
+            _metrics.messages++;
+            if (_tracer) {
+                _tracer->received(message);
+            }
+            long id = StompSubscriptionTable::parseId(message.headers.find("subscription"));
+
+            StompSubscription *subscription = _subscriptions.get(id);
+            if (subscription == nullptr) {
                 // Not for us. Do nothing (raise an error one day??)
                 return;
             }
-            long id = sub.substring(4).toInt();
 
-            String messageId = message.headers.getValue("message-id");
+            uint32_t seq = subscription->cumulative.next();
+            uint32_t hash = 0;
+            if (subscription->dedup) {
+                const String *messageId = message.headers.find("message-id");
+                if (messageId) {
+                    hash = StompDedupWindow::hash(*messageId);
+                    if (subscription->dedup->contains(hash)) {
+                        subscription->dedup->countDuplicate();
+                        const String *ackId = message.headers.find("ack");
+                        if (subscription->ackMode == CLIENT_INDIVIDUAL) {
+                            ack(message);
+                        } else if (subscription->ackMode == CLIENT && ackId) {
+                            // in CLIENT mode an ACK is cumulative: it waits until it settles nothing still held
+                            subscription->cumulative.drop(ackId->c_str(), ackId->length(), seq);
+                        }
+                        return;
+                    }
+                }
+            }
 
-            StompSubscription *subscription = &_subscriptions[id];
-            if (subscription->id != id) {
+            if (subscription->batch) {
+                subscription->cumulative.batchSeq = seq;
+                if (subscription->batch->add(message)) {
+                    _flushBatch(*subscription);
+                }
                 return;
             }
 
-            if (subscription->messageHandler) {
-                StompMessageHandler callback = subscription->messageHandler;
-                Stomp_Ack_t ackType = callback(message);
+            if (subscription->messageHandler || subscription->router) {
+                Stomp_Ack_t ackType;
+                {
+                    STOMP_PROFILE(PHASE_HANDLER);
+                    if (subscription->router) {
+                        ackType = subscription->router->route(message);
+                    } else {
+                        // Copy the handler: the table may grow (moving the subscription) if the handler subscribes
+                        StompMessageHandler callback = subscription->messageHandler;
+                        ackType = callback(message);
+                    }
+                }
+
+                // The handler may have unsubscribed, so look the window up again
+                subscription = _subscriptions.get(id);
+                if (hash != 0 && ackType != NACK && subscription && subscription->dedup) {
+                    subscription->dedup->record(hash);
+                }
+
+                const StompRetryPolicy *retry = subscription ? subscription->retry : nullptr;
+                if (retry && ackType != NACK) {
+                    _settleRetry(message, *retry);
+                }
+
+                if (subscription && subscription->ackMode == CLIENT) {
+                    if (ackType == CONTINUE) {
+                        const String *ackId = message.headers.find("ack");
+                        if (ackId) {
+                            subscription->cumulative.hold(*ackId, seq);
+                        }
+                    } else {
+                        subscription->cumulative.settled(seq);
+                    }
+                }
+
                 switch (ackType) {
                     case ACK:
                         ack(message);
                         break;
 
                     case NACK:
-                        nack(message);
+                        if (retry) {
+                            _retry(message, *retry);
+                        } else {
+                            nack(message);
+                        }
                         break;
 
                     case CONTINUE:
@@ -373,14 +1459,216 @@ namespace Stomp {
 
         }
 
+        void _publishMetrics() {
+            if (_machine.state() != CONNECTED) {
+                return;
+            }
+            String snapshot;
+            _metrics.toJson(snapshot);
+            sendMessage(_metricsDestination, snapshot);
+        }
+
+        void _flushBatches() {
+            _subscriptions.forEach([this](StompSubscription &subscription) {
+                if (subscription.batch && subscription.batch->count() > 0) {
+                    this->_flushBatch(subscription);
+                }
+            });
+        }
+
+        void _flushBatch(StompSubscription &subscription) {
+            // Copy what we need: the table may grow (moving the subscription) if the handler subscribes
+            long id = subscription.id;
+            uint32_t seq = subscription.cumulative.batchSeq;
+            StompBatchBuffer *buffer = subscription.batch;
+            StompDedupWindow *dedup = subscription.dedup;
+            Stomp_AckMode_t ackMode = subscription.ackMode;
+
+            StompBatch batch = buffer->batch();
+            StompBatchHandler handler = buffer->handler();
+            Stomp_Ack_t decision = ACK;
+            if (handler) {
+                STOMP_PROFILE(PHASE_HANDLER);
+                decision = handler(batch);
+            }
+            if (decision == NACK) {
+                batch.nacks = batch.count < 32 ? ((uint32_t) 1 << batch.count) - 1 : 0xFFFFFFFF;
+            }
+
+            for (uint8_t i = 0; dedup && i < batch.count; i++) {
+                const String *messageId = batch.messages[i].headers.find("message-id");
+                if (messageId && !batch.nacked(i)) {
+                    dedup->record(StompDedupWindow::hash(*messageId));
+                }
+            }
+
+            if (decision != CONTINUE && ackMode != AUTO) {
+                _ackBatch(batch, ackMode);
+            }
+
+            StompSubscription *current = _subscriptions.get(id);
+            if (current && ackMode == CLIENT && batch.count > 0) {
+                if (decision == CONTINUE) {
+                    const String *ackId = batch.messages[batch.count - 1].headers.find("ack");
+                    if (ackId) {
+                        current->cumulative.hold(*ackId, seq);
+                    }
+                } else {
+                    current->cumulative.settled(seq);
+                }
+            }
+            buffer->clear();
+        }
+
+        /**
+         * In CLIENT mode, acknowledge the messages the client dropped itself, once the ACK settles nothing still held
+         */
+        void _ackDropped() {
+            if (_machine.state() != CONNECTED) {
+                return;
+            }
+            _subscriptions.forEach([this](StompSubscription &subscription) {
+                StompCumulativeAck &cumulative = subscription.cumulative;
+                if (subscription.ackMode == CLIENT &&
+                    cumulative.ready(subscription.batch ? subscription.batch->count() : 0)) {
+                    this->_sendAck("ACK", cumulative.dropped);
+                    cumulative.settled(cumulative.droppedSeq);
+                }
+            });
+        }
+
+        /**
+         * Acknowledge a batch with as few frames as the ack mode allows
+         */
+        void _ackBatch(const StompBatch &batch, Stomp_AckMode_t ackMode) {
+            if (ackMode == CLIENT_INDIVIDUAL) {
+                for (uint8_t i = 0; i < batch.count; i++) {
+                    _sendAck(batch.nacked(i) ? "NACK" : "ACK", batch.messages[i]);
+                }
+                return;
+            }
+
+            // CLIENT: an ACK covers every earlier unacknowledged message, so only ACK just before each NACK and at the end
+            bool accepted = false;
+            for (uint8_t i = 0; i < batch.count; i++) {
+                if (batch.nacked(i)) {
+                    if (accepted) {
+                        _sendAck("ACK", batch.messages[i - 1]);
+                        accepted = false;
+                    }
+                    _sendAck("NACK", batch.messages[i]);
+                } else {
+                    accepted = true;
+                }
+            }
+            if (accepted) {
+                _sendAck("ACK", batch.messages[batch.count - 1]);
+            }
+        }
+
+        /**
+         * NACK a message according to a retry policy: later, or not at all once it has used up its attempts
+         */
+        void _retry(const StompCommand &message, const StompRetryPolicy &policy) {
+            const String *key = _retryKey(message, policy);
+            if (key == nullptr) {
+                nack(message);
+                return;
+            }
+
+            uint32_t hash = StompDedupWindow::hash(*key);
+            uint8_t attempts = _retryAttempts.increment(hash);
+            if (attempts >= policy.maxAttempts) {
+                _retryAttempts.forget(hash);
+                if (policy.deadLetter) {
+                    policy.deadLetter(message, attempts);
+                }
+                ack(message);
+                return;
+            }
+
+            for (uint8_t i = 0; i < STOMP_MAX_DELAYED_NACKS; i++) {
+                DelayedNack &pending = _delayedNacks[i];
+                if (pending.timer != -1) {
+                    continue;
+                }
+
+                pending.timer = _timers.start(StompRetryAttempts::delay(policy, attempts), [this, i]() {
+                    this->_sendDelayedNack(i);
+                });
+                if (pending.timer == -1) {
+                    break;
+                }
+                pending.ackId = message.headers.getValue("ack");
+                pending.session = _machine.entries(CONNECTED);
+                return;
+            }
+
+            // No room to defer it
+            nack(message);
+        }
+
+        /**
+         * The sketch settled a message it kept with CONTINUE: in CLIENT mode that may free the dropped messages' ACK
+         */
+        void _releaseHold(const StompCommand &message) {
+            StompSubscription *subscription = _subscriptions.get(
+                    StompSubscriptionTable::parseId(message.headers.find("subscription")));
+            const String *ackId = message.headers.find("ack");
+            if (subscription && subscription->ackMode == CLIENT && ackId) {
+                subscription->cumulative.settled(*ackId);
+            }
+        }
+
+        void _settleRetry(const StompCommand &message, const StompRetryPolicy &policy) {
+            const String *key = _retryKey(message, policy);
+            if (key) {
+                _retryAttempts.forget(StompDedupWindow::hash(*key));
+            }
+        }
+
+        /**
+         * The header which identifies a message across redeliveries: the policy's key header, else the message-id
+         */
+        static const String *_retryKey(const StompCommand &message, const StompRetryPolicy &policy) {
+            const String *key = policy.keyHeader ? message.headers.find(policy.keyHeader) : nullptr;
+            return key ? key : message.headers.find("message-id");
+        }
+
+        /**
+         * Send a deferred NACK, unless the connection it belonged to has gone (the broker redelivers anyway)
+         */
+        void _sendDelayedNack(uint8_t index) {
+            DelayedNack &pending = _delayedNacks[index];
+            if (_machine.state() == CONNECTED && pending.session == _machine.entries(CONNECTED)) {
+                _sendAck("NACK", pending.ackId);
+            }
+            pending.ackId = String();
+            pending.timer = -1;
+        }
+
         void _handleReceipt(const StompCommand &command) {
+            String receiptId = command.headers.getValue("receipt-id");
+
+            unsigned long rtt;
+            int dash = receiptId.indexOf('-');
+            if (_tracer && _tracer->receipt(receiptId)) {
+                // traced SEND: timed by the tracer
+            } else if (dash != -1 && _receiptTimer.received(receiptId.substring(dash + 1).toInt(), millis(), &rtt)) {
+                _metrics.receiptMillis.record(rtt);
+            }
+
+            if (receiptId.startsWith("ack-") && _pendingReceipts > 0) {
+                _pendingReceipts--;
+            }
 
             if (_receiptHandler) {
                 _receiptHandler(command);
             }
 
-            if (_state == DISCONNECTING) {
-                _state = DISCONNECTED;
+            if (_machine.state() == DISCONNECTING && receiptId.equals(_disconnectReceipt)) {
+                _machine.fire(EVENT_RECEIPT);
+                _closeSocket();
                 if (_disconnectHandler) {
                     _disconnectHandler(command);
                 }
@@ -388,7 +1676,12 @@ namespace Stomp {
         }
 
         void _handleError(const StompCommand &command) {
-            _state = DISCONNECTED;
+            _metrics.errors++;
+            STOMP_LOG_WARN("ERROR from broker: ", command.headers.getValue("message"));
+            if (_machine.state() == OPENING) {
+                _brokerFailed();
+            }
+            _machine.fire(EVENT_ERROR);
             if (_errorHandler) {
                 _errorHandler(command);
             }
@@ -398,22 +1691,125 @@ namespace Stomp {
         }
 
         void _send(String lines[], uint8_t nlines) {
+            _sendFrame(_serialise(lines, nlines));
+        }
+
+        void _sendAck(const char *command, const StompCommand &message) {
+            const String *id = message.headers.find("ack");
+            if (id) {
+                _sendAck(command, *id);
+            } else {
+                _sendAck(command, String());
+            }
+        }
+
+        void _sendAck(const char *command, const String &id) {
+            // built in one buffer: ACKs are sent for nearly every message
+            String msg;
+            msg.reserve(strlen(command) + id.length() + 32);
+            msg += command;
+            msg += "\nid:";
+            msg += id;
+            msg += '\n';
+
+            if (_ackReceipts) {
+                msg += "receipt:ack-";
+                msg += _commandCount;
+                msg += '\n';
+                _pendingReceipts++;
+                _receiptTimer.sent(_commandCount, millis());
+            }
+            msg += '\n';
+
+            if (strcmp(command, "ACK") == 0) {
+                _metrics.acks++;
+            } else {
+                _metrics.nacks++;
+            }
+            STOMP_LOG_TRACE("send ", msg);
+            _sendFrame(msg);
+        }
+
+        /**
+         * Service the socket until done() returns true or the timeout (measured from start) expires
+         */
+        template<typename Condition>
+        bool _waitUntil(Condition done, unsigned long start, unsigned long timeout) {
+            while (!done()) {
+                Stomp_State_t state = _machine.state();
+                if (millis() - start >= timeout || (state != CONNECTED && state != DISCONNECTING)) {
+                    return done();
+                }
+                _wsClient.loop();
+                _dispatchInbound(micros(), 0);
+                if (_machine.state() == CONNECTED) {
+                    // settle what arrived while waiting, before DISCONNECT
+                    _flushBatches();
+                    _ackDropped();
+                }
+                yield();
+            }
+            return true;
+        }
+
+        /**
+         * Send everything left in the outbox, ignoring the replay interval
+         */
+        bool _flushOutbox(unsigned long start, unsigned long timeout) {
+            if (_outbox == nullptr) {
+                return true;
+            }
+
+            String frame;
+            StompOutboxRecord record;
+            while (_outbox->peek(frame, record)) {
+                if (millis() - start >= timeout) {
+                    return false;
+                }
+                if (!_outbox->expired(record)) {
+                    if (!_sendFrame(frame)) {
+                        return false;
+                    }
+                }
+                _outbox->pop();
+                yield();
+            }
+            return true;
+        }
+
+        /**
+         * Complete the lines of a SEND frame after its command and destination
+         * @return uint8_t - The number of lines
+         */
+        uint8_t _sendLines(const String &destination, const String &message, String lines[]) {
+            uint8_t nlines = 2;
+            if (_tracer) {
+                nlines += _tracer->stamp(destination, lines + nlines);
+            }
+            lines[nlines++] = "";
+            lines[nlines++] = message;
+            return nlines;
+        }
+
+        String _serialise(String lines[], uint8_t nlines) {
+            unsigned int length = 1;
+            for (int i = 0; i < nlines; i++) {
+                length += lines[i].length() + 1;
+            }
             String msg;
+            msg.reserve(length);
             for (int i = 0; i < nlines; i++) {
                 msg += lines[i];
                 msg += "\n";
             }
             msg += "\n";
 
-            Serial.println("SENDING MESSAGE:");
-            Serial.println(msg);
+            STOMP_LOG_TRACE("send ", msg);
 
-            _wsClient.sendTXT(msg.c_str(), msg.length() + 1);
-            _lastSent = millis();
-            _commandCount++;
+            return msg;
         }
 
-        void _sendWithHeaders(String lines[], uint8_t nlines, StompHeaders headers) {
+        String _serialiseWithHeaders(String lines[], uint8_t nlines, const StompHeaders &headers) {
 
             String msg;
             // Add the command
@@ -430,8 +1826,93 @@ namespace Stomp {
             }
             msg += "\n";
 
-            _wsClient.sendTXT(msg.c_str(), msg.length() + 1);
+            return msg;
+        }
+
+        /**
+         * Send a serialised frame, including its NULL terminator
+         */
+        bool _sendFrame(const String &msg) {
+            unsigned long start = micros();
+            bool sent;
+            {
+                STOMP_PROFILE(PHASE_SEND);
+                sent = _transmit(msg, msg.length() + 1);
+            }
+            _metrics.sendMicros.record(micros() - start);
+            if (_recorder) {
+                _recorder->record(msg, true);
+            }
+
+            if (sent) {
+                _metrics.framesOut++;
+                _metrics.bytesOut += msg.length();
+                _metrics.frameSizeOut.record(msg.length());
+                // Real traffic doubles as a heart-beat, so the adaptive interval can relax
+                _heartbeatHealthy();
+            } else {
+                _metrics.sendFailures++;
+                _heartbeatShaky();
+            }
+            _lastSent = millis();
             _commandCount++;
+            return sent;
+        }
+
+        /**
+         * Hand length bytes of msg to the socket, wrapped in SockJS framing if need be
+         */
+        bool _transmit(const String &msg, size_t length) {
+            if (!_sockjs) {
+                return _wsClient.sendTXT(msg.c_str(), length);
+            }
+            String framed = StompSockJS::encode(msg.c_str(), length);
+            return _wsClient.sendTXT(framed.c_str(), framed.length());
+        }
+
+        /**
+         * Send a SEND frame now, or queue it if we are not connected, the send fails, or older frames are
+         * still waiting in the outbox (so that order is preserved)
+         */
+        bool _sendOrQueue(const String &msg, unsigned long ttl) {
+            if (_outbox == nullptr) {
+                return _machine.state() == CONNECTED && _sendFrame(msg);
+            }
+
+            if (_machine.state() == CONNECTED && _outbox->size() == 0 && _sendFrame(msg)) {
+                return true;
+            }
+
+            return _outbox->push(msg, ttl);
+        }
+
+        /**
+         * Replay at most one queued frame per call, no more often than the replay interval. Expired frames are
+         * discarded without counting against the rate.
+         */
+        void _replayOutbox() {
+            if (_outbox == nullptr || _machine.state() != CONNECTED) {
+                return;
+            }
+
+            if (_outboxInterval > 0 && millis() - _lastReplayed < _outboxInterval) {
+                return;
+            }
+
+            String frame;
+            StompOutboxRecord record;
+            while (_outbox->peek(frame, record)) {
+                if (_outbox->expired(record)) {
+                    _outbox->pop();
+                    continue;
+                }
+
+                if (_sendFrame(frame)) {
+                    _outbox->pop();
+                }
+                _lastReplayed = millis();
+                return;
+            }
         }
 
     };
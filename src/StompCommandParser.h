@@ -19,64 +19,77 @@ namespace Stomp {
             // NULL
             // * (EOL)
 
-            String EOL = "\n";
-            String EOL2 = "\n\n";
+            const char EOL = '\n';
+            const char *blank = strstr(data.c_str(), "\n\n");
 
             long headersStart = data.indexOf(EOL);
-            long bodyStart = data.indexOf(EOL2);
+            long bodyStart = blank ? blank - data.c_str() : -1;
 
             StompCommand cmd;
-            String headers;
-            long start = 0;
-            long end = 0;
 
             if (headersStart == -1) {
                 cmd.command = data;
             } else {
                 cmd.command = data.substring(0, headersStart);
-                headersStart += EOL.length();
+                headersStart += 1;
             }
             cmd.command.trim();
 
-            if (bodyStart == -1) {
-                headers = data.substring(headersStart);
-                cmd.body = "";
-            } else {
-                headers = data.substring(headersStart, bodyStart);
-
-                bodyStart += EOL2.length();
-                cmd.body = data.substring(bodyStart);
+            long headersEnd = bodyStart == -1 ? data.length() : bodyStart;
+            if (bodyStart != -1) {
+                cmd.body = data.substring(bodyStart + 2);
+                cmd.body.trim();
             }
 
-            headers.trim();
-            cmd.body.trim();
-
-            String header;
-
-            while (start < 0 || (unsigned) start < headers.length()) {
-                end = headers.indexOf(EOL, start);
-                if (end == -1) {
-                    header = headers.substring(start);
-                    start = headers.length();
-                } else {
-                    header = headers.substring(start, end);
-                    start = end + EOL.length();
+            // split each header line straight out of the frame, without copying the line or the header block first
+            long start = headersStart;
+            while (start != -1 && start < headersEnd) {
+                long end = data.indexOf(EOL, start);
+                if (end == -1 || end > headersEnd) {
+                    end = headersEnd;
                 }
-                header.trim();
-                // now split it into key and value
-                int idx = header.indexOf(":");
-                if (idx != -1) {
+                int idx = data.indexOf(':', start);
+                if (idx != -1 && idx < end) {
                     StompHeader h;
-                    h.key = header.substring(0, idx);
+                    h.key = data.substring(start, idx);
                     h.key.trim();
-                    h.value = header.substring(idx + 1);
+                    h.value = data.substring(idx + 1, end);
                     h.value.trim();
-                    cmd.headers.append(h);
+                    cmd.headers.append(std::move(h));
                 }
+                start = end + 1;
             }
 
             return cmd;
         }
+
+        /**
+         * Locate a header in an unparsed frame without allocating
+         * @param data String        - The raw frame
+         * @param key char*          - The header name
+         * @param length unsigned*   - Set to the length of the value
+         * @return const char*       - The start of the value (not NULL terminated, still escaped), or nullptr if
+         *                             absent
+         */
+        static const char *peekHeader(const String &data, const char *key, unsigned int *length) {
+            const char *p = data.c_str();
+            size_t keyLength = strlen(key);
+
+            // skip the command line, then look at each header line until the blank line (which may end in CRLF)
+            p = strchr(p, '\n');
+            while (p != nullptr && p[1] != '\n' && p[1] != '\0' && !(p[1] == '\r' && p[2] == '\n')) {
+                const char *line = p + 1;
+                p = strchr(line, '\n');
+                if (strncmp(line, key, keyLength) == 0 && line[keyLength] == ':') {
+                    const char *value = line + keyLength + 1;
+                    const char *end = p ? p : value + strlen(value);
+                    if (end > value && end[-1] == '\r') end--;
+                    *length = end - value;
+                    return value;
+                }
+            }
+            return nullptr;
+        }
     };
 
 }
@@ -0,0 +1,91 @@
+#ifndef STOMP_DEDUP_H
+#define STOMP_DEDUP_H
+
+#include "Stomp.h"
+
+// The number of recent message-ids remembered by each StompDedupWindow
+#ifndef STOMP_DEDUP_WINDOW
+#define STOMP_DEDUP_WINDOW 32
+#endif
+
+namespace Stomp {
+
+/**
+ * Remembers the most recent STOMP_DEDUP_WINDOW message-ids of a subscription, as 32-bit FNV-1a hashes in a ring, so
+ * that redelivered messages can be recognised. Memory use is fixed: 4 bytes per id, whatever the ids' lengths.
+ *
+ * A hash collision makes a new message look like a duplicate; with a window of 32 the chance is about 1 in 10^8 per
+ * message.
+ */
+    class StompDedupWindow {
+
+    public:
+        StompDedupWindow() : _next(0), _duplicates(0) {
+            clear();
+        }
+
+        static uint32_t hash(const String &messageId) {
+            uint32_t h = 2166136261u;
+            for (const char *p = messageId.c_str(); *p; p++) {
+                h = (h ^ (uint8_t) *p) * 16777619u;
+            }
+            return h == 0 ? 1 : h;  // 0 marks an empty slot
+        }
+
+        bool contains(uint32_t hash) const {
+            for (uint32_t seen: _hashes) {
+                if (seen == hash) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Remember hash, forgetting the oldest once the window is full
+         */
+        void record(uint32_t hash) {
+            if (contains(hash)) {
+                return;
+            }
+            _hashes[_next] = hash;
+            _next = (_next + 1) % STOMP_DEDUP_WINDOW;
+        }
+
+        /**
+         * Forget hash, so that a redelivery of the message is handled again
+         */
+        void forget(uint32_t hash) {
+            for (uint32_t &seen: _hashes) {
+                if (seen == hash) {
+                    seen = 0;
+                }
+            }
+        }
+
+        void clear() {
+            for (uint32_t &seen: _hashes) {
+                seen = 0;
+            }
+        }
+
+        /**
+         * The number of duplicates suppressed
+         */
+        uint32_t duplicates() const {
+            return _duplicates;
+        }
+
+        void countDuplicate() {
+            _duplicates++;
+        }
+
+    private:
+        uint32_t _hashes[STOMP_DEDUP_WINDOW];
+        uint16_t _next;
+        uint32_t _duplicates;
+    };
+
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef STOMP_DELEGATE_H
+#define STOMP_DELEGATE_H
+
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+#include <utility>
+
+// Bytes available inline for a bound callable: enough for an object pointer plus a member function pointer
+#ifndef STOMP_DELEGATE_SIZE
+#define STOMP_DELEGATE_SIZE (4 * sizeof(void *))
+#endif
+
+namespace Stomp {
+
+    template<typename Signature>
+    class StompDelegate;
+
+/**
+ * A callable stored inline, without heap allocation. It can hold:
+ *  - a plain function pointer (so existing handlers keep working)
+ *  - a member function bound to an object:     StompDelegate<...>(&object, &Object::method)
+ *  - a function taking a void* context:        StompDelegate<...>(function, context)
+ *  - a lambda or functor of up to STOMP_DELEGATE_SIZE bytes which is trivially copyable (e.g. captures pointers
+ *    and plain values, not Strings)
+ * Oversized or non-trivial callables are rejected at compile time.
+ */
+    template<typename R, typename... Args>
+    class StompDelegate<R(Args...)> {
+
+    public:
+        StompDelegate() : _invoke(nullptr) {
+        }
+
+        StompDelegate(std::nullptr_t) : _invoke(nullptr) {
+        }
+
+        template<typename F, typename = typename std::enable_if<
+                !std::is_same<typename std::decay<F>::type, StompDelegate>::value &&
+                std::is_convertible<decltype(std::declval<F &>()(std::declval<Args>()...)), R>::value>::type>
+        StompDelegate(F callable) : _invoke(nullptr) {
+            static_assert(sizeof(F) <= STOMP_DELEGATE_SIZE, "callable too large for StompDelegate");
+            static_assert(alignof(F) <= alignof(void *), "callable over-aligned for StompDelegate");
+            static_assert(std::is_trivially_copyable<F>::value, "StompDelegate callables must be trivially copyable");
+
+            if (_isNull(callable)) {
+                return;
+            }
+            memcpy(_storage, (const void *) &callable, sizeof(F));
+            _invoke = &_call<F>;
+        }
+
+        template<typename T>
+        StompDelegate(T *object, R (T::*method)(Args...)) :
+                StompDelegate([object, method](Args... args) -> R {
+                    return (object->*method)(std::forward<Args>(args)...);
+                }) {
+        }
+
+        template<typename T>
+        StompDelegate(const T *object, R (T::*method)(Args...) const) :
+                StompDelegate([object, method](Args... args) -> R {
+                    return (object->*method)(std::forward<Args>(args)...);
+                }) {
+        }
+
+        StompDelegate(R (*function)(void *, Args...), void *context) :
+                StompDelegate([function, context](Args... args) -> R {
+                    return function(context, std::forward<Args>(args)...);
+                }) {
+        }
+
+        R operator()(Args... args) const {
+            return _invoke(_storage, std::forward<Args>(args)...);
+        }
+
+        explicit operator bool() const {
+            return _invoke != nullptr;
+        }
+
+        bool operator==(std::nullptr_t) const {
+            return _invoke == nullptr;
+        }
+
+        bool operator!=(std::nullptr_t) const {
+            return _invoke != nullptr;
+        }
+
+    private:
+        typedef R (*Invoker)(const void *storage, Args... args);
+
+        alignas(void *) unsigned char _storage[STOMP_DELEGATE_SIZE];
+        Invoker _invoke;
+
+        template<typename F>
+        static R _call(const void *storage, Args... args) {
+            F *callable = (F *) const_cast<void *>(storage);
+            return (*callable)(std::forward<Args>(args)...);
+        }
+
+        template<typename F>
+        static bool _isNull(const F &) {
+            return false;
+        }
+
+        template<typename F>
+        static bool _isNull(F *pointer) {
+            return pointer == nullptr;
+        }
+    };
+
+}
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef STOMP_FLIGHT_RECORDER_H
+#define STOMP_FLIGHT_RECORDER_H
+
+#include "Stomp.h"
+#include "StompCommandParser.h"
+#include "StompSubscriptions.h"
+
+// The number of frames remembered. At 24 bytes each the default fits in the ESP8266's 512 bytes of RTC user memory
+#ifndef STOMP_RECORDER_RECORDS
+#define STOMP_RECORDER_RECORDS 16
+#endif
+
+// The number of body bytes kept for each frame
+#ifndef STOMP_RECORDER_BODY_BYTES
+#define STOMP_RECORDER_BODY_BYTES 12
+#endif
+
+// First 4-byte block of RTC user memory used by the mirror
+#ifndef STOMP_RECORDER_RTC_OFFSET
+#define STOMP_RECORDER_RTC_OFFSET 0
+#endif
+
+namespace Stomp {
+
+    typedef enum {
+        FRAME_UNKNOWN,
+        FRAME_CONNECT,
+        FRAME_CONNECTED,
+        FRAME_SEND,
+        FRAME_SUBSCRIBE,
+        FRAME_UNSUBSCRIBE,
+        FRAME_ACK,
+        FRAME_NACK,
+        FRAME_DISCONNECT,
+        FRAME_MESSAGE,
+        FRAME_RECEIPT,
+        FRAME_ERROR,
+        FRAME_HEARTBEAT
+    } Stomp_Frame_t;
+
+/**
+ * Keeps metadata of the last STOMP_RECORDER_RECORDS frames sent and received, for post-mortems: when, which command,
+ * which subscription, how large, and the first bytes of the body. Recording copies a few bytes into a fixed ring; it
+ * does not allocate.
+ *
+ * On the ESP8266 the ring can be mirrored into RTC memory as it is written, and restored after a soft reset.
+ */
+    class StompFlightRecorder {
+
+    public:
+        struct Record {
+            uint32_t time;      // millis()
+            uint8_t command;    // Stomp_Frame_t
+            uint8_t outbound;
+            int16_t subscription;
+            uint16_t size;
+            char body[STOMP_RECORDER_BODY_BYTES];  // not NULL terminated when full
+        };
+
+        StompFlightRecorder() : _head(0), _count(0), _rtcMirror(false) {
+        }
+
+        static Stomp_Frame_t classify(const char *frame) {
+            switch (frame[0]) {
+                case '\0':
+                case '\n':
+                case '\r':
+                    return FRAME_HEARTBEAT;
+                case 'A':
+                    return _is(frame, "ACK") ? FRAME_ACK : FRAME_UNKNOWN;
+                case 'C':
+                    return _is(frame, "CONNECTED") ? FRAME_CONNECTED : _is(frame, "CONNECT") ? FRAME_CONNECT :
+                                                                       FRAME_UNKNOWN;
+                case 'D':
+                    return _is(frame, "DISCONNECT") ? FRAME_DISCONNECT : FRAME_UNKNOWN;
+                case 'E':
+                    return _is(frame, "ERROR") ? FRAME_ERROR : FRAME_UNKNOWN;
+                case 'M':
+                    return _is(frame, "MESSAGE") ? FRAME_MESSAGE : FRAME_UNKNOWN;
+                case 'N':
+                    return _is(frame, "NACK") ? FRAME_NACK : FRAME_UNKNOWN;
+                case 'R':
+                    return _is(frame, "RECEIPT") ? FRAME_RECEIPT : FRAME_UNKNOWN;
+                case 'S':
+                    return _is(frame, "SEND") ? FRAME_SEND : _is(frame, "SUBSCRIBE") ? FRAME_SUBSCRIBE : FRAME_UNKNOWN;
+                case 'U':
+                    return _is(frame, "UNSUBSCRIBE") ? FRAME_UNSUBSCRIBE : FRAME_UNKNOWN;
+                default:
+                    return FRAME_UNKNOWN;
+            }
+        }
+
+        static const char *name(uint8_t command) {
+            static const char *const names[] = {"?", "CONNECT", "CONNECTED", "SEND", "SUBSCRIBE", "UNSUBSCRIBE", "ACK",
+                                                "NACK", "DISCONNECT", "MESSAGE", "RECEIPT", "ERROR", "HEARTBEAT"};
+            return command <= FRAME_HEARTBEAT ? names[command] : names[0];
+        }
+
+        /**
+         * Record a raw frame
+         */
+        void record(const String &frame, bool outbound) {
+            Record &r = _records[_head];
+            const char *text = frame.c_str();
+
+            r.time = millis();
+            r.command = classify(text);
+            r.outbound = outbound;
+            r.size = frame.length() > 0xFFFF ? 0xFFFF : frame.length();
+
+            r.subscription = -1;
+            if (r.command == FRAME_MESSAGE) {
+                unsigned int length;
+                const char *value = StompCommandParser::peekHeader(frame, "subscription", &length);
+                r.subscription = StompSubscriptionTable::parseId(value, length);
+            }
+
+            memset(r.body, 0, sizeof(r.body));
+            const char *body = strstr(text, "\n\n");
+            if (body) {
+                strncpy(r.body, body + 2, sizeof(r.body));
+            }
+
+            uint8_t index = _head;
+            _head = (_head + 1) % STOMP_RECORDER_RECORDS;
+            if (_count < STOMP_RECORDER_RECORDS) {
+                _count++;
+            }
+
+            if (_rtcMirror) {
+                _mirror(index);
+            }
+        }
+
+        uint8_t count() const {
+            return _count;
+        }
+
+        /**
+         * @param index uint8_t - 0 is the oldest record held
+         */
+        const Record &get(uint8_t index) const {
+            return _records[(_head + STOMP_RECORDER_RECORDS - _count + index) % STOMP_RECORDER_RECORDS];
+        }
+
+        void clear() {
+            _head = 0;
+            _count = 0;
+            if (_rtcMirror) {
+                _mirrorHeader();
+            }
+        }
+
+        /**
+         * Print the records, oldest first, one per line:
+         *     -1234ms < MESSAGE sub-2 187B {"temp":21.
+         */
+        void dump(Print &out) const {
+            char line[64];
+            for (uint8_t i = 0; i < _count; i++) {
+                _format(get(i), line, sizeof(line));
+                out.println(line);
+            }
+        }
+
+        String toString() const {
+            String text;
+            char line[64];
+            for (uint8_t i = 0; i < _count; i++) {
+                _format(get(i), line, sizeof(line));
+                text += line;
+                text += "\n";
+            }
+            return text;
+        }
+
+        /**
+         * Write every record through to RTC memory as well (ESP8266 only), so that they survive a soft reset
+         * @return bool - false if RTC memory is not available or too small
+         */
+        bool setRtcMirror(bool enabled) {
+#if defined(ESP8266)
+            static_assert(8 + sizeof(_records) <= 512 - STOMP_RECORDER_RTC_OFFSET * 4,
+                          "flight recorder too large for RTC user memory");
+            _rtcMirror = enabled;
+            if (enabled) {
+                for (uint8_t i = 0; i < STOMP_RECORDER_RECORDS; i++) {
+                    _mirror(i);
+                }
+            }
+            return true;
+#else
+            _rtcMirror = false;
+            return !enabled;
+#endif
+        }
+
+        /**
+         * Load the records mirrored into RTC memory before a soft reset (ESP8266 only). Call this before
+         * setRtcMirror(true), which overwrites them. Restored times are millis() of the previous boot.
+         * @return bool - false if there was nothing to restore
+         */
+        bool restoreFromRtc() {
+#if defined(ESP8266)
+            uint32_t header[2];
+            if (!ESP.rtcUserMemoryRead(STOMP_RECORDER_RTC_OFFSET, header, sizeof(header)) || header[0] != _magic() ||
+                (header[1] & 0xFF) >= STOMP_RECORDER_RECORDS || (header[1] >> 8 & 0xFF) > STOMP_RECORDER_RECORDS) {
+                return false;
+            }
+            if (!ESP.rtcUserMemoryRead(STOMP_RECORDER_RTC_OFFSET + 2, (uint32_t *) _records, sizeof(_records))) {
+                return false;
+            }
+            _head = header[1] & 0xFF;
+            _count = header[1] >> 8 & 0xFF;
+            return true;
+#else
+            return false;
+#endif
+        }
+
+    private:
+        static_assert(sizeof(Record) % 4 == 0, "records are mirrored in 4-byte RTC blocks");
+        static_assert(STOMP_RECORDER_RECORDS <= 255, "STOMP_RECORDER_RECORDS must fit in a byte");
+
+        Record _records[STOMP_RECORDER_RECORDS];
+        uint8_t _head;
+        uint8_t _count;
+        bool _rtcMirror;
+
+        static bool _is(const char *frame, const char *command) {
+            size_t length = strlen(command);
+            char next = frame[length];
+            return strncmp(frame, command, length) == 0 && (next == '\n' || next == '\r' || next == '\0');
+        }
+
+        static void _format(const Record &r, char *line, size_t size) {
+            char body[STOMP_RECORDER_BODY_BYTES + 1];
+            for (uint8_t i = 0; i <= STOMP_RECORDER_BODY_BYTES; i++) {
+                char c = i < STOMP_RECORDER_BODY_BYTES ? r.body[i] : '\0';
+                body[i] = c == '\0' ? '\0' : (c < ' ' || c > '~') ? '.' : c;
+                if (c == '\0') break;
+            }
+
+            char subscription[12] = "";
+            if (r.subscription >= 0) {
+                snprintf(subscription, sizeof(subscription), " sub-%d", r.subscription);
+            }
+            snprintf(line, size, "-%lums %c %s%s %uB %s", (unsigned long) (millis() - r.time), r.outbound ? '>' : '<',
+                     name(r.command), subscription, (unsigned) r.size, body);
+        }
+
+        static uint32_t _magic() {
+            return 0x53544652 ^ (uint32_t) sizeof(Record) ^ (uint32_t) STOMP_RECORDER_RECORDS << 24;
+        }
+
+        void _mirrorHeader() {
+#if defined(ESP8266)
+            uint32_t header[2] = {_magic(), (uint32_t) _head | (uint32_t) _count << 8};
+            ESP.rtcUserMemoryWrite(STOMP_RECORDER_RTC_OFFSET, header, sizeof(header));
+#endif
+        }
+
+        void _mirror(uint8_t index) {
+#if defined(ESP8266)
+            ESP.rtcUserMemoryWrite(STOMP_RECORDER_RTC_OFFSET + 2 + index * sizeof(Record) / 4,
+                                   (uint32_t *) &_records[index], sizeof(Record));
+            _mirrorHeader();
+#else
+            (void) index;
+#endif
+        }
+    };
+
+}
+
+#endif
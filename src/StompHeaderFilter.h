@@ -0,0 +1,286 @@
+#ifndef STOMP_HEADER_FILTER_H
+#define STOMP_HEADER_FILTER_H
+
+#include "Stomp.h"
+#include "StompCommandParser.h"
+
+// Maximum number of &&-separated clauses in a filter
+#ifndef STOMP_FILTER_MAX_CLAUSES
+#define STOMP_FILTER_MAX_CLAUSES 4
+#endif
+
+// Bytes available for the header names and values of a compiled filter
+#ifndef STOMP_FILTER_SIZE
+#define STOMP_FILTER_SIZE 96
+#endif
+
+namespace Stomp {
+
+/**
+ * A predicate over a MESSAGE's headers, compiled once and evaluated on the raw frame before it is parsed, so that
+ * messages of no interest cost neither header nor body copies.
+ *
+ * Expressions are clauses joined by "&&":
+ *     device-id == 5C:CF:7F:01:02:03
+ *     type in (reading, alarm) && priority != low
+ *     correlation-id exists
+ * Values may be quoted with ' or " if they contain spaces, commas or brackets. "==" and "in" are false when the
+ * header is absent; "!=" is true. Values are written unescaped and compared with the header as decoded, so
+ * "device-id == 5C:CF:7F:01:02:03" matches the header line "device-id:5C\cCF\c7F\c01\c02\c03".
+ */
+    class StompHeaderFilter {
+
+    public:
+        StompHeaderFilter() : _clauseCount(0), _used(0), _rejectWith(ACK), _rejected(0) {
+        }
+
+        explicit StompHeaderFilter(const char *expression) : StompHeaderFilter() {
+            compile(expression);
+        }
+
+        /**
+         * Replace the filter with the given expression
+         * @return bool - false if the expression is malformed or too large, in which case the filter matches nothing
+         */
+        bool compile(const char *expression) {
+            _clauseCount = 0;
+            _used = 0;
+            _valid = _compile(expression);
+            return _valid;
+        }
+
+        bool valid() const {
+            return _valid;
+        }
+
+        /**
+         * What to do with rejected messages: ACK (the default) acknowledges them, CONTINUE leaves them
+         * unacknowledged. In CLIENT mode the ACK is cumulative, so it is sent from the client's loop() for the newest
+         * rejected message, once no earlier message is held by a handler's CONTINUE or a batch.
+         */
+        void setRejected(Stomp_Ack_t rejectWith) {
+            _rejectWith = rejectWith;
+        }
+
+        Stomp_Ack_t rejectWith() const {
+            return _rejectWith;
+        }
+
+        /**
+         * The number of messages rejected so far
+         */
+        uint32_t rejected() const {
+            return _rejected;
+        }
+
+        /**
+         * Evaluate the filter against an unparsed frame. Does not allocate.
+         */
+        bool matches(const String &frame) {
+            if (!_valid) {
+                _rejected++;
+                return false;
+            }
+
+            for (uint8_t c = 0; c < _clauseCount; c++) {
+                if (!_matches(_clauses[c], frame)) {
+                    _rejected++;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        typedef enum {
+            EQUALS,
+            NOT_EQUALS,
+            IN,
+            EXISTS
+        } Op;
+
+        struct Clause {
+            Op op;
+            uint16_t key;     // offsets into _text
+            uint16_t values;
+            uint8_t count;
+        };
+
+        Clause _clauses[STOMP_FILTER_MAX_CLAUSES];
+        char _text[STOMP_FILTER_SIZE];
+        uint8_t _clauseCount;
+        uint16_t _used;
+        bool _valid = false;
+        Stomp_Ack_t _rejectWith;
+        uint32_t _rejected;
+
+        bool _matches(const Clause &clause, const String &frame) const {
+            unsigned int length;
+            const char *value = StompCommandParser::peekHeader(frame, _text + clause.key, &length);
+
+            switch (clause.op) {
+                case EXISTS:
+                    return value != nullptr;
+                case NOT_EQUALS:
+                    return value == nullptr || !_equals(_text + clause.values, value, length);
+                case EQUALS:
+                case IN:
+                default:
+                    if (value == nullptr) {
+                        return false;
+                    }
+                    const char *candidate = _text + clause.values;
+                    for (uint8_t i = 0; i < clause.count; i++) {
+                        if (_equals(candidate, value, length)) {
+                            return true;
+                        }
+                        candidate += strlen(candidate) + 1;
+                    }
+                    return false;
+            }
+        }
+
+        /**
+         * Compare expected with a raw header value, decoding the value's STOMP escapes (\\c for ':', \\n, \\r, \\\\)
+         */
+        static bool _equals(const char *expected, const char *value, unsigned int length) {
+            const char *end = value + length;
+            while (value < end) {
+                char c = *value++;
+                if (c == '\\') {
+                    if (value == end) {
+                        return false;
+                    }
+                    switch (*value++) {
+                        case 'c':
+                            c = ':';
+                            break;
+                        case 'n':
+                            c = '\n';
+                            break;
+                        case 'r':
+                            c = '\r';
+                            break;
+                        case '\\':
+                            c = '\\';
+                            break;
+                        default:
+                            return false;
+                    }
+                }
+                if (*expected++ != c) {
+                    return false;
+                }
+            }
+            return *expected == '\0';
+        }
+
+        static const char *_skipSpace(const char *p) {
+            while (*p == ' ' || *p == '\t') p++;
+            return p;
+        }
+
+        static bool _isDelimiter(char c) {
+            return c == '\0' || c == ' ' || c == '\t' || c == '=' || c == '!' || c == '(' || c == ')' || c == ',' ||
+                   c == '&';
+        }
+
+        /**
+         * Copy the (optionally quoted) token at p into _text
+         * @return const char* - The position after the token, or nullptr on error
+         */
+        const char *_token(const char *p, uint16_t *offset) {
+            p = _skipSpace(p);
+            const char *start = p;
+            const char *end;
+            const char *next;
+
+            if (*p == '\'' || *p == '"') {
+                start = p + 1;
+                end = strchr(start, *p);
+                if (end == nullptr) {
+                    return nullptr;
+                }
+                next = end + 1;
+            } else {
+                while (!_isDelimiter(*p)) p++;
+                end = p;
+                next = p;
+            }
+
+            size_t length = end - start;
+            if (length == 0 || _used + length + 1 > STOMP_FILTER_SIZE) {
+                return nullptr;
+            }
+            *offset = _used;
+            memcpy(_text + _used, start, length);
+            _text[_used + length] = '\0';
+            _used += length + 1;
+            return next;
+        }
+
+        bool _compile(const char *p) {
+            if (p == nullptr) {
+                return false;
+            }
+
+            while (true) {
+                if (_clauseCount >= STOMP_FILTER_MAX_CLAUSES) {
+                    return false;
+                }
+                Clause &clause = _clauses[_clauseCount];
+                clause.count = 1;
+
+                if ((p = _token(p, &clause.key)) == nullptr) {
+                    return false;
+                }
+                p = _skipSpace(p);
+
+                if (strncmp(p, "==", 2) == 0 || strncmp(p, "!=", 2) == 0) {
+                    clause.op = *p == '=' ? EQUALS : NOT_EQUALS;
+                    if ((p = _token(p + 2, &clause.values)) == nullptr) {
+                        return false;
+                    }
+                } else if (strncmp(p, "in", 2) == 0 && _isDelimiter(p[2])) {
+                    clause.op = IN;
+                    clause.count = 0;
+                    p = _skipSpace(p + 2);
+                    if (*p++ != '(') {
+                        return false;
+                    }
+                    do {
+                        uint16_t offset;
+                        if ((p = _token(p, &offset)) == nullptr) {
+                            return false;
+                        }
+                        if (clause.count++ == 0) {
+                            clause.values = offset;
+                        }
+                        p = _skipSpace(p);
+                    } while (*p++ == ',');
+                    if (p[-1] != ')') {
+                        return false;
+                    }
+                } else if (strncmp(p, "exists", 6) == 0 && _isDelimiter(p[6])) {
+                    clause.op = EXISTS;
+                    p += 6;
+                } else {
+                    return false;
+                }
+
+                _clauseCount++;
+                p = _skipSpace(p);
+                if (*p == '\0') {
+                    return true;
+                }
+                if (strncmp(p, "&&", 2) != 0) {
+                    return false;
+                }
+                p += 2;
+            }
+        }
+    };
+
+}
+
+#endif
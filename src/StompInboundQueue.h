@@ -0,0 +1,163 @@
+#ifndef STOMP_INBOUND_QUEUE_H
+#define STOMP_INBOUND_QUEUE_H
+
+#include <Arduino.h>
+
+// Depth of each priority lane
+#ifndef STOMP_INBOUND_QUEUE_DEPTH
+#define STOMP_INBOUND_QUEUE_DEPTH 16
+#endif
+
+// Number of priority lanes. Lane 0 is the lowest priority
+#ifndef STOMP_INBOUND_LANES
+#define STOMP_INBOUND_LANES 3
+#endif
+
+// A waiting lane is served after it has been passed over this many times, whatever its priority
+#ifndef STOMP_LANE_STARVATION_LIMIT
+#define STOMP_LANE_STARVATION_LIMIT 8
+#endif
+
+namespace Stomp {
+
+/**
+ * Fixed-depth FIFO of received frames awaiting dispatch. Frames are moved in and out, so only the Strings'
+ * existing buffers change hands.
+ */
+    class StompFrameQueue {
+
+    public:
+        bool push(String &frame) {
+            if (full()) {
+                return false;
+            }
+            _frames[(_head + _size) % STOMP_INBOUND_QUEUE_DEPTH] = std::move(frame);
+            _size++;
+            return true;
+        }
+
+        bool pop(String &frame) {
+            if (_size == 0) {
+                return false;
+            }
+            frame = std::move(_frames[_head]);
+            _frames[_head] = String();
+            _head = (_head + 1) % STOMP_INBOUND_QUEUE_DEPTH;
+            _size--;
+            return true;
+        }
+
+        bool full() const {
+            return _size == STOMP_INBOUND_QUEUE_DEPTH;
+        }
+
+        void clear() {
+            String frame;
+            while (pop(frame)) {
+            }
+        }
+
+        bool empty() const {
+            return _size == 0;
+        }
+
+        uint16_t size() const {
+            return _size;
+        }
+
+    private:
+        String _frames[STOMP_INBOUND_QUEUE_DEPTH];
+        uint16_t _head = 0;
+        uint16_t _size = 0;
+    };
+
+/**
+ * One StompFrameQueue per priority lane. pop() serves the highest non-empty lane, except that a lane which has been
+ * passed over STOMP_LANE_STARVATION_LIMIT times while waiting is served first.
+ */
+    class StompInboundQueue {
+
+    public:
+        StompInboundQueue() {
+            for (auto &skipped: _skipped) {
+                skipped = 0;
+            }
+        }
+
+        static uint8_t lane(uint8_t priority) {
+            return priority < STOMP_INBOUND_LANES ? priority : STOMP_INBOUND_LANES - 1;
+        }
+
+        bool push(String &frame, uint8_t priority) {
+            return _lanes[lane(priority)].push(frame);
+        }
+
+        bool full(uint8_t priority) const {
+            return _lanes[lane(priority)].full();
+        }
+
+        /**
+         * Remove the oldest frame of one lane, regardless of priority
+         */
+        bool popLane(uint8_t priority, String &frame) {
+            return _lanes[lane(priority)].pop(frame);
+        }
+
+        bool pop(String &frame) {
+            int serve = -1;
+            for (int i = STOMP_INBOUND_LANES - 1; i >= 0; i--) {
+                if (_lanes[i].empty()) continue;
+                if (serve == -1) {
+                    serve = i;
+                }
+                if (_skipped[i] >= STOMP_LANE_STARVATION_LIMIT) {
+                    serve = i;
+                    break;
+                }
+            }
+
+            if (serve == -1) {
+                return false;
+            }
+
+            for (int i = 0; i < STOMP_INBOUND_LANES; i++) {
+                if (i == serve) {
+                    _skipped[i] = 0;
+                } else if (!_lanes[i].empty() && _skipped[i] < STOMP_LANE_STARVATION_LIMIT) {
+                    _skipped[i]++;
+                }
+            }
+
+            return _lanes[serve].pop(frame);
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        /**
+         * Discard every waiting frame
+         */
+        void clear() {
+            for (int i = 0; i < STOMP_INBOUND_LANES; i++) {
+                _lanes[i].clear();
+                _skipped[i] = 0;
+            }
+        }
+
+        uint16_t size() const {
+            uint16_t total = 0;
+            for (const auto &lane: _lanes) {
+                total += lane.size();
+            }
+            return total;
+        }
+
+    private:
+        StompFrameQueue _lanes[STOMP_INBOUND_LANES];
+        uint8_t _skipped[STOMP_INBOUND_LANES];
+    };
+
+}
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef STOMP_JSON_H
+#define STOMP_JSON_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include "Stomp.h"
+
+/**
+ * Describe a struct member decoded from the JSON key of the same name, e.g.
+ *     STOMP_JSON_FIELD(Reading, temperature, Stomp::JSON_FLOAT)
+ */
+#define STOMP_JSON_FIELD(Struct, member, type) \
+    STOMP_JSON_FIELD_KEY(Struct, member, #member, type)
+
+/**
+ * Describe a struct member decoded from the given JSON key
+ */
+#define STOMP_JSON_FIELD_KEY(Struct, member, key, type) \
+    {key, type, (uint16_t) offsetof(Struct, member), (uint16_t) sizeof(((Struct *) nullptr)->member)}
+
+namespace Stomp {
+
+    typedef enum {
+        JSON_INT,     // int8_t .. int64_t, chosen by the member's size
+        JSON_UINT,    // uint8_t .. uint64_t
+        JSON_FLOAT,   // float or double
+        JSON_BOOL,    // bool
+        JSON_STRING   // char[N], NULL terminated; longer strings fail the decode
+    } Stomp_JsonType_t;
+
+    typedef struct {
+        const char *key;
+        Stomp_JsonType_t type;
+        uint16_t offset;
+        uint16_t size;
+    } StompJsonField;
+
+/**
+ * The fields of one message shape. Keys not in the schema, and nested objects and arrays, are skipped.
+ */
+    struct StompJsonSchema {
+        const StompJsonField *fields;
+        uint8_t count;
+
+        template<size_t N>
+        StompJsonSchema(const StompJsonField (&fields)[N]) : fields(fields), count(N) {
+        }
+    };
+
+/**
+ * Decodes a JSON object straight into a struct in a single pass, without allocating.
+ */
+    class StompJsonDecoder {
+
+    public:
+        /**
+         * @param json char*               - The JSON text, e.g. a message body
+         * @param schema StompJsonSchema   - The fields to extract
+         * @param target void*             - The struct to decode into. Fields absent from the JSON (or null) are left
+         *                                   untouched
+         * @param present uint32_t*        - If given, bit i is set when field i (of the first 32) was decoded
+         * @return bool                    - false if the JSON is malformed or a value does not fit its field, in which
+         *                                   case target may be partly written
+         */
+        static bool decode(const char *json, const StompJsonSchema &schema, void *target,
+                           uint32_t *present = nullptr) {
+            if (present) {
+                *present = 0;
+            }
+
+            const char *p = _space(json);
+            if (*p++ != '{') {
+                return false;
+            }
+
+            p = _space(p);
+            if (*p == '}') {
+                return *_space(p + 1) == '\0';
+            }
+
+            while (true) {
+                if (*p != '"') {
+                    return false;
+                }
+                const char *key = p + 1;
+                p = _endOfString(key);
+                if (p == nullptr) {
+                    return false;
+                }
+                int field = _lookup(schema, key, p - key);
+
+                p = _space(p + 1);
+                if (*p++ != ':') {
+                    return false;
+                }
+                p = _space(p);
+
+                if (field == -1 || strncmp(p, "null", 4) == 0) {
+                    p = _skip(p);
+                } else {
+                    p = _value(p, schema.fields[field], (uint8_t *) target);
+                    if (p && present && field < 32) {
+                        *present |= (uint32_t) 1 << field;
+                    }
+                }
+                if (p == nullptr) {
+                    return false;
+                }
+
+                p = _space(p);
+                if (*p == ',') {
+                    p = _space(p + 1);
+                } else if (*p == '}') {
+                    return *_space(p + 1) == '\0';
+                } else {
+                    return false;
+                }
+            }
+        }
+
+    private:
+        static const char *_space(const char *p) {
+            while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+            return p;
+        }
+
+        /**
+         * @return const char* - The closing quote of the string whose contents start at p, or nullptr
+         */
+        static const char *_endOfString(const char *p) {
+            for (; *p; p++) {
+                if (*p == '\\') {
+                    if (*++p == '\0') return nullptr;
+                } else if (*p == '"') {
+                    return p;
+                }
+            }
+            return nullptr;
+        }
+
+        static int _lookup(const StompJsonSchema &schema, const char *key, size_t length) {
+            for (uint8_t i = 0; i < schema.count; i++) {
+                const char *name = schema.fields[i].key;
+                if (strncmp(name, key, length) == 0 && name[length] == '\0') {
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        /**
+         * Skip any value, including nested objects and arrays
+         */
+        static const char *_skip(const char *p) {
+            int depth = 0;
+            do {
+                if (*p == '"') {
+                    p = _endOfString(p + 1);
+                    if (p == nullptr) return nullptr;
+                    p++;
+                } else if (*p == '{' || *p == '[') {
+                    depth++;
+                    p++;
+                } else if (*p == '}' || *p == ']') {
+                    if (--depth < 0) return nullptr;
+                    p++;
+                } else if (*p == '\0') {
+                    return nullptr;
+                } else if (depth > 0) {
+                    p++;
+                } else {
+                    const char *start = p;
+                    while (*p && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' &&
+                           *p != '\n') {
+                        p++;
+                    }
+                    if (p == start) return nullptr;
+                }
+            } while (depth > 0);
+            return p;
+        }
+
+        static const char *_value(const char *p, const StompJsonField &field, uint8_t *target) {
+            void *member = target + field.offset;
+
+            switch (field.type) {
+                case JSON_INT:
+                case JSON_UINT:
+                    return _integer(p, field, member);
+
+                case JSON_FLOAT: {
+                    char *end;
+                    double value = strtod(p, &end);
+                    if (end == p) return nullptr;
+                    if (field.size == sizeof(float)) {
+                        float f = (float) value;
+                        memcpy(member, &f, sizeof(f));
+                    } else if (field.size == sizeof(double)) {
+                        memcpy(member, &value, sizeof(value));
+                    } else {
+                        return nullptr;
+                    }
+                    return end;
+                }
+
+                case JSON_BOOL: {
+                    bool value;
+                    if (strncmp(p, "true", 4) == 0) {
+                        value = true;
+                        p += 4;
+                    } else if (strncmp(p, "false", 5) == 0) {
+                        value = false;
+                        p += 5;
+                    } else {
+                        return nullptr;
+                    }
+                    memcpy(member, &value, sizeof(value));
+                    return p;
+                }
+
+                case JSON_STRING:
+                    return *p == '"' ? _string(p + 1, (char *) member, field.size) : nullptr;
+            }
+            return nullptr;
+        }
+
+        static const char *_integer(const char *p, const StompJsonField &field, void *member) {
+            bool negative = *p == '-';
+            if (negative) {
+                if (field.type == JSON_UINT) return nullptr;
+                p++;
+            }
+
+            uint64_t magnitude = 0;
+            const char *digits = p;
+            for (; *p >= '0' && *p <= '9'; p++) {
+                uint64_t next = magnitude * 10 + (*p - '0');
+                if (next / 10 != magnitude) return nullptr;
+                magnitude = next;
+            }
+            if (p == digits || *p == '.' || *p == 'e' || *p == 'E') {
+                return nullptr;
+            }
+
+            uint8_t bits = field.size * 8;
+            if (bits == 0 || bits > 64) return nullptr;
+            if (field.type == JSON_UINT) {
+                if (bits < 64 && magnitude >> bits) return nullptr;
+            } else {
+                uint64_t limit = ((uint64_t) 1 << (bits - 1)) - (negative ? 0 : 1);
+                if (magnitude > limit) return nullptr;
+            }
+
+            int64_t value = negative ? (int64_t) (0 - magnitude) : (int64_t) magnitude;
+            switch (field.size) {
+                case 1: {
+                    int8_t v = (int8_t) value;
+                    memcpy(member, &v, 1);
+                    break;
+                }
+                case 2: {
+                    int16_t v = (int16_t) value;
+                    memcpy(member, &v, 2);
+                    break;
+                }
+                case 4: {
+                    int32_t v = (int32_t) value;
+                    memcpy(member, &v, 4);
+                    break;
+                }
+                case 8:
+                    memcpy(member, &value, 8);
+                    break;
+                default:
+                    return nullptr;
+            }
+            return p;
+        }
+
+        /**
+         * Unescape the string whose contents start at p into out (capacity bytes, including the terminator)
+         * @return const char* - The position after the closing quote, or nullptr
+         */
+        static const char *_string(const char *p, char *out, uint16_t capacity) {
+            uint16_t n = 0;
+            while (*p != '"') {
+                char c = *p++;
+                uint32_t codepoint = (uint8_t) c;
+
+                if (c == '\0') {
+                    return nullptr;
+                } else if (c == '\\') {
+                    c = *p++;
+                    switch (c) {
+                        case '"':
+                        case '\\':
+                        case '/':
+                            codepoint = c;
+                            break;
+                        case 'b':
+                            codepoint = '\b';
+                            break;
+                        case 'f':
+                            codepoint = '\f';
+                            break;
+                        case 'n':
+                            codepoint = '\n';
+                            break;
+                        case 'r':
+                            codepoint = '\r';
+                            break;
+                        case 't':
+                            codepoint = '\t';
+                            break;
+                        case 'u':
+                            codepoint = 0;
+                            for (uint8_t i = 0; i < 4; i++, p++) {
+                                char h = *p;
+                                uint8_t digit = h >= '0' && h <= '9' ? h - '0' :
+                                                h >= 'a' && h <= 'f' ? h - 'a' + 10 :
+                                                h >= 'A' && h <= 'F' ? h - 'A' + 10 : 16;
+                                if (digit == 16) return nullptr;
+                                codepoint = codepoint << 4 | digit;
+                            }
+                            break;
+                        default:
+                            return nullptr;
+                    }
+                }
+
+                // escaped code points are written as UTF-8; raw bytes are copied as they are
+                uint8_t encoded[3];
+                uint8_t length;
+                if (codepoint < 0x80 || c != 'u') {
+                    encoded[0] = (uint8_t) codepoint;
+                    length = 1;
+                } else if (codepoint < 0x800) {
+                    encoded[0] = 0xC0 | (codepoint >> 6);
+                    encoded[1] = 0x80 | (codepoint & 0x3F);
+                    length = 2;
+                } else {
+                    encoded[0] = 0xE0 | (codepoint >> 12);
+                    encoded[1] = 0x80 | ((codepoint >> 6) & 0x3F);
+                    encoded[2] = 0x80 | (codepoint & 0x3F);
+                    length = 3;
+                }
+
+                if (n + length >= capacity) {
+                    return nullptr;
+                }
+                memcpy(out + n, encoded, length);
+                n += length;
+            }
+            out[n] = '\0';
+            return p + 1;
+        }
+    };
+
+}
+
+#endif
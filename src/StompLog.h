@@ -0,0 +1,200 @@
+#ifndef STOMP_LOG_H
+#define STOMP_LOG_H
+
+#include <Arduino.h>
+
+#define STOMP_LOG_LEVEL_NONE 0
+#define STOMP_LOG_LEVEL_ERROR 1
+#define STOMP_LOG_LEVEL_WARN 2
+#define STOMP_LOG_LEVEL_INFO 3
+#define STOMP_LOG_LEVEL_DEBUG 4
+#define STOMP_LOG_LEVEL_TRACE 5  // every frame sent and received
+
+// Messages above this level are compiled out entirely
+#ifndef STOMP_LOG_LEVEL
+#define STOMP_LOG_LEVEL STOMP_LOG_LEVEL_WARN
+#endif
+
+// Size of the buffer used by StompLogRing
+#ifndef STOMP_LOG_RING_SIZE
+#define STOMP_LOG_RING_SIZE 512
+#endif
+
+#if STOMP_LOG_LEVEL >= STOMP_LOG_LEVEL_ERROR
+#define STOMP_LOG_ERROR(...) Stomp::StompLog::log("E ", __VA_ARGS__)
+#else
+#define STOMP_LOG_ERROR(...) do {} while (0)
+#endif
+
+#if STOMP_LOG_LEVEL >= STOMP_LOG_LEVEL_WARN
+#define STOMP_LOG_WARN(...) Stomp::StompLog::log("W ", __VA_ARGS__)
+#else
+#define STOMP_LOG_WARN(...) do {} while (0)
+#endif
+
+#if STOMP_LOG_LEVEL >= STOMP_LOG_LEVEL_INFO
+#define STOMP_LOG_INFO(...) Stomp::StompLog::log("I ", __VA_ARGS__)
+#else
+#define STOMP_LOG_INFO(...) do {} while (0)
+#endif
+
+#if STOMP_LOG_LEVEL >= STOMP_LOG_LEVEL_DEBUG
+#define STOMP_LOG_DEBUG(...) Stomp::StompLog::log("D ", __VA_ARGS__)
+#else
+#define STOMP_LOG_DEBUG(...) do {} while (0)
+#endif
+
+#if STOMP_LOG_LEVEL >= STOMP_LOG_LEVEL_TRACE
+#define STOMP_LOG_TRACE(...) Stomp::StompLog::log("T ", __VA_ARGS__)
+#else
+#define STOMP_LOG_TRACE(...) do {} while (0)
+#endif
+
+namespace Stomp {
+
+    class StompLogRing;
+
+/**
+ * Where the STOMP_LOG_* macros write. Messages are a prefix followed by the arguments, each printed with Print::print,
+ * on one line. Levels above STOMP_LOG_LEVEL cost nothing: neither the call nor its arguments are compiled.
+ */
+    class StompLog {
+
+    public:
+        /**
+         * Send log output to sink (Serial by default), or nowhere if nullptr
+         */
+        static void setSink(Print *sink) {
+            _sink() = sink;
+            _ring() = nullptr;
+        }
+
+        /**
+         * Buffer log output in ring, to be drained when the client is idle
+         */
+        static void setSink(StompLogRing *ring);
+
+        /**
+         * Copy what the ring sink (if any) holds to its output, as far as that will not block
+         */
+        static void drain();
+
+        static Print *sink() {
+            return _sink();
+        }
+
+        template<typename... Args>
+        static void log(const char *prefix, const Args &... args) {
+            Print *out = _sink();
+            if (out == nullptr) {
+                return;
+            }
+            out->print(prefix);
+            _print(out, args...);
+            out->println();
+        }
+
+    private:
+        static Print *&_sink() {
+            static Print *sink = &Serial;
+            return sink;
+        }
+
+        static StompLogRing *&_ring() {
+            static StompLogRing *ring = nullptr;
+            return ring;
+        }
+
+        static void _print(Print *) {
+        }
+
+        template<typename T, typename... Rest>
+        static void _print(Print *out, const T &first, const Rest &... rest) {
+            out->print(first);
+            _print(out, rest...);
+        }
+    };
+
+/**
+ * A log sink that never blocks: output is kept in a ring of STOMP_LOG_RING_SIZE bytes (the newest bytes are dropped
+ * when it is full) and copied to the real output by drain(), which StompClient::loop() calls when it has nothing else
+ * to do. Only as much is copied as the output can take without blocking.
+ */
+    class StompLogRing : public Print {
+
+    public:
+        explicit StompLogRing(Print &out) : _out(out), _head(0), _size(0), _dropped(0) {
+        }
+
+        using Print::write;
+
+        size_t write(uint8_t c) override {
+            return write(&c, 1);
+        }
+
+        size_t write(const uint8_t *buffer, size_t size) override {
+            size_t n = 0;
+            for (; n < size && _size < STOMP_LOG_RING_SIZE; n++) {
+                _buffer[(_head + _size) % STOMP_LOG_RING_SIZE] = buffer[n];
+                _size++;
+            }
+            _dropped += size - n;
+            return n;
+        }
+
+        /**
+         * Copy buffered output to the real output
+         * @return size_t - The number of bytes copied
+         */
+        size_t drain() {
+            int available = _out.availableForWrite();
+            size_t room = available > 0 ? (size_t) available : 0;
+            size_t n = 0;
+            while (_size > 0 && n < room) {
+                size_t chunk = STOMP_LOG_RING_SIZE - _head;
+                if (chunk > _size) chunk = _size;
+                if (chunk > room - n) chunk = room - n;
+                _out.write(_buffer + _head, chunk);
+                _head = (_head + chunk) % STOMP_LOG_RING_SIZE;
+                _size -= chunk;
+                n += chunk;
+            }
+            return n;
+        }
+
+        /**
+         * Bytes waiting to be drained
+         */
+        size_t pending() const {
+            return _size;
+        }
+
+        /**
+         * Bytes lost because the ring was full
+         */
+        uint32_t dropped() const {
+            return _dropped;
+        }
+
+    private:
+        Print &_out;
+        uint8_t _buffer[STOMP_LOG_RING_SIZE];
+        uint16_t _head;
+        uint16_t _size;
+        uint32_t _dropped;
+    };
+
+    inline void StompLog::setSink(StompLogRing *ring) {
+        _sink() = ring;
+        _ring() = ring;
+    }
+
+    inline void StompLog::drain() {
+        if (_ring()) {
+            _ring()->drain();
+        }
+    }
+
+}
+
+#endif
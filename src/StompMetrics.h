@@ -0,0 +1,232 @@
+#ifndef STOMP_METRICS_H
+#define STOMP_METRICS_H
+
+#include <Arduino.h>
+
+// Buckets per histogram: bucket 0 holds 0, bucket i holds [2^(i-1), 2^i), the last bucket everything above
+#ifndef STOMP_HISTOGRAM_BUCKETS
+#define STOMP_HISTOGRAM_BUCKETS 20
+#endif
+
+// The number of outstanding receipts whose round trip is being timed
+#ifndef STOMP_METRICS_RECEIPTS
+#define STOMP_METRICS_RECEIPTS 8
+#endif
+
+namespace Stomp {
+
+/**
+ * Fixed-memory histogram with power-of-two buckets. Percentiles are reported as the upper bound of their bucket, so
+ * they are accurate to within a factor of two.
+ */
+    class StompHistogram {
+
+    public:
+        StompHistogram() {
+            reset();
+        }
+
+        void record(uint32_t value) {
+            uint8_t bucket = 0;
+            for (uint32_t v = value; v != 0 && bucket < STOMP_HISTOGRAM_BUCKETS - 1; v >>= 1) {
+                bucket++;
+            }
+            _buckets[bucket]++;
+            _count++;
+            _sum += value;
+            if (value > _max) _max = value;
+            if (value < _min) _min = value;
+        }
+
+        uint32_t count() const {
+            return _count;
+        }
+
+        uint32_t min() const {
+            return _count ? _min : 0;
+        }
+
+        uint32_t max() const {
+            return _max;
+        }
+
+        uint32_t mean() const {
+            return _count ? (uint32_t) (_sum / _count) : 0;
+        }
+
+        /**
+         * @param percent uint8_t - 0..100
+         * @return uint32_t       - A value at least as large as that percentile of the recorded values
+         */
+        uint32_t percentile(uint8_t percent) const {
+            if (_count == 0) {
+                return 0;
+            }
+
+            uint32_t rank = (uint32_t) (((uint64_t) _count * percent + 99) / 100);
+            if (rank == 0) rank = 1;
+            uint32_t seen = 0;
+            for (uint8_t i = 0; i < STOMP_HISTOGRAM_BUCKETS; i++) {
+                seen += _buckets[i];
+                if (seen >= rank) {
+                    uint32_t upper = i == 0 ? 0 : (i >= 32 ? 0xFFFFFFFF : (uint32_t) ((1ULL << i) - 1));
+                    return upper < _max ? upper : _max;
+                }
+            }
+            return _max;
+        }
+
+        uint32_t bucket(uint8_t index) const {
+            return index < STOMP_HISTOGRAM_BUCKETS ? _buckets[index] : 0;
+        }
+
+        void reset() {
+            for (auto &bucket: _buckets) {
+                bucket = 0;
+            }
+            _count = 0;
+            _sum = 0;
+            _min = 0xFFFFFFFF;
+            _max = 0;
+        }
+
+        /**
+         * Append {"n":..,"p50":..,"p99":..,"max":..}
+         */
+        void toJson(String &out) const {
+            out += "{\"n\":";
+            out += String(_count);
+            out += ",\"p50\":";
+            out += String(percentile(50));
+            out += ",\"p99\":";
+            out += String(percentile(99));
+            out += ",\"max\":";
+            out += String(_max);
+            out += "}";
+        }
+
+    private:
+        uint32_t _buckets[STOMP_HISTOGRAM_BUCKETS];
+        uint32_t _count;
+        uint64_t _sum;
+        uint32_t _min;
+        uint32_t _max;
+    };
+
+/**
+ * What the client has done since it was created (or the metrics were last reset)
+ */
+    struct StompMetrics {
+        uint32_t framesIn = 0;
+        uint32_t framesOut = 0;
+        uint32_t bytesIn = 0;
+        uint32_t bytesOut = 0;
+        uint32_t sendFailures = 0;
+        uint32_t messages = 0;
+        uint32_t acks = 0;
+        uint32_t nacks = 0;
+        uint32_t errors = 0;
+        uint32_t connects = 0;
+        uint32_t heartbeatsIn = 0;
+        uint32_t heartbeatMisses = 0;
+
+        StompHistogram parseMicros;     // raw frame -> StompCommand
+        StompHistogram dispatchMicros;  // handling a parsed frame, including the message handler
+        StompHistogram sendMicros;      // handing a frame to the socket
+        StompHistogram frameSizeIn;     // bytes of each frame received, heart-beats included
+        StompHistogram frameSizeOut;    // bytes of each frame the socket accepted
+        StompHistogram receiptMillis;   // round trip of frames sent with a receipt header
+
+        void reset() {
+            *this = StompMetrics();
+        }
+
+        /**
+         * Write a compact JSON snapshot to out
+         */
+        void toJson(String &out) const {
+            out = "{\"in\":";
+            out += String(framesIn);
+            out += ",\"out\":";
+            out += String(framesOut);
+            out += ",\"bytesIn\":";
+            out += String(bytesIn);
+            out += ",\"bytesOut\":";
+            out += String(bytesOut);
+            out += ",\"sendFail\":";
+            out += String(sendFailures);
+            out += ",\"msgs\":";
+            out += String(messages);
+            out += ",\"acks\":";
+            out += String(acks);
+            out += ",\"nacks\":";
+            out += String(nacks);
+            out += ",\"errors\":";
+            out += String(errors);
+            out += ",\"connects\":";
+            out += String(connects);
+            out += ",\"hbIn\":";
+            out += String(heartbeatsIn);
+            out += ",\"hbMiss\":";
+            out += String(heartbeatMisses);
+            out += ",\"parseUs\":";
+            parseMicros.toJson(out);
+            out += ",\"dispatchUs\":";
+            dispatchMicros.toJson(out);
+            out += ",\"sendUs\":";
+            sendMicros.toJson(out);
+            out += ",\"sizeIn\":";
+            frameSizeIn.toJson(out);
+            out += ",\"sizeOut\":";
+            frameSizeOut.toJson(out);
+            out += ",\"receiptMs\":";
+            receiptMillis.toJson(out);
+            out += "}";
+        }
+    };
+
+/**
+ * Times receipts: remembers when each receipt id was sent, matched when the RECEIPT arrives
+ */
+    class StompReceiptTimer {
+
+    public:
+        StompReceiptTimer() : _next(0) {
+            for (auto &pending: _pending) {
+                pending.id = 0;
+            }
+        }
+
+        void sent(uint32_t id, unsigned long now) {
+            _pending[_next].id = id;
+            _pending[_next].sentAt = now;
+            _next = (_next + 1) % STOMP_METRICS_RECEIPTS;
+        }
+
+        /**
+         * @return bool - true, with the round trip in rtt, if the receipt id was being timed
+         */
+        bool received(uint32_t id, unsigned long now, unsigned long *rtt) {
+            for (auto &pending: _pending) {
+                if (pending.id == id && id != 0) {
+                    *rtt = now - pending.sentAt;
+                    pending.id = 0;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        struct Pending {
+            uint32_t id;
+            unsigned long sentAt;
+        };
+
+        Pending _pending[STOMP_METRICS_RECEIPTS];
+        uint8_t _next;
+    };
+
+}
+
+#endif
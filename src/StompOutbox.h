@@ -0,0 +1,234 @@
+#ifndef STOMP_OUTBOX_H
+#define STOMP_OUTBOX_H
+
+#include <Arduino.h>
+
+#ifndef STOMP_OUTBOX_RAM_SIZE
+#define STOMP_OUTBOX_RAM_SIZE 2048
+#endif
+
+namespace Stomp {
+
+/**
+ * Metadata stored in front of every queued frame.
+ * The epoch identifies the session (boot) which queued the frame: persistent backends start a new epoch each time
+ * they are opened, so frames with a TTL left over from a previous boot are treated as expired.
+ */
+    typedef struct {
+        uint32_t queuedAt;
+        uint32_t ttl;
+        uint16_t epoch;
+        uint16_t length;
+    } StompOutboxRecord;
+
+/**
+ * Storage for outbound frames which could not be sent, replayed in order once the connection is back.
+ * Implementations only store and return bytes; expiry is decided by expired().
+ */
+    class StompOutbox {
+
+    public:
+        virtual ~StompOutbox() = default;
+
+        /**
+         * Append a serialised frame
+         * @param frame String      - The complete frame, without NULL terminator
+         * @param ttl unsigned long - Milliseconds after which the frame is dropped rather than sent, 0 for never
+         * @return bool             - false if there is no room for the frame
+         */
+        virtual bool push(const String &frame, unsigned long ttl) = 0;
+
+        /**
+         * Read the oldest frame without removing it
+         * @return bool - false if the outbox is empty
+         */
+        virtual bool peek(String &frame, StompOutboxRecord &record) = 0;
+
+        /**
+         * Remove the oldest frame
+         */
+        virtual void pop() = 0;
+
+        /**
+         * The number of frames waiting
+         */
+        virtual uint32_t size() = 0;
+
+        /**
+         * True if the frame described by record should be dropped
+         */
+        bool expired(const StompOutboxRecord &record) const {
+            if (record.ttl == 0) return false;
+            if (record.epoch != _epoch) return true;
+            return millis() - record.queuedAt >= record.ttl;
+        }
+
+    protected:
+        uint16_t _epoch = 0;
+
+        StompOutboxRecord _record(const String &frame, unsigned long ttl) const {
+            StompOutboxRecord record;
+            record.queuedAt = millis();
+            record.ttl = ttl;
+            record.epoch = _epoch;
+            record.length = frame.length();
+            return record;
+        }
+    };
+
+/**
+ * A ring buffer of length-prefixed records laid out in a caller supplied block of memory.
+ * The ring's indices live at the start of the block, so a block which persists (e.g. a mapped file) persists the
+ * queue as well.
+ */
+    class StompRingOutbox : public StompOutbox {
+
+    public:
+        bool push(const String &frame, unsigned long ttl) override {
+            if (frame.length() >= WRAP) return false;
+
+            uint32_t needed = sizeof(StompOutboxRecord) + frame.length();
+            uint32_t capacity = _capacity();
+
+            if (_ring->count == 0) {
+                _ring->head = 0;
+                _ring->tail = 0;
+            }
+
+            uint32_t at;
+            if (_ring->count > 0 && _ring->tail == _ring->head) {
+                return false;
+            } else if (_ring->tail >= _ring->head) {
+                if (capacity - _ring->tail >= needed) {
+                    at = _ring->tail;
+                } else if (_ring->head >= needed) {
+                    // Not enough room before the end: mark the rest as unused and wrap around
+                    if (capacity - _ring->tail >= sizeof(StompOutboxRecord)) {
+                        StompOutboxRecord marker = {0, 0, 0, WRAP};
+                        memcpy(_data() + _ring->tail, &marker, sizeof(marker));
+                    }
+                    at = 0;
+                } else {
+                    return false;
+                }
+            } else if (_ring->head - _ring->tail >= needed) {
+                at = _ring->tail;
+            } else {
+                return false;
+            }
+
+            StompOutboxRecord record = _record(frame, ttl);
+            memcpy(_data() + at, &record, sizeof(record));
+            memcpy(_data() + at + sizeof(record), frame.c_str(), frame.length());
+            _ring->tail = at + needed;
+            _ring->count++;
+            _written();
+            return true;
+        }
+
+        bool peek(String &frame, StompOutboxRecord &record) override {
+            if (_ring->count == 0) return false;
+
+            uint32_t at = _headRecord(record);
+            frame = String((const char *) _data() + at + sizeof(record), record.length);
+            return true;
+        }
+
+        void pop() override {
+            if (_ring->count == 0) return;
+
+            StompOutboxRecord record;
+            uint32_t at = _headRecord(record);
+            _ring->head = at + sizeof(record) + record.length;
+            _ring->count--;
+            if (_ring->count == 0) {
+                _ring->head = 0;
+                _ring->tail = 0;
+            }
+            _written();
+        }
+
+        uint32_t size() override {
+            return _ring->count;
+        }
+
+    protected:
+        static const uint16_t WRAP = 0xFFFF;
+        static const uint32_t MAGIC = 0x53544f42; // "STOB"
+
+        typedef struct {
+            uint32_t magic;
+            uint32_t head;
+            uint32_t tail;
+            uint32_t count;
+            uint16_t epoch;
+            uint16_t reserved;
+            uint32_t size;
+        } RingHeader;
+
+        RingHeader *_ring = nullptr;
+
+        /**
+         * Attach the ring to a block of memory. An existing ring of the same size is kept (starting a new epoch),
+         * anything else is reset.
+         */
+        void _attach(uint8_t *block, uint32_t size) {
+            _ring = (RingHeader *) block;
+            if (_ring->magic != MAGIC || _ring->size != size || _ring->head >= size || _ring->tail > size) {
+                memset(_ring, 0, sizeof(RingHeader));
+                _ring->magic = MAGIC;
+                _ring->size = size;
+            }
+            _ring->epoch++;
+            _epoch = _ring->epoch;
+        }
+
+        /**
+         * Called after every change to the ring
+         */
+        virtual void _written() {}
+
+    private:
+        uint8_t *_data() {
+            return (uint8_t *) _ring + sizeof(RingHeader);
+        }
+
+        uint32_t _capacity() {
+            return _ring->size - sizeof(RingHeader);
+        }
+
+        /**
+         * Locate the oldest record, skipping a wrap marker or a tail too short to hold one
+         */
+        uint32_t _headRecord(StompOutboxRecord &record) {
+            uint32_t at = _ring->head;
+            if (_capacity() - at < sizeof(StompOutboxRecord)) {
+                at = 0;
+            } else {
+                memcpy(&record, _data() + at, sizeof(record));
+                if (record.length != WRAP) return at;
+                at = 0;
+            }
+            memcpy(&record, _data() + at, sizeof(record));
+            return at;
+        }
+    };
+
+/**
+ * Outbox held in a static RAM buffer of STOMP_OUTBOX_RAM_SIZE bytes. Contents are lost on reset.
+ */
+    class StompRamOutbox : public StompRingOutbox {
+
+    public:
+        StompRamOutbox() {
+            memset(_block, 0, sizeof(_block));
+            _attach((uint8_t *) _block, sizeof(_block));
+        }
+
+    private:
+        uint32_t _block[STOMP_OUTBOX_RAM_SIZE / sizeof(uint32_t)];
+    };
+
+}
+
+#endif
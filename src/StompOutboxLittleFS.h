@@ -0,0 +1,202 @@
+#ifndef STOMP_OUTBOX_LITTLEFS_H
+#define STOMP_OUTBOX_LITTLEFS_H
+
+#include "StompOutbox.h"
+#include <LittleFS.h>
+
+namespace Stomp {
+
+/**
+ * Outbox kept in a LittleFS file so that queued frames survive a reset or deep sleep.
+ * Frames are appended to <path>; the read position and epoch are kept in <path>.idx. Both files are removed once
+ * the queue has been drained. When an append would take the file past maxBytes while frames already replayed are
+ * still at its start, the unread frames are first copied to the front of a new file (via <path>.tmp), so only frames
+ * still waiting count against the limit. A reset during that copy can at worst replay frames already sent.
+ * LittleFS.begin() must have been called before the outbox is used.
+ */
+    class StompLittleFSOutbox : public StompOutbox {
+
+    public:
+        /**
+         * @param path const char*  - The data file to use
+         * @param maxBytes uint32_t - Upper limit on the data file size
+         */
+        StompLittleFSOutbox(const char *path, uint32_t maxBytes) : _path(path), _indexPath(String(path) + ".idx"),
+                                                                   _tempPath(String(path) + ".tmp"),
+                                                                   _maxBytes(maxBytes) {
+        }
+
+        bool push(const String &frame, unsigned long ttl) override {
+            _load();
+            if (frame.length() >= 0xFFFF) return false;
+
+            uint32_t needed = sizeof(StompOutboxRecord) + frame.length();
+            File f = LittleFS.open(_path, "a");
+            if (!f) return false;
+
+            if (f.size() - _head + needed > _maxBytes) {
+                f.close();
+                return false;
+            }
+            if (f.size() + needed > _maxBytes) {
+                f.close();
+                if (!_compact()) return false;
+                f = LittleFS.open(_path, "a");
+                if (!f) return false;
+            }
+
+            StompOutboxRecord record = _record(frame, ttl);
+            bool ok = f.write((const uint8_t *) &record, sizeof(record)) == sizeof(record) &&
+                      f.write((const uint8_t *) frame.c_str(), frame.length()) == frame.length();
+            f.close();
+
+            if (ok) _count++;
+            return ok;
+        }
+
+        bool peek(String &frame, StompOutboxRecord &record) override {
+            _load();
+            if (_count == 0) return false;
+
+            File f = LittleFS.open(_path, "r");
+            if (!f) return false;
+
+            bool ok = f.seek(_head, SeekSet) && f.read((uint8_t *) &record, sizeof(record)) == sizeof(record);
+            if (ok) {
+                frame = "";
+                frame.reserve(record.length);
+                char buf[64];
+                uint32_t remaining = record.length;
+                while (ok && remaining > 0) {
+                    size_t chunk = remaining < sizeof(buf) ? remaining : sizeof(buf);
+                    ok = f.read((uint8_t *) buf, chunk) == chunk;
+                    frame.concat(buf, chunk);
+                    remaining -= chunk;
+                }
+            }
+            f.close();
+            return ok;
+        }
+
+        void pop() override {
+            _load();
+            if (_count == 0) return;
+
+            StompOutboxRecord record;
+            File f = LittleFS.open(_path, "r");
+            if (!f) return;
+            bool ok = f.seek(_head, SeekSet) && f.read((uint8_t *) &record, sizeof(record)) == sizeof(record);
+            f.close();
+            if (!ok) return;
+
+            _head += sizeof(record) + record.length;
+            _count--;
+
+            if (_count == 0) {
+                LittleFS.remove(_path);
+                _head = 0;
+            }
+            _saveIndex();
+        }
+
+        uint32_t size() override {
+            _load();
+            return _count;
+        }
+
+    private:
+        typedef struct {
+            uint32_t head;
+            uint16_t epoch;
+            uint16_t reserved;
+        } Index;
+
+        String _path;
+        String _indexPath;
+        String _tempPath;
+        uint32_t _maxBytes;
+
+        bool _loaded = false;
+        uint32_t _head = 0;
+        uint32_t _count = 0;
+
+        /**
+         * On first use read the index, start a new epoch and count the frames still queued
+         */
+        void _load() {
+            if (_loaded) return;
+            _loaded = true;
+
+            Index index = {0, 0, 0};
+            File idx = LittleFS.open(_indexPath, "r");
+            if (idx) {
+                if (idx.read((uint8_t *) &index, sizeof(index)) != sizeof(index)) {
+                    index.head = 0;
+                }
+                idx.close();
+            }
+            _head = index.head;
+            _epoch = index.epoch + 1;
+
+            // a reset part way through _compact() can leave the unread frames only in the temporary file
+            if (!LittleFS.exists(_path) && LittleFS.exists(_tempPath)) {
+                LittleFS.rename(_tempPath, _path);
+            }
+
+            File f = LittleFS.open(_path, "r");
+            if (f) {
+                uint32_t at = _head;
+                StompOutboxRecord record;
+                while (f.seek(at, SeekSet) && f.read((uint8_t *) &record, sizeof(record)) == sizeof(record)) {
+                    at += sizeof(record) + record.length;
+                    if (at > f.size()) break;
+                    _count++;
+                }
+                f.close();
+            }
+            if (_count == 0) {
+                LittleFS.remove(_path);
+                _head = 0;
+            }
+            _saveIndex();
+        }
+
+        /**
+         * Drop the frames already replayed from the start of the data file
+         */
+        bool _compact() {
+            File from = LittleFS.open(_path, "r");
+            File to = LittleFS.open(_tempPath, "w");
+            bool ok = from && to && from.seek(_head, SeekSet);
+            uint8_t buf[64];
+            while (ok && from.position() < from.size()) {
+                size_t chunk = from.read(buf, sizeof(buf));
+                ok = chunk > 0 && to.write(buf, chunk) == chunk;
+            }
+            if (from) from.close();
+            if (to) to.close();
+            if (!ok) {
+                LittleFS.remove(_tempPath);
+                return false;
+            }
+
+            // index first: if the reset comes before the rename, the old file is replayed from its start
+            _head = 0;
+            _saveIndex();
+            LittleFS.remove(_path);
+            return LittleFS.rename(_tempPath, _path);
+        }
+
+        void _saveIndex() {
+            Index index = {_head, _epoch, 0};
+            File idx = LittleFS.open(_indexPath, "w");
+            if (idx) {
+                idx.write((const uint8_t *) &index, sizeof(index));
+                idx.close();
+            }
+        }
+    };
+
+}
+
+#endif
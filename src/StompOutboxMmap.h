@@ -0,0 +1,96 @@
+#ifndef STOMP_OUTBOX_MMAP_H
+#define STOMP_OUTBOX_MMAP_H
+
+#if defined(__linux__)
+
+#include "StompOutbox.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace Stomp {
+
+/**
+ * Outbox kept in a memory-mapped file, for Linux gateway builds.
+ * The ring lives directly in the shared mapping, so queued frames survive a restart of the process.
+ */
+    class StompMmapOutbox : public StompRingOutbox {
+
+    public:
+        /**
+         * @param path const char* - The file to use. Created if it does not exist
+         * @param size uint32_t    - The size of the file in bytes, including the ring's bookkeeping
+         */
+        StompMmapOutbox(const char *path, uint32_t size) : _size(size) {
+            _fd = open(path, O_RDWR | O_CREAT, 0644);
+            if (_fd < 0) return;
+
+            if (ftruncate(_fd, size) != 0) {
+                _close();
+                return;
+            }
+
+            void *block = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+            if (block == MAP_FAILED) {
+                _close();
+                return;
+            }
+
+            _block = (uint8_t *) block;
+            _attach(_block, size);
+        }
+
+        ~StompMmapOutbox() override {
+            if (_block) {
+                msync(_block, _size, MS_SYNC);
+                munmap(_block, _size);
+            }
+            _close();
+        }
+
+        /**
+         * False if the file could not be opened or mapped
+         */
+        bool isOpen() const {
+            return _block != nullptr;
+        }
+
+        bool push(const String &frame, unsigned long ttl) override {
+            return isOpen() && StompRingOutbox::push(frame, ttl);
+        }
+
+        bool peek(String &frame, StompOutboxRecord &record) override {
+            return isOpen() && StompRingOutbox::peek(frame, record);
+        }
+
+        void pop() override {
+            if (isOpen()) StompRingOutbox::pop();
+        }
+
+        uint32_t size() override {
+            return isOpen() ? StompRingOutbox::size() : 0;
+        }
+
+    protected:
+        void _written() override {
+            msync(_block, _size, MS_ASYNC);
+        }
+
+    private:
+        uint32_t _size;
+        int _fd = -1;
+        uint8_t *_block = nullptr;
+
+        void _close() {
+            if (_fd >= 0) {
+                close(_fd);
+                _fd = -1;
+            }
+        }
+    };
+
+}
+
+#endif
+
+#endif
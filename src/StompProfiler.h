@@ -0,0 +1,203 @@
+#ifndef STOMP_PROFILER_H
+#define STOMP_PROFILER_H
+
+#include <Arduino.h>
+
+/**
+ * Phase profiling of StompClient::loop(). Define STOMP_PROFILING to enable it; otherwise the STOMP_PROFILE() points
+ * compile to nothing.
+ *
+ * The clock can be replaced by defining STOMP_PROFILE_CLOCK() (returning STOMP_PROFILE_TICKS) and STOMP_PROFILE_UNIT.
+ * The defaults are the CPU cycle counter on the ESP8266/ESP32, CLOCK_MONOTONIC in ns on Linux and macOS (or the TSC
+ * with STOMP_PROFILE_RDTSC on x86), and micros() elsewhere.
+ */
+#ifndef STOMP_PROFILE_CLOCK
+#if defined(ESP8266) || defined(ESP32)
+#define STOMP_PROFILE_CLOCK() ESP.getCycleCount()
+#define STOMP_PROFILE_TICKS uint32_t
+#define STOMP_PROFILE_UNIT "cycles"
+#elif defined(STOMP_PROFILE_RDTSC) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define STOMP_PROFILE_CLOCK() __rdtsc()
+#define STOMP_PROFILE_TICKS uint64_t
+#define STOMP_PROFILE_UNIT "tsc"
+#elif defined(__linux__) || defined(__APPLE__)
+#include <time.h>
+#define STOMP_PROFILE_CLOCK() Stomp::StompProfiler::monotonicNanos()
+#define STOMP_PROFILE_TICKS uint64_t
+#define STOMP_PROFILE_UNIT "ns"
+#else
+#define STOMP_PROFILE_CLOCK() micros()
+#define STOMP_PROFILE_TICKS unsigned long
+#define STOMP_PROFILE_UNIT "us"
+#endif
+#endif
+
+#ifndef STOMP_PROFILE_TICKS
+#define STOMP_PROFILE_TICKS uint32_t
+#endif
+
+#ifndef STOMP_PROFILE_UNIT
+#define STOMP_PROFILE_UNIT "ticks"
+#endif
+
+#define STOMP_PROFILE_CONCAT_(a, b) a##b
+#define STOMP_PROFILE_CONCAT(a, b) STOMP_PROFILE_CONCAT_(a, b)
+
+#ifdef STOMP_PROFILING
+#define STOMP_PROFILE(phase) \
+    Stomp::StompProfileScope STOMP_PROFILE_CONCAT(_stompProfile, __LINE__)(Stomp::StompProfiler::instance(), phase)
+#else
+#define STOMP_PROFILE(phase) do {} while (0)
+#endif
+
+namespace Stomp {
+
+    typedef enum {
+        PHASE_LOOP,       // loop() itself, outside the phases below
+        PHASE_SOCKET,     // WebSocketsClient::loop(): socket reads, TLS, framing
+        PHASE_PARSE,      // raw frame -> StompCommand, including header filters
+        PHASE_DISPATCH,   // routing a parsed frame, acknowledgements, client bookkeeping
+        PHASE_HANDLER,    // user message handlers
+        PHASE_SEND,       // handing frames to the socket
+        PHASE_TIMERS,     // StompTimers handlers
+        PHASE_OUTBOX,     // outbox replay
+        PHASE_HEARTBEAT,  // heart-beat checks
+        PHASE_COUNT
+    } Stomp_Phase_t;
+
+/**
+ * Accumulates exclusive time per phase: entering a phase pauses the enclosing one, so nested phases (a handler
+ * called from inside the socket's callback, a send from inside a handler) are not counted twice.
+ */
+    class StompProfiler {
+
+    public:
+        static StompProfiler &instance() {
+            static StompProfiler profiler;
+            return profiler;
+        }
+
+        static uint64_t monotonicNanos() {
+#if defined(__linux__) || defined(__APPLE__)
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+#else
+            return (uint64_t) micros() * 1000;
+#endif
+        }
+
+        /**
+         * Start timing phase
+         * @return Stomp_Phase_t - The phase that was running, to be passed to leave()
+         */
+        Stomp_Phase_t enter(Stomp_Phase_t phase) {
+            STOMP_PROFILE_TICKS now = STOMP_PROFILE_CLOCK();
+            Stomp_Phase_t previous = _current;
+            if (_depth++ > 0) {
+                _ticks[_current] += (STOMP_PROFILE_TICKS) (now - _since);
+            }
+            _calls[phase]++;
+            _current = phase;
+            _since = now;
+            return previous;
+        }
+
+        void leave(Stomp_Phase_t previous) {
+            STOMP_PROFILE_TICKS now = STOMP_PROFILE_CLOCK();
+            _ticks[_current] += (STOMP_PROFILE_TICKS) (now - _since);
+            _depth--;
+            _current = previous;
+            _since = now;
+        }
+
+        /**
+         * Time spent in phase, in STOMP_PROFILE_UNIT
+         */
+        uint64_t ticks(Stomp_Phase_t phase) const {
+            return _ticks[phase];
+        }
+
+        /**
+         * The number of times phase was entered
+         */
+        uint32_t calls(Stomp_Phase_t phase) const {
+            return _calls[phase];
+        }
+
+        uint64_t totalTicks() const {
+            uint64_t total = 0;
+            for (auto ticks: _ticks) {
+                total += ticks;
+            }
+            return total;
+        }
+
+        static const char *name(Stomp_Phase_t phase) {
+            static const char *const names[] = {"loop", "socket", "parse", "dispatch", "handler", "send", "timers",
+                                                "outbox", "heartbeat"};
+            return phase < PHASE_COUNT ? names[phase] : "?";
+        }
+
+        void reset() {
+            for (uint8_t i = 0; i < PHASE_COUNT; i++) {
+                _ticks[i] = 0;
+                _calls[i] = 0;
+            }
+        }
+
+        /**
+         * Print a table of phases: calls, total time, share of the total and mean time per call
+         */
+        void report(Print &out) const {
+            uint64_t total = totalTicks();
+            char line[80];
+            snprintf(line, sizeof(line), "%-10s %10s %14s %6s %12s", "phase", "calls", "total " STOMP_PROFILE_UNIT, "%",
+                     "mean");
+            out.println(line);
+            for (uint8_t i = 0; i < PHASE_COUNT; i++) {
+                uint64_t ticks = _ticks[i];
+                unsigned long share = total ? (unsigned long) (ticks * 1000 / total) : 0;
+                snprintf(line, sizeof(line), "%-10s %10lu %14llu %4lu.%lu %12llu", name((Stomp_Phase_t) i),
+                         (unsigned long) _calls[i], (unsigned long long) ticks, share / 10, share % 10,
+                         (unsigned long long) (_calls[i] ? ticks / _calls[i] : 0));
+                out.println(line);
+            }
+        }
+
+    private:
+        StompProfiler() : _current(PHASE_LOOP), _since(0), _depth(0) {
+            reset();
+        }
+
+        uint64_t _ticks[PHASE_COUNT];
+        uint32_t _calls[PHASE_COUNT];
+        Stomp_Phase_t _current;
+        STOMP_PROFILE_TICKS _since;
+        uint8_t _depth;
+    };
+
+    class StompProfileScope {
+
+    public:
+        StompProfileScope(StompProfiler &profiler, Stomp_Phase_t phase) : _profiler(profiler),
+                                                                          _previous(profiler.enter(phase)) {
+        }
+
+        ~StompProfileScope() {
+            _profiler.leave(_previous);
+        }
+
+        StompProfileScope(const StompProfileScope &) = delete;
+
+        StompProfileScope &operator=(const StompProfileScope &) = delete;
+
+    private:
+        StompProfiler &_profiler;
+        Stomp_Phase_t _previous;
+    };
+
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef STOMP_RETRY_H
+#define STOMP_RETRY_H
+
+#include "Stomp.h"
+
+// The number of messages whose delivery attempts are counted at once
+#ifndef STOMP_RETRY_TRACKED
+#define STOMP_RETRY_TRACKED 16
+#endif
+
+// The number of NACKs which can be waiting for their delay at once. Further NACKs are sent immediately
+#ifndef STOMP_MAX_DELAYED_NACKS
+#define STOMP_MAX_DELAYED_NACKS 4
+#endif
+
+namespace Stomp {
+
+/**
+ * Called with a message which has been NACKed maxAttempts times. The message is then ACKed, so the broker stops
+ * redelivering it.
+ */
+    typedef StompDelegate<void(const StompCommand &message, uint8_t attempts)> StompDeadLetterHandler;
+
+/**
+ * How a subscription's NACKs are retried: the n-th NACK of a message is sent after baseDelay * 2^(n-1) ms, capped at
+ * maxDelay, and after maxAttempts NACKs the message goes to deadLetter instead.
+ *
+ * Retrying needs a CLIENT_INDIVIDUAL subscription. In CLIENT mode an ACK is cumulative: the ACK of a message received
+ * while another waits for its delayed NACK would settle that one too, and the NACK would then name a message the broker
+ * no longer holds (RabbitMQ closes the session for it).
+ *
+ * Attempts are counted per message, which the client recognises by its message-id header unless keyHeader names a
+ * header to use instead. Some brokers (RabbitMQ among them) give a redelivered message a new message-id, so each
+ * redelivery looks like a first attempt and the message is never dead-lettered. The redelivered header does not help:
+ * it says that a message has been delivered before, not how often. With such a broker, set keyHeader to a header the
+ * publisher sets once per message (e.g. "correlation-id" or an application "job-id"); messages without it fall back to
+ * their message-id.
+ */
+    struct StompRetryPolicy {
+        unsigned long baseDelay;
+        unsigned long maxDelay;
+        uint8_t maxAttempts;
+        StompDeadLetterHandler deadLetter;
+        const char *keyHeader;
+    };
+
+/**
+ * Counts NACKs per message key hash. When full, the entry counted longest ago is reused.
+ */
+    class StompRetryAttempts {
+
+    public:
+        StompRetryAttempts() : _next(0) {
+            for (auto &entry: _entries) {
+                entry.hash = 0;
+                entry.attempts = 0;
+            }
+        }
+
+        /**
+         * Count another attempt
+         * @return uint8_t - The number of attempts so far, including this one
+         */
+        uint8_t increment(uint32_t hash) {
+            for (auto &entry: _entries) {
+                if (entry.hash == hash) {
+                    if (entry.attempts < 255) entry.attempts++;
+                    return entry.attempts;
+                }
+            }
+
+            Entry &entry = _entries[_next];
+            _next = (_next + 1) % STOMP_RETRY_TRACKED;
+            entry.hash = hash;
+            entry.attempts = 1;
+            return 1;
+        }
+
+        void forget(uint32_t hash) {
+            for (auto &entry: _entries) {
+                if (entry.hash == hash) {
+                    entry.hash = 0;
+                    entry.attempts = 0;
+                }
+            }
+        }
+
+        /**
+         * The delay before the given attempt's NACK is sent
+         */
+        static unsigned long delay(const StompRetryPolicy &policy, uint8_t attempts) {
+            unsigned long delay = policy.baseDelay;
+            for (uint8_t i = 1; i < attempts && delay < policy.maxDelay; i++) {
+                delay *= 2;
+            }
+            return delay < policy.maxDelay ? delay : policy.maxDelay;
+        }
+
+    private:
+        struct Entry {
+            uint32_t hash;
+            uint8_t attempts;
+        };
+
+        Entry _entries[STOMP_RETRY_TRACKED];
+        uint8_t _next;
+    };
+
+}
+
+#endif
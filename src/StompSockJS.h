@@ -0,0 +1,208 @@
+#ifndef STOMP_SOCKJS_H
+#define STOMP_SOCKJS_H
+
+#include "Stomp.h"
+
+namespace Stomp {
+
+/**
+ * SockJS framing over its raw WebSocket transport. The server sends
+ *     o              - the session is open
+ *     h              - heart-beat
+ *     a["...","..."] - one or more messages, each a JSON string
+ *     c[code,"why"]  - the session is closed
+ * and the client sends each message as a JSON array of one string.
+ */
+    class StompSockJS {
+
+    public:
+        /**
+         * Wrap a frame for sending: ["<frame, JSON escaped>"]
+         * @param length size_t - Bytes of frame to send; include its NULL terminator to send one
+         */
+        static String encode(const char *frame, size_t length) {
+            String framed;
+            framed.reserve(length + length / 8 + 12);
+            framed += "[\"";
+            for (size_t i = 0; i < length; i++) {
+                _escape(framed, frame[i]);
+            }
+            framed += "\"]";
+            return framed;
+        }
+
+        /**
+         * Unwrap the messages of an 'a' frame (or, without the 'a', of a frame sent by a client), calling
+         * handler(String &message) for each. A trailing NULL terminator is removed from each message
+         * @return bool - false if the frame is malformed. Messages before the error have already been handled
+         */
+        template<typename Handler>
+        static bool decode(const char *payload, size_t length, Handler handler) {
+            const char *p = payload;
+            const char *end = payload + length;
+            if (p < end && *p == 'a') {
+                p++;
+            }
+            if (p >= end || *p != '[') {
+                return false;
+            }
+            p++;
+
+            String message;
+            while (true) {
+                p = _skipSpace(p, end);
+                if (p < end && *p == ']') {
+                    return true;
+                }
+                if (p >= end || *p != '"') {
+                    return false;
+                }
+                if (!_unescape(++p, end, message)) {
+                    return false;
+                }
+                unsigned int messageLength = message.length();
+                if (messageLength > 0 && message[messageLength - 1] == '\0') {
+                    message.remove(messageLength - 1);
+                }
+                handler(message);
+
+                p = _skipSpace(p, end);
+                if (p < end && *p == ',') {
+                    p++;
+                } else if (p >= end || *p != ']') {
+                    return false;
+                }
+            }
+        }
+
+    private:
+        static void _escape(String &out, char c) {
+            switch (c) {
+                case '"':
+                    out += "\\\"";
+                    break;
+                case '\\':
+                    out += "\\\\";
+                    break;
+                case '\n':
+                    out += "\\n";
+                    break;
+                case '\r':
+                    out += "\\r";
+                    break;
+                case '\t':
+                    out += "\\t";
+                    break;
+                default:
+                    if ((unsigned char) c < 0x20) {
+                        char code[7];
+                        snprintf(code, sizeof(code), "\\u%04x", (unsigned char) c);
+                        out += code;
+                    } else {
+                        out += c;
+                    }
+            }
+        }
+
+        static const char *_skipSpace(const char *p, const char *end) {
+            while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+                p++;
+            }
+            return p;
+        }
+
+        static int _hex(char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+
+        /**
+         * Read a JSON string body up to and including its closing quote into out, with \u escapes encoded as UTF-8
+         */
+        static bool _unescape(const char *&p, const char *end, String &out) {
+            out = "";
+            const char *run = p;
+            while (p < end) {
+                char c = *p;
+                if (c == '"') {
+                    out.concat(run, p - run);
+                    p++;
+                    return true;
+                }
+                if (c != '\\') {
+                    p++;
+                    continue;
+                }
+
+                out.concat(run, p - run);
+                if (++p >= end) {
+                    return false;
+                }
+                char decoded;
+                switch (*p++) {
+                    case 'n':
+                        decoded = '\n';
+                        break;
+                    case 'r':
+                        decoded = '\r';
+                        break;
+                    case 't':
+                        decoded = '\t';
+                        break;
+                    case 'b':
+                        decoded = '\b';
+                        break;
+                    case 'f':
+                        decoded = '\f';
+                        break;
+                    case 'u': {
+                        if (p + 4 > end) {
+                            return false;
+                        }
+                        long code = 0;
+                        for (uint8_t i = 0; i < 4; i++) {
+                            int digit = _hex(*p++);
+                            if (digit < 0) {
+                                return false;
+                            }
+                            code = code << 4 | digit;
+                        }
+                        _appendUtf8(out, code);
+                        run = p;
+                        continue;
+                    }
+                    default:
+                        // \" \\ \/
+                        decoded = p[-1];
+                }
+                out.concat(&decoded, 1);
+                run = p;
+            }
+            return false;
+        }
+
+        static void _appendUtf8(String &out, long code) {
+            char bytes[3];
+            unsigned int length;
+            if (code < 0x80) {
+                bytes[0] = (char) code;
+                length = 1;
+            } else if (code < 0x800) {
+                bytes[0] = (char) (0xC0 | code >> 6);
+                bytes[1] = (char) (0x80 | (code & 0x3F));
+                length = 2;
+            } else {
+                bytes[0] = (char) (0xE0 | code >> 12);
+                bytes[1] = (char) (0x80 | (code >> 6 & 0x3F));
+                bytes[2] = (char) (0x80 | (code & 0x3F));
+                length = 3;
+            }
+            out.concat(bytes, length);
+        }
+    };
+
+}
+
+#endif
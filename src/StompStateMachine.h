@@ -0,0 +1,152 @@
+#ifndef STOMP_STATE_MACHINE_H
+#define STOMP_STATE_MACHINE_H
+
+#include <Arduino.h>
+#include "Stomp.h"
+
+#define STOMP_STATE_COUNT 5
+
+namespace Stomp {
+
+/**
+ * Events which move the connection between states
+ */
+    typedef enum {
+        EVENT_BEGIN,          // begin() / failover: a new socket connection was requested
+        EVENT_SOCKET_OPEN,    // the WebSocket (or SockJS session) is open
+        EVENT_SOCKET_CLOSED,  // the WebSocket was closed
+        EVENT_CONNECTED,      // CONNECTED frame received
+        EVENT_ERROR,          // ERROR frame received
+        EVENT_DISCONNECT,     // DISCONNECT frame sent
+        EVENT_RECEIPT,        // receipt for DISCONNECT received
+        EVENT_TIMEOUT,        // the current state's timeout expired, or the broker's heart-beats stopped
+        EVENT_CLOSE           // the connection was abandoned locally
+    } Stomp_Event_t;
+
+/**
+ * Notified of every state change
+ */
+    typedef StompDelegate<void(Stomp_State_t from, Stomp_State_t to, Stomp_Event_t event)> StompTransitionHandler;
+
+    typedef struct {
+        Stomp_State_t from;
+        Stomp_Event_t event;
+        Stomp_State_t to;
+    } StompTransition;
+
+/**
+ * Drives a state from a fixed transition table. Each state can have a timeout, and the machine keeps count of how
+ * often and for how long each state has been occupied.
+ */
+    class StompStateMachine {
+
+    public:
+        StompStateMachine(const StompTransition *table, uint8_t size, Stomp_State_t initial) :
+                _table(table), _size(size), _state(initial), _previous(initial), _entered(millis()),
+                _handler(nullptr) {
+            for (uint8_t i = 0; i < STOMP_STATE_COUNT; i++) {
+                _timeouts[i] = 0;
+                _totals[i] = 0;
+                _entries[i] = 0;
+            }
+            _entries[initial] = 1;
+        }
+
+        Stomp_State_t state() const {
+            return _state;
+        }
+
+        /**
+         * The state occupied before the most recent transition
+         */
+        Stomp_State_t previous() const {
+            return _previous;
+        }
+
+        /**
+         * Apply the transition for event in the current state
+         * @return bool - false if the table has no transition, in which case the event is ignored
+         */
+        bool fire(Stomp_Event_t event) {
+            for (uint8_t i = 0; i < _size; i++) {
+                if (_table[i].from == _state && _table[i].event == event) {
+                    _enter(_table[i].to, event);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Limit the time spent in a state. 0 (the default) means no limit
+         */
+        void setTimeout(Stomp_State_t state, unsigned long timeout) {
+            _timeouts[state] = timeout;
+        }
+
+        unsigned long timeout(Stomp_State_t state) const {
+            return _timeouts[state];
+        }
+
+        /**
+         * True once the current state has outlived its timeout
+         */
+        bool timedOut() const {
+            unsigned long limit = _timeouts[_state];
+            return limit > 0 && timeInState() >= limit;
+        }
+
+        /**
+         * Time (ms) spent in the current state so far
+         */
+        unsigned long timeInState() const {
+            return millis() - _entered;
+        }
+
+        /**
+         * Total time (ms) spent in the given state, including the current visit
+         */
+        unsigned long totalTimeIn(Stomp_State_t state) const {
+            return _totals[state] + (state == _state ? timeInState() : 0);
+        }
+
+        /**
+         * The number of times the given state has been entered
+         */
+        uint32_t entries(Stomp_State_t state) const {
+            return _entries[state];
+        }
+
+        void onTransition(StompTransitionHandler handler) {
+            _handler = handler;
+        }
+
+    private:
+        const StompTransition *_table;
+        uint8_t _size;
+        Stomp_State_t _state;
+        Stomp_State_t _previous;
+        unsigned long _entered;
+        StompTransitionHandler _handler;
+
+        unsigned long _timeouts[STOMP_STATE_COUNT];
+        unsigned long _totals[STOMP_STATE_COUNT];
+        uint32_t _entries[STOMP_STATE_COUNT];
+
+        void _enter(Stomp_State_t to, Stomp_Event_t event) {
+            unsigned long now = millis();
+            _totals[_state] += now - _entered;
+            _entries[to]++;
+            _entered = now;
+            _previous = _state;
+            _state = to;
+
+            if (_handler) {
+                _handler(_previous, to, event);
+            }
+        }
+    };
+
+}
+
+#endif
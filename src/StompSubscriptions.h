@@ -0,0 +1,173 @@
+#ifndef STOMP_SUBSCRIPTIONS_H
+#define STOMP_SUBSCRIPTIONS_H
+
+#include "Stomp.h"
+
+// The number of subscription slots held inline in the client
+#ifndef STOMP_MAX_SUBSCRIPTIONS
+#define STOMP_MAX_SUBSCRIPTIONS 8
+#endif
+
+// The table grows on the heap (doubling) up to this many subscriptions. Defaults to no growth
+#ifndef STOMP_SUBSCRIPTIONS_LIMIT
+#define STOMP_SUBSCRIPTIONS_LIMIT STOMP_MAX_SUBSCRIPTIONS
+#endif
+
+namespace Stomp {
+
+/**
+ * Subscriptions indexed directly by their numeric id, so lookup is constant time however many there are.
+ * Freed ids are kept on a free list and handed out again before the table grows.
+ */
+    class StompSubscriptionTable {
+
+    public:
+        StompSubscriptionTable() : _slots(_inline), _capacity(STOMP_MAX_SUBSCRIPTIONS), _used(0), _count(0),
+                                   _freeHead(-1) {
+        }
+
+        ~StompSubscriptionTable() {
+            if (_slots != _inline) {
+                delete[] _slots;
+            }
+        }
+
+        StompSubscriptionTable(const StompSubscriptionTable &) = delete;
+
+        StompSubscriptionTable &operator=(const StompSubscriptionTable &) = delete;
+
+        /**
+         * Allocate a subscription
+         * @return StompSubscription* - The new subscription with its id set, or nullptr if the table is full.
+         *                              Pointers are invalidated when the table grows.
+         */
+        StompSubscription *add() {
+            long id;
+            if (_freeHead != -1) {
+                id = _freeHead;
+                _freeHead = _slots[id].nextFree;
+            } else {
+                if (_used == _capacity && !_grow()) {
+                    return nullptr;
+                }
+                id = _used++;
+            }
+
+            StompSubscription &subscription = _slots[id];
+            subscription = StompSubscription();
+            subscription.id = id;
+            subscription.nextFree = -1;
+            _count++;
+            return &subscription;
+        }
+
+        /**
+         * @return StompSubscription* - The active subscription with the given id, or nullptr
+         */
+        StompSubscription *get(long id) {
+            if (id < 0 || id >= _used || _slots[id].id != id) {
+                return nullptr;
+            }
+            return &_slots[id];
+        }
+
+        /**
+         * Release a subscription so that its id can be reused
+         * @return bool - false if there was no such subscription
+         */
+        bool remove(long id) {
+            if (get(id) == nullptr) {
+                return false;
+            }
+            _slots[id] = StompSubscription();
+            _slots[id].id = -1;
+            _slots[id].nextFree = _freeHead;
+            _freeHead = id;
+            _count--;
+            return true;
+        }
+
+        /**
+         * The number of active subscriptions
+         */
+        long count() const {
+            return _count;
+        }
+
+        /**
+         * The number of slots currently allocated
+         */
+        long capacity() const {
+            return _capacity;
+        }
+
+        /**
+         * Iterate over the active subscriptions
+         */
+        template<typename Visitor>
+        void forEach(Visitor visit) {
+            for (long i = 0; i < _used; i++) {
+                if (_slots[i].id == i) {
+                    visit(_slots[i]);
+                }
+            }
+        }
+
+        /**
+         * Parse the numeric id out of a "sub-<n>" subscription header without allocating
+         * @return long - The id, or -1 if the value is not one of ours
+         */
+        static long parseId(const String *value) {
+            return value == nullptr ? -1 : parseId(value->c_str(), value->length());
+        }
+
+        static long parseId(const char *value, unsigned int length) {
+            if (value == nullptr || length <= 4 || strncmp(value, "sub-", 4) != 0) {
+                return -1;
+            }
+
+            long id = 0;
+            for (unsigned int i = 4; i < length; i++) {
+                char c = value[i];
+                if (c < '0' || c > '9' || id > STOMP_SUBSCRIPTIONS_LIMIT) {
+                    return -1;
+                }
+                id = id * 10 + (c - '0');
+            }
+            return id;
+        }
+
+    private:
+        StompSubscription _inline[STOMP_MAX_SUBSCRIPTIONS];
+        StompSubscription *_slots;
+        long _capacity;
+        long _used;
+        long _count;
+        long _freeHead;
+
+        bool _grow() {
+            if (_capacity >= STOMP_SUBSCRIPTIONS_LIMIT) {
+                return false;
+            }
+
+            long capacity = _capacity * 2;
+            if (capacity > STOMP_SUBSCRIPTIONS_LIMIT) {
+                capacity = STOMP_SUBSCRIPTIONS_LIMIT;
+            }
+
+            StompSubscription *slots = new StompSubscription[capacity];
+            for (long i = 0; i < _used; i++) {
+                slots[i] = std::move(_slots[i]);
+            }
+            if (_slots != _inline) {
+                delete[] _slots;
+            }
+            _slots = slots;
+            _capacity = capacity;
+            return true;
+        }
+    };
+
+}
+
+#endif
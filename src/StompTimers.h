@@ -0,0 +1,99 @@
+#ifndef STOMP_TIMERS_H
+#define STOMP_TIMERS_H
+
+#include <Arduino.h>
+#include "StompDelegate.h"
+
+#ifndef STOMP_MAX_TIMERS
+#define STOMP_MAX_TIMERS 8
+#endif
+
+namespace Stomp {
+
+    typedef StompDelegate<void()> StompTimerHandler;
+
+/**
+ * Fixed set of one-shot and repeating millisecond timers, run from StompClient::loop(). Handlers run on the loop, so
+ * they may send frames; they should not block.
+ */
+    class StompTimers {
+
+    public:
+        StompTimers() {
+            for (auto &timer: _timers) {
+                timer.handler = nullptr;
+            }
+        }
+
+        /**
+         * Call handler once after delay ms, then every interval ms if interval is not 0
+         * @return int8_t - The timer's id, or -1 if all STOMP_MAX_TIMERS are in use
+         */
+        int8_t start(unsigned long delay, StompTimerHandler handler, unsigned long interval = 0) {
+            if (!handler) {
+                return -1;
+            }
+            for (int8_t id = 0; id < STOMP_MAX_TIMERS; id++) {
+                Timer &timer = _timers[id];
+                if (!timer.handler) {
+                    timer.handler = handler;
+                    timer.started = millis();
+                    timer.delay = delay;
+                    timer.interval = interval;
+                    return id;
+                }
+            }
+            return -1;
+        }
+
+        bool cancel(int8_t id) {
+            if (!active(id)) {
+                return false;
+            }
+            _timers[id].handler = nullptr;
+            return true;
+        }
+
+        bool active(int8_t id) const {
+            return id >= 0 && id < STOMP_MAX_TIMERS && (bool) _timers[id].handler;
+        }
+
+        /**
+         * Call the handlers of the timers which are due
+         */
+        void run() {
+            unsigned long now = millis();
+            for (auto &timer: _timers) {
+                if (!timer.handler || now - timer.started < timer.delay) {
+                    continue;
+                }
+
+                // Copy the handler: it may cancel or restart its own timer
+                StompTimerHandler handler = timer.handler;
+                if (timer.interval > 0) {
+                    timer.started += timer.delay;
+                    timer.delay = timer.interval;
+                    if (now - timer.started >= timer.delay) {
+                        timer.started = now;  // fell behind: skip the missed ticks
+                    }
+                } else {
+                    timer.handler = nullptr;
+                }
+                handler();
+            }
+        }
+
+    private:
+        struct Timer {
+            StompTimerHandler handler;
+            unsigned long started;
+            unsigned long delay;
+            unsigned long interval;
+        };
+
+        Timer _timers[STOMP_MAX_TIMERS];
+    };
+
+}
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef STOMP_TOPIC_ROUTER_H
+#define STOMP_TOPIC_ROUTER_H
+
+#include "Stomp.h"
+
+#ifndef STOMP_ROUTER_MAX_NODES
+#define STOMP_ROUTER_MAX_NODES 32
+#endif
+
+#ifndef STOMP_ROUTER_MAX_ROUTES
+#define STOMP_ROUTER_MAX_ROUTES 32
+#endif
+
+namespace Stomp {
+
+/**
+ * Routes messages from one broker subscription to many local handlers by destination pattern.
+ *
+ * Patterns are split into segments on the separator ('/' by default, '.' for RabbitMQ style topics) and compiled into
+ * a trie when added. A "*" segment matches exactly one segment, a "#" segment matches zero or more. Matching a
+ * destination walks the trie without allocating.
+ *
+ * Typical use: subscribe once to a broker wildcard, e.g. "/topic/devices.#", and add() the fine-grained patterns.
+ */
+    class StompTopicRouter {
+
+    public:
+        explicit StompTopicRouter(char separator = '/') : _separator(separator), _nodeCount(1), _routeCount(0),
+                                                          _generation(0), _unmatched(ACK) {
+            _nodes[0] = Node();
+        }
+
+        /**
+         * Register a handler for destinations matching pattern
+         * @return bool - false if STOMP_ROUTER_MAX_NODES or STOMP_ROUTER_MAX_ROUTES would be exceeded
+         */
+        bool add(const String &pattern, StompMessageHandler handler) {
+            if (_routeCount >= STOMP_ROUTER_MAX_ROUTES) {
+                return false;
+            }
+
+            int16_t node = 0;
+            int16_t mark = _nodeCount;     // nodes from here on were created by this call
+            int16_t grafted = -1;          // the existing node the first of them hangs from
+            unsigned int start = 0;
+            while (start <= pattern.length()) {
+                int end = pattern.indexOf(_separator, start);
+                if (end == -1) {
+                    end = pattern.length();
+                }
+
+                int16_t parent = node;
+                node = _child(parent, pattern.substring(start, end));
+                if (node == -1) {
+                    _rollback(mark, grafted);
+                    return false;
+                }
+                if (node == mark) {
+                    grafted = parent;
+                }
+                start = end + 1;
+            }
+
+            Route &route = _routes[_routeCount];
+            route.handler = handler;
+            route.next = _nodes[node].firstRoute;
+            route.generation = 0;
+            _nodes[node].firstRoute = _routeCount++;
+            return true;
+        }
+
+        /**
+         * The decision returned when no pattern matches. Defaults to ACK, so unwanted messages are discarded.
+         */
+        void setUnmatched(Stomp_Ack_t ack) {
+            _unmatched = ack;
+        }
+
+        /**
+         * Call every handler whose pattern matches the message's destination. Each handler is called at most once.
+         * @return Stomp_Ack_t - NACK if any handler returned NACK, otherwise ACK if any returned ACK, otherwise
+         *                       CONTINUE. The unmatched decision if no handler matched.
+         */
+        Stomp_Ack_t route(const StompCommand &message) {
+            const String *destination = message.headers.find("destination");
+            if (destination == nullptr) {
+                return _unmatched;
+            }
+
+            if (++_generation == 0) {
+                for (int16_t r = 0; r < _routeCount; r++) {
+                    _routes[r].generation = 0;
+                }
+                _generation = 1;
+            }
+            _matched = false;
+            _result = CONTINUE;
+            _match(0, destination->c_str(), message);
+
+            return _matched ? _result : _unmatched;
+        }
+
+    private:
+        typedef enum {
+            LITERAL,
+            ONE,   // *
+            MANY   // #
+        } NodeKind;
+
+        struct Node {
+            String segment;
+            NodeKind kind = LITERAL;
+            int16_t firstChild = -1;
+            int16_t nextSibling = -1;
+            int16_t firstRoute = -1;
+        };
+
+        struct Route {
+            StompMessageHandler handler;
+            int16_t next;
+            uint16_t generation;
+        };
+
+        char _separator;
+        Node _nodes[STOMP_ROUTER_MAX_NODES];
+        Route _routes[STOMP_ROUTER_MAX_ROUTES];
+        int16_t _nodeCount;
+        int16_t _routeCount;
+        uint16_t _generation;
+        Stomp_Ack_t _unmatched;
+
+        bool _matched;
+        Stomp_Ack_t _result;
+
+        /**
+         * Find or create the child of parent for one pattern segment
+         */
+        int16_t _child(int16_t parent, const String &segment) {
+            NodeKind kind = segment.equals("*") ? ONE : segment.equals("#") ? MANY : LITERAL;
+
+            for (int16_t c = _nodes[parent].firstChild; c != -1; c = _nodes[c].nextSibling) {
+                if (_nodes[c].kind == kind && (kind != LITERAL || _nodes[c].segment.equals(segment))) {
+                    return c;
+                }
+            }
+
+            if (_nodeCount >= STOMP_ROUTER_MAX_NODES) {
+                return -1;
+            }
+
+            int16_t c = _nodeCount++;
+            _nodes[c].kind = kind;
+            if (kind == LITERAL) {
+                _nodes[c].segment = segment;
+            }
+            _nodes[c].nextSibling = _nodes[parent].firstChild;
+            _nodes[parent].firstChild = c;
+            return c;
+        }
+
+        /**
+         * Remove the nodes created by an add() which ran out of room, so that they do not take up the table
+         */
+        void _rollback(int16_t mark, int16_t grafted) {
+            if (grafted == -1) {
+                return;
+            }
+            // the first new node was pushed onto the front of grafted's children, the rest hang below it
+            _nodes[grafted].firstChild = _nodes[mark].nextSibling;
+            for (int16_t c = mark; c < _nodeCount; c++) {
+                _nodes[c] = Node();
+            }
+            _nodeCount = mark;
+        }
+
+        /**
+         * @return const char* - The start of the segment after the one starting at p, nullptr if p is the last
+         */
+        const char *_next(const char *p) const {
+            const char *separator = strchr(p, _separator);
+            return separator ? separator + 1 : nullptr;
+        }
+
+        bool _segmentEquals(const Node &node, const char *p) const {
+            const char *separator = strchr(p, _separator);
+            size_t length = separator ? (size_t) (separator - p) : strlen(p);
+            return node.segment.length() == length && memcmp(node.segment.c_str(), p, length) == 0;
+        }
+
+        /**
+         * Match the destination from segment p (nullptr once every segment has been consumed) below node
+         */
+        void _match(int16_t node, const char *p, const StompCommand &message) {
+            if (p == nullptr) {
+                _fire(_nodes[node], message);
+            }
+
+            for (int16_t c = _nodes[node].firstChild; c != -1; c = _nodes[c].nextSibling) {
+                const Node &child = _nodes[c];
+                if (child.kind == MANY) {
+                    // consume zero, one, two... segments
+                    const char *q = p;
+                    while (true) {
+                        _match(c, q, message);
+                        if (q == nullptr) break;
+                        q = _next(q);
+                    }
+                } else if (p != nullptr && (child.kind == ONE || _segmentEquals(child, p))) {
+                    _match(c, _next(p), message);
+                }
+            }
+        }
+
+        void _fire(const Node &node, const StompCommand &message) {
+            for (int16_t r = node.firstRoute; r != -1; r = _routes[r].next) {
+                Route &route = _routes[r];
+                if (route.generation == _generation || !route.handler) {
+                    continue;
+                }
+                route.generation = _generation;
+                _matched = true;
+
+                Stomp_Ack_t ack = route.handler(message);
+                if (ack == NACK || (ack == ACK && _result == CONTINUE)) {
+                    _result = ack;
+                }
+            }
+        }
+    };
+
+}
+
+#endif
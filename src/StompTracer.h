@@ -0,0 +1,235 @@
+#ifndef STOMP_TRACER_H
+#define STOMP_TRACER_H
+
+#include "Stomp.h"
+#include "StompMetrics.h"
+
+// The number of destinations with their own latency histograms
+#ifndef STOMP_TRACE_DESTINATIONS
+#define STOMP_TRACE_DESTINATIONS 4
+#endif
+
+// The number of traced SENDs awaiting their receipt
+#ifndef STOMP_TRACE_PENDING
+#define STOMP_TRACE_PENDING 8
+#endif
+
+// The number of recent round trips from which the broker clock offset is chosen
+#ifndef STOMP_TRACE_SAMPLES
+#define STOMP_TRACE_SAMPLES 8
+#endif
+
+namespace Stomp {
+
+/**
+ * End-to-end latency tracing. While a tracer is set, every SEND carries
+ *     trace-origin:<this client>  trace-sent:<millis()>  receipt:trace-<n>
+ * and for each destination the tracer keeps histograms (ms) of:
+ *  - roundTrip: SEND until the broker's RECEIPT
+ *  - endToEnd:  SEND until our own message comes back on a subscription
+ *  - delivery:  the broker's timestamp header until a MESSAGE arrives, once the broker clock offset is known
+ *
+ * The broker clock offset is estimated NTP-style from our own messages coming back with a broker timestamp: with
+ * send time t0, broker time T and receive time t3, offset = T - (t0 + t3) / 2, good to within (t3 - t0) / 2. The
+ * sample with the smallest round trip among the last STOMP_TRACE_SAMPLES is used.
+ */
+    class StompTracer {
+
+    public:
+        struct Destination {
+            String name;
+            StompHistogram roundTrip;
+            StompHistogram endToEnd;
+            StompHistogram delivery;
+        };
+
+        StompTracer() : _origin((uint32_t) random(0x7FFFFFFF)), _sequence(0), _samples(0), _nextSample(0),
+                        _timestampHeader("timestamp") {
+            for (auto &pending: _pending) {
+                pending.sequence = 0;
+            }
+        }
+
+        /**
+         * The header in which the broker puts its time (ms since the epoch) on MESSAGEs. Defaults to "timestamp"
+         */
+        void setTimestampHeader(const char *header) {
+            _timestampHeader = header;
+        }
+
+        /**
+         * @return Destination* - The histograms of the given destination, or nullptr if it has not been traced
+         */
+        const Destination *destination(const String &name) const {
+            for (const auto &destination: _destinations) {
+                if (destination.name.length() > 0 && destination.name.equals(name)) {
+                    return &destination;
+                }
+            }
+            return nullptr;
+        }
+
+        const Destination *destination(uint8_t index) const {
+            return index < STOMP_TRACE_DESTINATIONS && _destinations[index].name.length() > 0 ?
+                   &_destinations[index] : nullptr;
+        }
+
+        /**
+         * The estimated broker clock offset: broker time = millis() + offset
+         * @param error uint32_t* - If given, set to the maximum error of the estimate in ms
+         * @return bool           - false until a sample has been taken
+         */
+        bool offset(int64_t *offset, uint32_t *error = nullptr) const {
+            int best = _bestSample();
+            if (best == -1) {
+                return false;
+            }
+            *offset = _offsetSamples[best].offset;
+            if (error) {
+                *error = _offsetSamples[best].roundTrip / 2;
+            }
+            return true;
+        }
+
+        /**
+         * Headers for an outgoing SEND, appended to lines
+         * @return uint8_t - The number of lines added
+         */
+        uint8_t stamp(const String &destination, String lines[]) {
+            if (++_sequence == 0) {
+                _sequence = 1;
+            }
+
+            Pending &pending = _pending[_sequence % STOMP_TRACE_PENDING];
+            pending.sequence = _sequence;
+            pending.sentAt = millis();
+            pending.destination = _index(destination);
+
+            lines[0] = "trace-origin:" + String(_origin);
+            lines[1] = "trace-sent:" + String(pending.sentAt);
+            lines[2] = "receipt:trace-" + String(_sequence);
+            return 3;
+        }
+
+        /**
+         * A RECEIPT arrived
+         * @return bool - true if it was for a traced SEND
+         */
+        bool receipt(const String &receiptId) {
+            if (!receiptId.startsWith("trace-")) {
+                return false;
+            }
+
+            uint32_t sequence = (uint32_t) _parse(receiptId.c_str() + 6);
+            Pending &pending = _pending[sequence % STOMP_TRACE_PENDING];
+            if (pending.sequence == sequence && sequence != 0) {
+                pending.sequence = 0;
+                if (pending.destination != -1) {
+                    _destinations[pending.destination].roundTrip.record(millis() - pending.sentAt);
+                }
+            }
+            return true;
+        }
+
+        /**
+         * A MESSAGE arrived
+         */
+        void received(const StompCommand &message) {
+            unsigned long now = millis();
+            const String *destinationName = message.headers.find("destination");
+            int8_t destination = destinationName ? _index(*destinationName) : -1;
+
+            const String *timestamp = message.headers.find(_timestampHeader);
+            int64_t brokerTime = timestamp ? _parse(timestamp->c_str()) : 0;
+
+            const String *origin = message.headers.find("trace-origin");
+            const String *sent = message.headers.find("trace-sent");
+            if (origin && sent && (uint32_t) _parse(origin->c_str()) == _origin) {
+                unsigned long sentAt = (unsigned long) _parse(sent->c_str());
+                unsigned long roundTrip = now - sentAt;
+                if (destination != -1) {
+                    _destinations[destination].endToEnd.record(roundTrip);
+                }
+                if (brokerTime > 0) {
+                    _sample(brokerTime - (int64_t) sentAt - (int64_t) (roundTrip / 2), roundTrip);
+                }
+                return;
+            }
+
+            int64_t offset;
+            if (brokerTime > 0 && destination != -1 && this->offset(&offset)) {
+                int64_t delivery = (int64_t) now + offset - brokerTime;
+                _destinations[destination].delivery.record(delivery > 0 ? (uint32_t) delivery : 0);
+            }
+        }
+
+    private:
+        struct Pending {
+            uint32_t sequence;
+            unsigned long sentAt;
+            int8_t destination;
+        };
+
+        struct Sample {
+            int64_t offset;
+            uint32_t roundTrip;
+        };
+
+        uint32_t _origin;
+        uint32_t _sequence;
+        Pending _pending[STOMP_TRACE_PENDING];
+        Destination _destinations[STOMP_TRACE_DESTINATIONS];
+        Sample _offsetSamples[STOMP_TRACE_SAMPLES];
+        uint8_t _samples;
+        uint8_t _nextSample;
+        const char *_timestampHeader;
+
+        /**
+         * @return int8_t - The slot for destination, claiming a free one if need be, or -1 if all are taken
+         */
+        int8_t _index(const String &destination) {
+            for (int8_t i = 0; i < STOMP_TRACE_DESTINATIONS; i++) {
+                if (_destinations[i].name.equals(destination)) {
+                    return i;
+                }
+                if (_destinations[i].name.length() == 0) {
+                    _destinations[i].name = destination;
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        void _sample(int64_t offset, uint32_t roundTrip) {
+            _offsetSamples[_nextSample] = {offset, roundTrip};
+            _nextSample = (_nextSample + 1) % STOMP_TRACE_SAMPLES;
+            if (_samples < STOMP_TRACE_SAMPLES) {
+                _samples++;
+            }
+        }
+
+        int _bestSample() const {
+            int best = -1;
+            for (uint8_t i = 0; i < _samples; i++) {
+                if (best == -1 || _offsetSamples[i].roundTrip < _offsetSamples[best].roundTrip) {
+                    best = i;
+                }
+            }
+            return best;
+        }
+
+        /**
+         * Parse a decimal integer which may not fit in a long (e.g. ms since the epoch)
+         */
+        static int64_t _parse(const char *p) {
+            int64_t value = 0;
+            for (; *p >= '0' && *p <= '9'; p++) {
+                value = value * 10 + (*p - '0');
+            }
+            return value;
+        }
+    };
+
+}
+
+#endif